@@ -0,0 +1,49 @@
+#ifndef ACTIVITY_PROFILE_H_
+#define ACTIVITY_PROFILE_H_
+
+#include <Arduino.h>
+
+#define PROFILE_IDLE_AFTER  60000 // ms with every amp off and nothing going on before going idle
+
+/**
+ * Whether the firmware should be quick or frugal. Active while an amp is
+ * on and for a while after anything happens; idle otherwise, which is
+ * most of the day. main.cpp applies the profile (task intervals, Wi-Fi
+ * sleep, the loop() delay) and calls wake() on a power edge, IR activity
+ * or a command, which switches to active right away.
+ */
+class ActivityProfile {
+  public:
+    enum Profile : uint8_t { Active, Idle };
+
+    ActivityProfile();
+
+    /** Something that wants low latency happened, true when it woke us up */
+    bool wake(const char* reason);
+    /** An input was handled: a command, a getter, a power edge or a remote
+     *  frame. The first one after a wake is timed */
+    void handled();
+    /** Goes idle once quiet for PROFILE_IDLE_AFTER, busy keeps us active.
+     *  True when the profile changed */
+    bool update(bool busy);
+    /** ms spent in profile since boot */
+    uint32_t timeIn(Profile p) const;
+
+    Profile profile;
+    const char* wakeReason;     // What woke us up last
+    uint32_t wakes;
+    uint32_t wakeLatency;       // ms from the last wake to the first input handled after it
+    uint32_t maxWakeLatency;
+
+  private:
+    void enter(Profile p);
+
+    unsigned long lastActivity;
+    unsigned long entered;      // millis() the profile was entered
+    uint32_t spent[2];          // ms, not counting the current stay
+    bool timing;                // Waiting for the first input handled after a wake
+};
+
+extern ActivityProfile activity;
+
+#endif // ACTIVITY_PROFILE_H_
@@ -0,0 +1,97 @@
+#ifndef COMMAND_ROUTER_H_
+#define COMMAND_ROUTER_H_
+
+#include <Arduino.h>
+
+#include "SpscQueue.hpp"
+#include "Z906Controller.h"
+
+#define COMMAND_QUEUE_SIZE  8
+#define EVENT_QUEUE_SIZE    16
+#define COMMAND_ALL         0xFF  // Command target for group commands
+#define REQUEST_MAX_SIZE    512   // Longer POST bodies are refused, longer MQTT packets never reach us
+#define EVENTS_PER_COMMAND  2     // Room a command needs per controller, its answer and a state update
+
+/** A request for one controller, or all of them */
+struct Command {
+  uint32_t id;
+  uint8_t target;   // Index in the controllers or COMMAND_ALL
+  HistorySource source;
+  unsigned long queued; // millis(), for the latency in RuntimeStats
+  String req;
+};
+
+/** An MQTT message to publish, or the answer to a command */
+struct Event {
+  uint32_t id;      // The command it answers, 0 when the IR context posted it on its own
+  String topic;
+  String payload;
+};
+
+/**
+ * Hands requests from the network context (web server, MQTT) to the
+ * controllers and their responses back. Every request, getters too, is
+ * queued and run by the IR context one per pass, once the transmitters
+ * have room for a whole sequence, so nothing ever waits for the IR to go
+ * out and only the IR context touches the controllers. The response comes
+ * back as an event with the id of its command. post() and receive() are
+ * what the web server and the MQTT callback do with a request, so the host
+ * tests take the same way in.
+ */
+class CommandRouter {
+  public:
+    CommandRouter();
+
+    void begin(Z906Controller* controllers, uint8_t count);
+
+    /** Network side. Answers a POST to controller target: 413 over
+     *  REQUEST_MAX_SIZE, 400 when it isn't JSON and 503 when the command
+     *  queue is full. Otherwise the command is queued and post() runs
+     *  onWait until its answer is back, 200 with it, or the IR context
+     *  can't take it yet, 202 then and the answer goes out as an event */
+    int post(uint8_t target, const String& req, String& response);
+    /** Network side. Queues an MQTT command, false with why in error when it's dropped */
+    bool receive(uint8_t target, const String& req, String& error);
+    /** Network side. Queues req for the IR context, returns its id or 0 when the queue is full */
+    uint32_t queue(uint8_t target, const String& req, HistorySource source);
+    /** IR side. Runs the oldest queued command once its controllers are
+     *  ready and the event queue has room for what it says, the responses
+     *  go out as events. False when nothing ran */
+    bool runNext();
+
+    /** IR side. Queues an MQTT message for the network context, false when the queue is full */
+    bool postEvent(const char* topic, String payload, uint32_t id = 0);
+    /** Network side */
+    bool popEvent(Event& event) { return events.pop(event); }
+
+    SpscQueue<Command, COMMAND_QUEUE_SIZE> commands;  // Network -> IR
+    SpscQueue<Event, EVENT_QUEUE_SIZE> events;        // IR -> network
+    void (*onWake)(const char* reason);               // A valid request came in
+    /** Lets the IR context run while post() waits, false once it can't
+     *  make progress. On the board the contexts take turns in loop(), so
+     *  this runs runNext(). Left NULL when the IR context has a thread of
+     *  its own, post() answers 202 unless the answer is already back */
+    bool (*onWait)();
+    /** Publishes the events post() pops while it waits that aren't its answer */
+    void (*onEvent)(const Event& event);
+
+  private:
+    /** target (or all of them) can take a sequence */
+    bool controllersReady(uint8_t target) const;
+    /** The network context took enough events off for target's answers */
+    bool eventsRoom(uint8_t target) const;
+    String handle(uint8_t i, const String& req, HistorySource source);
+    /** Pops events until the answer to id, handing the others to onEvent */
+    bool takeAnswer(uint32_t id, String& response);
+
+    Z906Controller* controllers;
+    uint8_t count;
+    uint32_t nextId;        // Network side
+};
+
+extern CommandRouter router;
+
+/** False when req isn't JSON (or doesn't fit REQUEST_DOC_SIZE) */
+bool isValidRequest(const String& req);
+
+#endif // COMMAND_ROUTER_H_
@@ -46,7 +46,7 @@
   #define Debugf(...)
 #endif
 
-void chipInformation() {
+inline void chipInformation() {
   Serial.println();
   Serial.print( F("Heap: ") );  Serial.println(system_get_free_heap_size());
   Serial.print( F("Boot Vers: ") );  Serial.println(system_get_boot_version());
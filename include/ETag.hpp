@@ -0,0 +1,39 @@
+#ifndef ETAG_H_
+#define ETAG_H_
+
+#include <Arduino.h>
+
+/* Conditional GETs for the web server's resources. A resource's ETag is
+ * the boot tag and its version, the boot tag keeps the tags from repeating
+ * when the version counters restart at 0 after a reboot */
+
+/** A boot tag, new on every boot */
+inline String newBootTag() {
+  return String(ESP.random(), HEX);
+}
+
+/** The quoted ETag of a resource at version */
+inline String makeETag(const String& bootTag, const String& version) {
+  return "\"" + bootTag + "-" + version + "\"";
+}
+
+/** True when an If-None-Match header lists etag (or is "*") */
+inline bool etagMatches(const String& ifNoneMatch, const String& etag) {
+  return ifNoneMatch.length() > 0 && (ifNoneMatch == "*" || ifNoneMatch.indexOf(etag) >= 0);
+}
+
+/** Sends the ETag and answers 304 if the client has that version already.
+ *  Returns true when it did, the resource needn't be serialized then.
+ *  Server is an ESP8266WebServer collecting If-None-Match */
+template<typename Server>
+bool notModified(Server& server, const String& etag) {
+  server.sendHeader("ETag", etag);
+  server.sendHeader("Cache-Control", "no-cache");
+  if(etagMatches(server.header("If-None-Match"), etag)) {
+    server.send(304);
+    return true;
+  }
+  return false;
+}
+
+#endif // ETAG_H_
@@ -0,0 +1,71 @@
+#ifndef IR_BINDINGS_H_
+#define IR_BINDINGS_H_
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <IRremoteESP8266.h>
+
+#include "NecWaveform.h"
+
+#define BINDING_SLOTS       64    // Power of two
+#define BINDING_MAX_LOAD    48    // Used + deleted slots before the table is rebuilt
+#define BINDINGS_FILE       "/bindings.bin"
+#define LEARN_TIMEOUT       15000 // ms learn mode waits for a key
+
+/**
+ * Codes from other remotes (any protocol IRremoteESP8266 decodes) bound to
+ * Z906 keys, e.g. the TV remote's volume keys to Plus/Minus. The table is
+ * open addressing with linear probing, so a lookup on the receive path is
+ * a hash and a probe or two however many codes are bound. It's kept in
+ * LittleFS as the raw table and rewritten when a binding changes.
+ */
+class IRBindings {
+  public:
+    bool begin();
+
+    /** The Z906 key bound to the code, 0 if none */
+    uint32_t find(decode_type_t protocol, uint64_t value, uint16_t bits) const;
+    bool bind(decode_type_t protocol, uint64_t value, uint16_t bits, uint32_t key);
+    /** Removes every code bound to key (all of them for 0), returns how many */
+    uint8_t unbind(uint32_t key);
+    void list(JsonArray bindings) const;
+
+    /** Waits for the next code from another remote to bind to key */
+    void learn(uint32_t key);
+    void stopLearning() { learnKey = 0; }
+    bool learning() const { return learnKey != 0 && millis() - learnStarted < LEARN_TIMEOUT; }
+    uint32_t learnKey;
+
+    /** True when a binding is in a protocol only IRrecv decodes */
+    bool needsIRrecv() const { return foreign > 0; }
+    uint8_t count;
+
+  private:
+    enum SlotState : uint8_t { Empty, Used, Deleted };
+    struct Slot {
+      uint64_t value;
+      uint32_t key;
+      int16_t protocol;
+      uint8_t bits;
+      SlotState state;
+    };
+
+    static uint8_t hash(int16_t protocol, uint64_t value, uint16_t bits);
+    int16_t findSlot(int16_t protocol, uint64_t value, uint16_t bits) const;
+    void insert(const Slot& slot);
+    void rebuild();
+    void recount();
+    bool save();
+
+    Slot slots[BINDING_SLOTS];
+    uint8_t deleted;
+    uint8_t foreign;
+    unsigned long learnStarted;
+};
+
+/** The Z906 key called name ("Plus", "Input 1", ... see keyName()), 0 if none */
+uint32_t keyByName(const char* name);
+
+extern IRBindings bindings;
+
+#endif // IR_BINDINGS_H_
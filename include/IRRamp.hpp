@@ -0,0 +1,126 @@
+#ifndef IR_RAMP_H_
+#define IR_RAMP_H_
+
+#include <stdint.h>
+
+#include "NecWaveform.h"
+
+#define NEC_FRAME_PERIOD_MS (NEC_FRAME_PERIOD / 1000)
+#define NEC_HOLD_TIMEOUT    200 // ms without a repeat frame before a held key counts as released
+#define BOUND_HOLD_TIMEOUT  (NEC_HOLD_TIMEOUT + NEC_FRAME_PERIOD_MS) // Echoing a bound key costs one repeat now and then
+#define RAMP_REPEAT_LEAD    30  // ms a repeat step is queued early so it follows the previous frame back to back
+
+/**
+ * Step interval of a ramp: the first step waits startMs, every following
+ * interval is percent % of the previous one but never below minMs.
+ */
+struct RampCurve {
+  uint16_t startMs;
+  uint16_t minMs;
+  uint8_t percent;
+};
+
+/** Default curve, accelerates into back to back NEC repeat frames */
+const RampCurve rampAccelerate = { 250, NEC_FRAME_PERIOD_MS, 70 };
+
+/**
+ * Schedules the key presses of a ramp (e.g. volume 10 -> 30). Once the
+ * interval has come down to the NEC frame period the steps are sent as NEC
+ * repeat frames, which take 11.8 ms of airtime instead of 67.5 ms.
+ * Times are in ms (millis()), poll() tells when and how to send the next step.
+ */
+class IRRamp {
+  public:
+    enum Step : uint8_t { None, Frame, Repeat };
+
+    IRRamp() : code(0), total(0), done(0), running(false) {}
+
+    void start(uint32_t code, uint16_t steps, uint32_t now, const RampCurve& curve) {
+      this->code = code;
+      this->curve = curve;
+      if(this->curve.minMs < NEC_FRAME_PERIOD_MS) this->curve.minMs = NEC_FRAME_PERIOD_MS;
+      total = steps;
+      done = 0;
+      interval = 0;
+      nextAt = now;
+      startedAt = now;
+      running = steps > 0;
+    }
+
+    /** Ramp with evenly spaced steps lasting about durationMs */
+    void startTimed(uint32_t code, uint16_t steps, uint32_t durationMs, uint32_t now) {
+      uint32_t stepMs = steps > 0 ? durationMs / steps : 0;
+      if(stepMs > 0xFFFF) stepMs = 0xFFFF;
+      RampCurve linear = { (uint16_t)stepMs, (uint16_t)stepMs, 100 };
+      start(code, steps, now, linear);
+    }
+
+    void cancel() { running = false; }
+    bool active() const { return running; }
+
+    /** Returns the step due at now, the caller has to send it right away */
+    Step poll(uint32_t now) {
+      if(!running) return None;
+      // Repeats only count if they directly follow the previous frame
+      Step step = (done > 0 && interval <= NEC_FRAME_PERIOD_MS) ? Repeat : Frame;
+      uint32_t lead = step == Repeat ? RAMP_REPEAT_LEAD : 0;
+      if((int32_t)(now + lead - nextAt) < 0) return None;
+
+      interval = done == 0 ? curve.startMs : (uint32_t)interval * curve.percent / 100;
+      if(interval < curve.minMs) interval = curve.minMs;
+      nextAt += interval;
+      if(++done >= total) running = false;
+      return step;
+    }
+
+    uint32_t code;
+    uint16_t total;
+    uint16_t done;
+    uint32_t startedAt;
+
+  private:
+    RampCurve curve;
+    uint16_t interval; // Interval that preceded the next step
+    uint32_t nextAt;
+    bool running;
+};
+
+/**
+ * Follows a key held on a remote. Resolves NEC repeat frames to the key they
+ * belong to, as long as they keep arriving within timeout ms.
+ */
+class IRHold {
+  public:
+    IRHold(uint16_t timeout = NEC_HOLD_TIMEOUT) : key(0), repeats(0), timeout(timeout), lastAt(0), pressedAt(0) {}
+
+    /** Returns the key code the received frame stands for, NEC_REPEAT if orphaned */
+    uint32_t onFrame(uint32_t code, uint32_t now) {
+      if(code == NEC_REPEAT) {
+        if(key == 0 || now - lastAt > timeout) return NEC_REPEAT;
+        repeats++;
+      } else {
+        key = code;
+        repeats = 0;
+        pressedAt = now;
+      }
+      lastAt = now;
+      return key;
+    }
+
+    bool held(uint32_t now) const { return key != 0 && now - lastAt <= timeout; }
+
+    /** Repeats the remote has sent by now, heard or not. Repeat n starts n
+     *  frame periods after the key frame, which is decoded about half a
+     *  period later in its frame than a repeat */
+    uint16_t repeatsBy(uint32_t now) const { return (now - pressedAt + NEC_FRAME_PERIOD_MS) / NEC_FRAME_PERIOD_MS; }
+
+    uint32_t key;
+    uint16_t repeats;
+
+  private:
+    uint16_t timeout;
+    uint32_t lastAt;
+    uint32_t pressedAt;
+};
+
+#endif // IR_RAMP_H_
@@ -0,0 +1,107 @@
+#ifndef IR_TRANSMITTER_H_
+#define IR_TRANSMITTER_H_
+
+#include <Arduino.h>
+
+#include "NecWaveform.h"
+
+#define IR_TX_QUEUE_SIZE    32  // Presses (each with its repeats) that can wait to be sent, two IRSequences
+#define IR_TX_MAX_CHANNELS  4   // IR LEDs that can transmit at the same time
+
+/**
+ * Sends the precomputed NEC waveforms without holding the CPU.
+ * timer0 clocks both the mark/space envelope and, during a mark, every half
+ * period of the 38 kHz carrier, which goes straight to the GPIO set/clear
+ * registers. The core's startWaveform()/stopWaveform() wait on the timer1
+ * interrupt and must not be called from ours. send() only queues the frame
+ * and returns. Every IR LED gets its own transmitter; timer0 is shared and
+ * always armed for whichever transmitter is due first, so frames to
+ * different LEDs interleave instead of waiting on each other.
+ */
+class IRTransmitter {
+  public:
+    IRTransmitter(uint8_t pin);
+    /** Takes one of the IR_TX_MAX_CHANNELS channels. Returns false when they
+     *  are all taken or pin is GPIO16, which isn't on the GPIO registers;
+     *  send() refuses everything then */
+    bool begin();
+
+    /** Queues times presses of code, each followed by repeat NEC repeat
+     *  frames and gapMs of silence. Never waits, returns false if code has no
+     *  precomputed waveform, the queue is full or begin() failed */
+    bool send(uint32_t code, uint16_t repeat = 0, uint16_t gapMs = 0, uint8_t times = 1);
+    /** Queues repeat NEC repeat frames. The receiver only accepts them if they
+     *  follow the frame of a held key without a gap */
+    bool sendRepeat(uint16_t repeat, uint16_t gapMs = 0);
+    bool busy() const { return running || head != tail; }
+    /** Like busy(), but false once all that's left is the silence padding
+     *  the last frame to the NEC frame period. Something queued then follows
+     *  that frame without a gap */
+    bool onAir() const {
+      return head != tail || (running && (phase == Segments || repeatLeft > 0 || timesLeft > 1));
+    }
+    /** send() takes a call right now: begin() got a channel and the queue has room */
+    bool accepts() const { return attached && room() > 0; }
+    /** send() calls that fit in the queue right now */
+    uint8_t room() const { return IR_TX_QUEUE_SIZE - 1 - (uint8_t)(head - tail + IR_TX_QUEUE_SIZE) % IR_TX_QUEUE_SIZE; }
+
+    /** True while any of the transmitters has something to send */
+    static bool anyBusy();
+    /** True while any of the transmitters is on the air, see onAir() */
+    static bool anyOnAir();
+    /** Called from send()/sendRepeat() before a frame is queued */
+    static void (*onSend)();
+
+    uint8_t pin;
+    uint32_t framesSent;
+    uint32_t refused;       // send() calls dropped because the queue was full
+    volatile uint32_t* frameCounter; // Also bumped for every frame sent when set (see Z906Journal)
+
+  private:
+    struct Frame {
+      const uint16_t* timings;
+      uint8_t length;
+      uint16_t repeat;
+      uint16_t gapMs;
+      uint8_t times;
+    };
+    enum Phase : uint8_t { Segments, Padding, Gap };
+
+    bool enqueue(const uint16_t* timings, uint8_t length, uint16_t repeat, uint16_t gapMs, uint8_t times);
+    ICACHE_RAM_ATTR void tick();
+    ICACHE_RAM_ATTR void startCarrier();
+    ICACHE_RAM_ATTR void stopCarrier();
+    ICACHE_RAM_ATTR void toggleCarrier();
+    ICACHE_RAM_ATTR bool loadNext();
+    ICACHE_RAM_ATTR void startPress();
+    ICACHE_RAM_ATTR static void schedule();
+    ICACHE_RAM_ATTR static void onTimer();
+
+    Frame queue[IR_TX_QUEUE_SIZE];
+    volatile uint8_t head;  // Written by send()
+    volatile uint8_t tail;  // Written by the timer interrupt
+    volatile bool running;
+    bool attached;          // Has a channel, only then does schedule() run it
+
+    // Only touched with interrupts off while running
+    uint32_t deadline;      // Cycle count at which the current mark/space ends
+    uint32_t carrierAt;     // Cycle count of the next carrier edge while carrier is set
+    bool carrier;
+    bool carrierHigh;
+    const uint16_t* pressTimings; // The press being sent, kept since its queue slot is freed by loadNext()
+    uint8_t pressLength;
+    uint16_t pressRepeat;
+    uint8_t timesLeft;
+    const uint16_t* timings;
+    uint8_t length;
+    uint8_t segment;
+    uint16_t repeatLeft;
+    uint16_t gapMs;
+    uint32_t elapsed;
+    Phase phase;
+
+    static IRTransmitter* channels[IR_TX_MAX_CHANNELS];
+    static uint8_t channelCount;
+};
+
+#endif // IR_TRANSMITTER_H_
@@ -1,3 +1,6 @@
+#ifndef LOGITECH_IR_CODES_H_
+#define LOGITECH_IR_CODES_H_
+
 #define POWER_IR  0x400501FE
 #define INPUT_IR  0x400510EF
 #define MUTE_IR   0x400557A8
@@ -11,4 +14,6 @@
 #define INPUT4_IR 0x400531CE
 #define INPUT5_IR 0x400540BF
 #define AUX_IR    0x400542BD
-#define TEST_IR   0x4005807F
\ No newline at end of file
+#define TEST_IR   0x4005807F
+
+#endif // LOGITECH_IR_CODES_H_
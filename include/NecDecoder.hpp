@@ -0,0 +1,143 @@
+#ifndef NEC_DECODER_H_
+#define NEC_DECODER_H_
+
+#include <stdint.h>
+
+#ifndef ICACHE_RAM_ATTR
+  #define ICACHE_RAM_ATTR
+#endif
+
+/* NEC protocol timings (µs) */
+#define NEC_HDR_MARK        9000
+#define NEC_HDR_SPACE       4500
+#define NEC_RPT_SPACE       2250
+#define NEC_BIT_MARK        560
+#define NEC_ONE_SPACE       1690
+#define NEC_ZERO_SPACE      560
+#define NEC_BITS            32
+#define NEC_TOLERANCE       25    // Allowed deviation in percent (IRremoteESP8266's kTolerance)
+#define NEC_EXCESS          50    // IR receivers stretch marks/shrink spaces by about this much (kMarkExcess)
+#define NEC_REPEAT          0xFFFFFFFF // Same value IRremoteESP8266 reports for repeat frames
+
+/**
+ * Incremental NEC decoder meant to be fed from a pin change interrupt.
+ * Every edge hands over the duration of the mark or space that just ended
+ * and the state machine advances one step, so there is no capture buffer
+ * and no batch decode. A decoded frame (or NEC_REPEAT) is latched until
+ * read(); a newer frame overwrites an unread one.
+ */
+class NecDecoder {
+  public:
+    NecDecoder() { reset(); }
+
+    /** Advances the state machine, mark is true if the ended interval was a mark */
+    ICACHE_RAM_ATTR void feed(uint32_t duration, bool mark) {
+      switch(state) {
+        case HeaderSpace:
+          if(mark) break;
+          if(match(duration, NEC_HDR_SPACE, false)) {
+            bits = 0;
+            shift = 0;
+            state = BitMark;
+          } else if(match(duration, NEC_RPT_SPACE, false)) {
+            state = RepeatMark;
+          } else {
+            fail();
+          }
+          return;
+        case BitMark:
+          if(!mark) break;
+          if(match(duration, NEC_BIT_MARK, true)) {
+            state = BitSpace;
+            return;
+          }
+          break;
+        case BitSpace:
+          if(mark) break;
+          if(match(duration, NEC_ONE_SPACE, false)) {
+            shift = (shift << 1) | 1;
+          } else if(match(duration, NEC_ZERO_SPACE, false)) {
+            shift <<= 1;
+          } else {
+            fail();
+            return;
+          }
+          if(++bits == NEC_BITS) {
+            latch(shift);
+          } else {
+            state = BitMark;
+          }
+          return;
+        case RepeatMark:
+          if(mark && match(duration, NEC_BIT_MARK, true)) {
+            latch(NEC_REPEAT);
+            return;
+          }
+          break;
+        case Idle:
+          break;
+      }
+      // Unexpected edge, a new frame may start right here
+      if(state != Idle) fail();
+      if(mark && match(duration, NEC_HDR_MARK, true)) state = HeaderSpace;
+    }
+
+    bool available() const { return ready; }
+
+    /** Returns the last decoded value and clears it */
+    uint32_t read() {
+      ready = false;
+      return value;
+    }
+
+    void reset() {
+      state = Idle;
+      ready = false;
+      bits = 0;
+      shift = 0;
+      value = 0;
+      frames = 0;
+      errors = 0;
+      overruns = 0;
+    }
+
+    volatile uint32_t frames;   // Frames (including repeats) decoded
+    volatile uint32_t errors;   // Frames abandoned halfway
+    volatile uint32_t overruns; // Frames overwritten before being read
+
+  private:
+    enum State : uint8_t { Idle, HeaderSpace, BitMark, BitSpace, RepeatMark };
+
+    /** The window IRrecv::matchMark()/matchSpace() use, so both receive
+     *  paths take the same frames: ±NEC_TOLERANCE % around the expected
+     *  length shifted by NEC_EXCESS, rounded outwards */
+    static bool match(uint32_t measured, uint32_t expected, bool mark) {
+      uint32_t adjusted = mark ? expected + NEC_EXCESS : expected - NEC_EXCESS;
+      uint32_t low = adjusted - (adjusted * NEC_TOLERANCE + 99) / 100;
+      uint32_t high = adjusted + adjusted * NEC_TOLERANCE / 100 + 1;
+      return measured - low <= high - low; // One compare, below low wraps around
+    }
+
+    ICACHE_RAM_ATTR void latch(uint32_t v) {
+      if(ready) overruns++;
+      value = v;
+      ready = true;
+      frames++;
+      state = Idle;
+    }
+
+    ICACHE_RAM_ATTR void fail() {
+      errors++;
+      state = Idle;
+    }
+
+    // Only the edge interrupt touches these
+    State state;
+    uint8_t bits;
+    uint32_t shift;
+    // Handed over to the loop
+    volatile bool ready;
+    volatile uint32_t value;
+};
+
+#endif // NEC_DECODER_H_
@@ -0,0 +1,55 @@
+#ifndef NEC_WAVEFORM_H_
+#define NEC_WAVEFORM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "NecDecoder.hpp"
+#include "LogitechIRCodes.h"
+
+#define NEC_FRAME_LENGTH    (2 + 2 * NEC_BITS + 1) // Header, 32 bits and the stop mark
+#define NEC_REPEAT_LENGTH   3
+#define NEC_FRAME_PERIOD    108000 // µs from the start of one frame to the next
+#define NEC_CARRIER_HIGH    13     // µs, 13 + 13 gives the 38 kHz carrier
+#define NEC_CARRIER_LOW     13
+
+/**
+ * Mark/space timings (µs) for one NEC frame, marks at even indexes.
+ * The tables (one copy, in NecWaveform.cpp) are plain const so they end up
+ * in RAM and can be read from the transmit interrupt while the flash is
+ * busy (e.g. during an EEPROM commit).
+ */
+struct NecWaveform {
+  uint32_t code;
+  uint16_t timings[NEC_FRAME_LENGTH];
+};
+
+/** Space length for bit n (0 = first sent, the MSB) of code */
+constexpr uint16_t necBitSpace(uint32_t code, uint8_t n) {
+  return (code >> (NEC_BITS - 1 - n)) & 1 ? NEC_ONE_SPACE : NEC_ZERO_SPACE;
+}
+
+#define NEC_BIT(code, n) NEC_BIT_MARK, necBitSpace(code, n)
+#define NEC_BYTE(code, n) NEC_BIT(code, n), NEC_BIT(code, n + 1), NEC_BIT(code, n + 2), NEC_BIT(code, n + 3), \
+                          NEC_BIT(code, n + 4), NEC_BIT(code, n + 5), NEC_BIT(code, n + 6), NEC_BIT(code, n + 7)
+#define NEC_WAVEFORM(code) { code, { NEC_HDR_MARK, NEC_HDR_SPACE, \
+                             NEC_BYTE(code, 0), NEC_BYTE(code, 8), NEC_BYTE(code, 16), NEC_BYTE(code, 24), \
+                             NEC_BIT_MARK } }
+
+#define NEC_WAVEFORM_COUNT  14
+
+/** Every code in LogitechIRCodes.h, generated at compile time */
+extern const NecWaveform necWaveforms[NEC_WAVEFORM_COUNT];
+extern const uint16_t necRepeatWaveform[NEC_REPEAT_LENGTH];
+
+/** Returns the precomputed waveform for code or NULL if it isn't a Z906 code */
+const NecWaveform* findNecWaveform(uint32_t code);
+
+/** Total on-air length (µs) of a mark/space sequence */
+inline uint32_t necDuration(const uint16_t* timings, uint8_t length) {
+  uint32_t total = 0;
+  for(uint8_t i = 0; i < length; i++) total += timings[i];
+  return total;
+}
+
+#endif // NEC_WAVEFORM_H_
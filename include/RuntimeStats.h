@@ -0,0 +1,50 @@
+#ifndef RUNTIME_STATS_H_
+#define RUNTIME_STATS_H_
+
+#include <Arduino.h>
+
+#define STATS_LATENCY_BUCKETS 12    // Bucket i counts commands done in under 2^i ms, the last one the rest
+#define STATS_LATENCY_LIMIT   512   // ms the 99th percentile command may take before we're unhealthy
+#define STATS_LOOP_LIMIT      50000 // us one pass of loop() may take before we're unhealthy
+#define STATS_HEAP_FLOOR      8192  // Free heap bytes we must never go under
+
+/**
+ * Counters for running for days: command latency (queued to handled) as a
+ * log2 histogram, the longest loop() pass, the heap low-water marks and
+ * the faults seen at the edges (malformed and oversized requests, Wi-Fi
+ * drops, MQTT reconnects). Cheap enough to keep on all the time, read
+ * with GET /stats and published to the debug topic now and then.
+ */
+class RuntimeStats {
+  public:
+    RuntimeStats();
+
+    void commandDone(uint32_t latencyMs);
+    /** Call once per loop() with how long the pass took */
+    void loopPass(uint32_t us);
+    void sampleHeap();
+
+    /** Upper bound (ms) of the bucket the percent-th percentile falls in */
+    uint32_t latencyPercentile(uint8_t percent) const;
+    /** False once a limit above was broken, it stays so until reset() */
+    bool healthy() const;
+    void reset();
+
+    uint32_t commands;
+    uint32_t maxLatency;      // ms
+    uint32_t maxLoop;         // us
+    uint32_t heapLow;
+    uint32_t blockLow;        // Largest free block, low-water mark
+    uint32_t malformed;       // Requests that weren't JSON
+    uint32_t oversized;       // Requests over REQUEST_MAX_SIZE
+    uint32_t wifiDrops;
+    uint32_t mqttReconnects;
+    unsigned long since;      // millis() of the last reset
+
+  private:
+    uint32_t latency[STATS_LATENCY_BUCKETS];
+};
+
+extern RuntimeStats stats;
+
+#endif // RUNTIME_STATS_H_
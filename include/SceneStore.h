@@ -0,0 +1,32 @@
+#ifndef SCENE_STORE_H_
+#define SCENE_STORE_H_
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define SCENE_DIR         "/scenes/"
+#define SCENE_NAME_SIZE   24  // Including the terminating null
+
+/**
+ * Named presets ("Movie", "Night", ...) kept as small JSON documents in
+ * LittleFS, one file per scene. The documents use the same keys as
+ * setSettings (input, effect, mode, mute, soundlevel, basslevel, ...).
+ */
+class SceneStore {
+  public:
+    bool begin();
+    bool save(const char* name, const String& json);
+    bool load(const char* name, String& json);
+    bool remove(const char* name);
+    void list(JsonArray names);
+
+    /** Scene names are letters, digits, '-' and '_' and shorter than SCENE_NAME_SIZE */
+    static bool validName(const char* name);
+
+  private:
+    static String path(const char* name);
+};
+
+extern SceneStore scenes;
+
+#endif // SCENE_STORE_H_
@@ -0,0 +1,77 @@
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <utility>
+
+/**
+ * Fixed capacity single-producer/single-consumer ring.
+ * Only the producer writes head and only the consumer writes tail. Each
+ * side hands a slot over with a release store of its index and reads the
+ * other side's index with an acquire load, so neither locks nor disabled
+ * interrupts are needed. On the ESP8266 the two sides are cooperative
+ * contexts in loop(), the same holds when they are real threads.
+ * A full queue refuses the item; the producer decides what backpressure
+ * means for it (answer busy, drop and count, ...).
+ */
+template<typename T, size_t N>
+class SpscQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+  public:
+    SpscQueue() : dropped(0), head(0), tail(0) {}
+
+    /** Producer side, false (and counted in dropped) when full */
+    bool push(T&& item) {
+      uint32_t h = head.load(std::memory_order_relaxed);
+      if(h - tail.load(std::memory_order_acquire) >= N) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      slots[h % N] = std::move(item);
+      head.store(h + 1, std::memory_order_release);
+      return true;
+    }
+
+    bool push(const T& item) {
+      T copy = item;
+      return push(std::move(copy));
+    }
+
+    /** Consumer side, false when empty */
+    bool pop(T& item) {
+      uint32_t t = tail.load(std::memory_order_relaxed);
+      if(head.load(std::memory_order_acquire) == t) return false;
+      item = std::move(slots[t % N]);
+      tail.store(t + 1, std::memory_order_release);
+      return true;
+    }
+
+    /** Consumer side, the item pop() would return next, NULL when empty.
+     *  It stays in the queue (and its slot the consumer's) until pop() */
+    T* front() {
+      uint32_t t = tail.load(std::memory_order_relaxed);
+      if(head.load(std::memory_order_acquire) == t) return NULL;
+      return &slots[t % N];
+    }
+
+    /** Exact from either side for its own view, a snapshot otherwise */
+    size_t size() const {
+      uint32_t t = tail.load(std::memory_order_acquire);
+      return head.load(std::memory_order_acquire) - t;
+    }
+    bool empty() const { return size() == 0; }
+    bool full() const { return size() >= N; }
+    static constexpr size_t capacity() { return N; }
+
+    std::atomic<uint32_t> dropped;  // Pushes refused because the queue was full
+
+  private:
+    T slots[N];
+    std::atomic<uint32_t> head;     // Next slot to write, free running
+    std::atomic<uint32_t> tail;     // Next slot to read, free running
+};
+
+#endif // SPSC_QUEUE_H_
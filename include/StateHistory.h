@@ -0,0 +1,93 @@
+#ifndef STATE_HISTORY_H_
+#define STATE_HISTORY_H_
+
+#include <Arduino.h>
+
+#define HISTORY_SIZE        2048  // Bytes of RAM for the newest records
+#define HISTORY_ROLLOVER          // Move the older half to LittleFS when full (comment out to drop it)
+#define HISTORY_FILE        "/history.bin"
+#define HISTORY_OLD_FILE    "/history.old"
+#define HISTORY_HEADER_FILE "/history.hdr"
+#define HISTORY_SEQ_RESERVE 1024  // Sequence numbers handed out per HISTORY_HEADER_FILE write
+#define HISTORY_FILE_MAX    16384 // Bytes before HISTORY_FILE becomes HISTORY_OLD_FILE
+#define HISTORY_PAGE_SIZE   50    // Records per GET /history page by default
+#define HISTORY_PAGE_MAX    200
+
+/** What made the state change */
+enum HistorySource : uint8_t { SourceRemote, SourceMqtt, SourceHttp, SourcePower, SourceAuto };
+static const char* const historySources[] = { "remote", "mqtt", "http", "power", "auto" };
+
+/**
+ * State transitions as a byte ring of variable length records:
+ * the ms since the previous record as a varint, unit << 6 | source << 3 |
+ * field (the TARGET_* bit index, see paramNames) and the new value,
+ * 3 bytes for most changes. With HISTORY_ROLLOVER the older half of a
+ * full ring is appended to LittleFS as one chunk instead of being dropped.
+ * Every record has a sequence number, which is what pages are asked by.
+ */
+class StateHistory {
+  public:
+    struct Entry {
+      uint32_t seq;
+      uint32_t time;          // millis() of the boot that recorded it
+      uint16_t boot;          // Counts up with every boot (0 without HISTORY_ROLLOVER)
+      uint8_t unit;
+      HistorySource source;
+      uint8_t field;
+      uint8_t value;
+    };
+    /** Gets every record from the first asked for, oldest first. Return false to stop */
+    typedef bool (*Reader)(const Entry& entry, void* context);
+
+    StateHistory();
+    /** Picks up the sequence numbers and boot count from LittleFS and counts
+     *  this boot in HISTORY_HEADER_FILE, after LittleFS is mounted */
+    void begin();
+    void record(uint8_t unit, HistorySource source, uint8_t field, uint8_t value);
+    void read(uint32_t from, Reader reader, void* context) const;
+
+    uint32_t nextSeq;         // Sequence number of the next record
+    uint32_t firstSeq;        // Oldest record still around (RAM or LittleFS)
+
+  private:
+    /** HISTORY_HEADER_FILE, so a ring that never rolled over still doesn't
+     *  hand out a sequence number twice. Records in RAM are lost with a
+     *  reset, the next boot starts at seqLimit */
+    struct Header {
+      uint32_t magic;
+      uint32_t seqLimit;      // Sequence numbers below it may be in use
+      uint16_t boot;
+      uint16_t reserved;
+    };
+
+    /** Where a chunk of records moved to LittleFS starts */
+    struct ChunkHeader {
+      uint32_t seq;           // Of the first record
+      uint32_t time;          // Of the first record
+      uint16_t boot;
+      uint16_t count;
+      uint16_t length;        // Bytes of records after the header
+      uint16_t reserved;
+    };
+
+    uint8_t at(size_t i) const { return buffer[(tail + i) % HISTORY_SIZE]; }
+    /** Length of the record i bytes after the tail, its time delta in dt */
+    size_t recordLength(size_t i, uint32_t* dt) const;
+    void dropOldest();
+    void rollover();
+    void saveHeader();
+    void readFile(const char* path, uint32_t from, Reader reader, void* context, bool& more) const;
+
+    uint8_t buffer[HISTORY_SIZE];
+    size_t tail;
+    size_t used;
+    uint32_t tailSeq;         // Of the oldest record in RAM
+    uint32_t tailTime;
+    uint32_t lastTime;        // Of the newest record
+    uint32_t seqLimit;        // Saved in HISTORY_HEADER_FILE, nextSeq stays below it
+    uint16_t boot;
+};
+
+extern StateHistory history;
+
+#endif // STATE_HISTORY_H_
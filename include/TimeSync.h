@@ -0,0 +1,62 @@
+#ifndef TIME_SYNC_H_
+#define TIME_SYNC_H_
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+
+#define TIME_SYNC_PORT      8906
+#define TIME_SYNC_INTERVAL  10000 // ms between beacons/requests
+#define TIME_SYNC_EXPIRE    35000 // ms before a silent reference unit is forgotten
+#define TIME_SYNC_SAMPLES   4     // Requests kept to pick the lowest round trip from
+
+/**
+ * Keeps a clock shared by all units on the LAN over UDP broadcast.
+ * Every unit broadcasts a beacon with its chip id, the unit with the lowest
+ * id is the reference. The others ask it for its time NTP style (t0..t3)
+ * and keep the offset from the request with the shortest round trip.
+ * Times are milliseconds, compare them with (int32_t)(a - b).
+ */
+class TimeSync {
+  public:
+    TimeSync();
+    void begin();
+    /** Sends beacons/requests and answers the other units, call from loop() */
+    void handle();
+
+    /** Shared clock in ms */
+    uint32_t now() const { return millis() + offset; }
+    bool isReference() const { return referenceId == chipId; }
+    bool synced() const { return isReference() || haveOffset; }
+
+    int32_t offset;
+    uint32_t roundTrip;   // ms, of the sample the offset came from
+
+  private:
+    struct Packet {
+      uint16_t magic;
+      uint8_t type;
+      uint32_t chipId;
+      uint32_t t0;        // Request sent (requester clock)
+      uint32_t t1;        // Request received (reference clock)
+      uint32_t t2;        // Response sent (reference clock)
+    } __attribute__((packed));
+    enum Type : uint8_t { Beacon, Request, Response };
+
+    void send(IPAddress ip, Packet& packet);
+    void onPacket(Packet& packet, IPAddress from);
+
+    WiFiUDP udp;
+    uint32_t chipId;
+    uint32_t referenceId;
+    IPAddress referenceIP;
+    uint32_t referenceSeen;
+    uint32_t lastSent;
+    bool haveOffset;
+    int32_t sampleOffset[TIME_SYNC_SAMPLES];
+    uint32_t sampleRoundTrip[TIME_SYNC_SAMPLES];
+    uint8_t sampleIndex;
+};
+
+extern TimeSync timeSync;
+
+#endif // TIME_SYNC_H_
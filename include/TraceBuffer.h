@@ -0,0 +1,57 @@
+#ifndef TRACE_BUFFER_H_
+#define TRACE_BUFFER_H_
+
+#include <Arduino.h>
+
+#define TRACE_SIZE          4096  // Bytes of records kept, the oldest are dropped first
+#define TRACE_MAX_PAYLOAD   255   // Longer payloads are cut
+#define TRACE_RECORD_HEADER 6
+#define TRACE_MAGIC         "Z9T2"
+
+/**
+ * Timestamped inputs in a byte ring, to be downloaded (GET /trace) and
+ * played back against the same firmware later.
+ * Every record is: millis() (uint32, little endian), kind << 4 | unit,
+ * payload length (uint8) and the payload. The download starts with a
+ * TraceFileHeader and has the records oldest first. millis() wraps after
+ * 49.7 days, a record is placed by its age at the download, so only one
+ * older than that can't be told apart.
+ */
+class TraceBuffer {
+  public:
+    enum Kind : uint8_t {
+      Mqtt = 1,   // Command payload, unit is the target controller (15 for the group)
+      Http,       // POST body
+      IRFrame,    // Code decoded from the remote (uint32, NEC_REPEAT for repeats)
+      OnLed,      // The amp's on-led changed (uint8 level)
+      IRSent      // Key queued for the IR LED (uint32 code, uint16 frames)
+    };
+
+    struct FileHeader {
+      char magic[4];        // TRACE_MAGIC
+      uint32_t now;         // millis() at the download
+      uint32_t dropped;     // Records pushed out since the last clear
+    };
+
+    TraceBuffer();
+    void record(Kind kind, uint8_t unit, const void* data, size_t length);
+    void clear();
+
+    /** Hands the stored records to write, oldest first, in at most two pieces */
+    void read(void (*write)(const uint8_t* data, size_t length)) const;
+    size_t size() const { return used; }
+
+    uint32_t records;
+    uint32_t dropped;
+
+  private:
+    void dropOldest();
+
+    uint8_t buffer[TRACE_SIZE];
+    size_t tail;    // Oldest record
+    size_t used;
+};
+
+extern TraceBuffer trace;
+
+#endif // TRACE_BUFFER_H_
@@ -0,0 +1,191 @@
+#ifndef Z906_CONTROLLER_H_
+#define Z906_CONTROLLER_H_
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include "Z906State.hpp"
+#include "IRTransmitter.h"
+#include "IRRamp.hpp"
+#include "Z906Planner.hpp"
+#include "Z906Resync.hpp"
+#include "Z906Journal.h"
+#include "IRBindings.h"
+#include "StateHistory.h"
+#include "SceneStore.h"
+
+#define LEVEL_TIMEOUT           5000
+#define MS_BETWEEN_SENDING_IR   20    // Amount of ms to leap between sending commands in a row
+#define SCHEDULE_SIZE           4     // Scheduled (group) commands that can wait at once
+#define SCHEDULE_LATE_LIMIT     1000  // ms a scheduled command may be late and still run
+#define SCENE_CACHE_SIZE        4     // Scenes kept compiled against the current state
+#define REQUEST_DOC_SIZE        640   // Room for a request with a full scene or batch in it
+#define BATCH_SIZE              8     // Operations a batch request may have
+#define GROUP_ALL               "all" // Group every controller is in
+
+/* EEPROM Addresses, relative to the start of the controller's slot */
+#define EEPROM_SLOT_SIZE        16
+#define SOUND_LEVEL_ADDR        1
+#define BASS_LEVEL_ADDR         2
+#define REAR_LEVEL_ADDR         3
+#define CENTER_LEVEL_ADDR       4
+#define CURRENT_INPUT_ADDR      5
+#define EFFECT_ON_AUX           6
+#define EFFECT_ON_INPUT1        7
+#define EFFECT_ON_INPUT2        8
+#define EFFECT_ON_INPUT3        9
+#define EFFECT_ON_INPUT4        10
+#define EFFECT_ON_INPUT5        11
+#define MUTE_ADDR               12
+
+/**
+ * One Z906 amp: its believed state, EEPROM slot, IR LED, power sense pin
+ * and MQTT topics. The topics live under ClientRoot, or ClientRoot/name
+ * when the controller has a name.
+ */
+class Z906Controller {
+  public:
+    Z906Controller(const char* name, uint8_t irPin, uint8_t onLedPin, uint8_t slot);
+
+    /** Sets up the pins and transmitter and loads the settings. Call after EEPROM.begin() */
+    void begin(const char* clientRoot);
+
+    /** Send the power key unless the amp is already there, false when the
+     *  transmitter refused it and the believed mode is left alone */
+    bool turnOn();
+    bool turnOff();
+    void changeSoundLevel(int8_t level);
+    void rampSoundLevel(int8_t level, uint32_t durationMs);
+    void cancelRamp();
+    void resetSettings();
+    /** Sends a scene's key presses as one burst and saves once, false if unknown */
+    bool applyScene(const char* name);
+    /** Drives the parameters in fields (TARGET_*) to a bound and back to their
+     *  believed values, returns the fields it could resync */
+    uint8_t resync(uint8_t fields);
+    /** Merges the operations (objects with setSettings keys) into one target
+     *  and sends it as one sequence, saved once. Puts a result per operation,
+     *  the presses and the settings in json. Nothing is sent when an
+     *  operation is invalid, returns false then */
+    bool applyBatch(JsonArrayConst ops, JsonObject json);
+    /** Sends the presses that take the amp to target as one sequence, saved
+     *  once. Puts the presses in json, returns the fields it can't reach */
+    uint8_t applyTarget(const Z906Target& target, JsonObject json);
+    /** True when a whole IRSequence fits in the transmitter queue. Nothing
+     *  waits for the transmitter, commands wait for this instead */
+    bool ready() const { return irtx.room() >= IR_SEQUENCE_SIZE; }
+
+    void loadSettings();
+    void saveSettings();
+    void getSettings(JsonObject json);
+    int8_t targetLevel(uint8_t i) const;
+    void printSettings();
+    void sendStates();
+
+    /** Reads the on-led of the amp, publishes the state when it changed */
+    void checkIfStillOn();
+    /** Hands a code the receiver decoded to learn mode, the key it's bound
+     *  to (handleBoundKey) or the Z906 remote handling (handleIRCode) */
+    void receiveIR(decode_type_t protocol, uint64_t value, uint16_t bits, bool repeat);
+    /** Updates the believed state from a code received from the remote */
+    void handleIRCode(uint32_t code);
+    /** Sends the Z906 key another remote's code is bound to (see IRBindings),
+     *  NEC_REPEAT while that remote's key is held. The receiver is off while
+     *  we send, so every echo also makes up for the repeats missed meanwhile */
+    void handleBoundKey(uint32_t code);
+    /** The receiver saw a frame it couldn't decode, a press may have been missed */
+    void missedFrame();
+    /** For handling requests, both the MQTT and REST requests are parsed here
+     * Returns: response string (with settings formatted as json), empty when
+     * req isn't JSON or names a group this controller isn't in */
+    String handleJSONReq(String req);
+    /** Adds what changed since the last call to the history, as caused by source */
+    void recordChanges(HistorySource source);
+    /** Runs ramps and scheduled commands, saves after held keys and ends level
+     *  mode, call from loop() */
+    void service();
+
+    const char* name;
+    const char* group;      // Takes commands with this "group" besides GROUP_ALL ones, "" for none
+    String commandTopic;
+    String stateTopic;
+    String debugTopic;
+
+    Z906State state;
+    bool isOn;
+    uint32_t stateVersion;  // Bumped whenever the believed state changes
+    HistorySource source;   // Who the command being handled came from, set by main.cpp
+    uint8_t confidence[PARAM_COUNT]; // How sure we are of each parameter (TARGET_* bit order), 0..100
+    unsigned long lastResyncMs;      // Duration of the last resync
+
+    /** Called when a reset request is handled, main.cpp blinks the status LED */
+    static void (*onReset)();
+
+  private:
+    /** A request to run at a time on the shared clock (see TimeSync) */
+    struct ScheduledCommand {
+      uint32_t at;
+      String req;
+    };
+
+    /** A scene's key presses, planned from the state at stateVersion */
+    struct CompiledScene {
+      char name[SCENE_NAME_SIZE];
+      uint32_t version;
+      uint8_t unreachable;
+      IRSequence seq;
+      Z906State result;
+    };
+
+    bool scheduleJSONReq(uint32_t at, String req);
+    CompiledScene* compileScene(const char* name);
+    bool compileScene(CompiledScene& scene);
+    void runSequence(const IRSequence& seq);
+    bool sendIR(uint32_t code, uint16_t repeat = 0, uint16_t gapMs = MS_BETWEEN_SENDING_IR);
+    void noteSent(const Z906State& sent, uint32_t code, uint16_t frames);
+    void learnIRCode(decode_type_t protocol, uint64_t value, uint16_t bits);
+    int eepromAddr(int addr) const { return slot * EEPROM_SLOT_SIZE + addr; }
+
+    uint8_t onLedPin;
+    uint8_t slot;
+    IRTransmitter irtx;
+    Z906Journal journal;    // Frames of the command on the air, survives a reset
+    Z906State recorded;     // The state as of the last history record
+
+    Mode lastMode;
+    unsigned long levelTimeout;
+
+    IRRamp volumeRamp;
+    uint8_t rampLevel;      // The soundLevel[] index the ramp is changing
+    HistorySource rampSource;
+    IRHold remoteHold;
+    IRHold boundHold;       // Key another remote's held code is bound to
+    uint16_t boundEchoed;   // Repeats of it sent so far
+    bool holdUnsaved;       // Settings changed by a held key, saved on release
+    bool heldBound;         // The repeats the receiver gets belong to a bound code
+
+    ScheduledCommand schedule[SCHEDULE_SIZE];
+    uint8_t scheduled;
+
+    CompiledScene sceneCache[SCENE_CACHE_SIZE];
+    uint8_t sceneCacheNext;     // Entry to replace next
+
+    uint8_t resyncing;          // Fields of the resync on the air, 0 when none
+    unsigned long resyncStarted;
+    unsigned long lastResync;
+    unsigned long lastActivity; // Last time we or the remote sent something
+    unsigned long lastDecay;
+    uint8_t sentFrames[PARAM_COUNT]; // Frames sent towards the next confidence point, see chargeFrames
+};
+
+/** Returns the strings index in const char[] array*/
+uint8_t getStringIndex(String s, const char* const array[], uint8_t len);
+
+/** Reads the setSettings keys (input, effect, mode, mute, soundlevel, basslevel,
+ *  rearlevel, centerlevel) in json into target, false if a value is invalid */
+bool parseTarget(JsonObjectConst json, Z906Target& target);
+
+/** Queues an MQTT message, main.cpp's network context publishes it (see CommandRouter) */
+bool postEvent(const char* topic, String payload);
+
+#endif // Z906_CONTROLLER_H_
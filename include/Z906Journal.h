@@ -0,0 +1,80 @@
+#ifndef Z906_JOURNAL_H_
+#define Z906_JOURNAL_H_
+
+#include <Arduino.h>
+
+#include "Z906Planner.hpp"
+#include "IRTransmitter.h"
+
+#define JOURNAL_SIZE        IR_TX_QUEUE_SIZE // Keys (each with its repeats) on the air at once
+#define JOURNAL_RTC_OFFSET  32    // RTC user memory blocks, the first 128 bytes belong to OTA (eboot)
+#define JOURNAL_RTC_BLOCKS  24    // 4 byte blocks per controller slot
+#define JOURNAL_RTC_END     128   // RTC user memory is 512 bytes
+#define JOURNAL_SLOTS       ((JOURNAL_RTC_END - JOURNAL_RTC_OFFSET) / JOURNAL_RTC_BLOCKS)
+
+static_assert(JOURNAL_SLOTS >= IR_TX_MAX_CHANNELS, "Every transmitter needs a journal slot");
+
+/** Applies a frame we sent to state: a remote key like the amp takes it,
+ *  or one of the direct input codes only we send */
+inline void applySent(Z906State& state, uint32_t code) {
+  if(state.applyKey(code)) return;
+  for(uint8_t i = 0; i < INPUT_COUNT; i++) {
+    if(inputCode((Input)i) == code) state.input = (Input)i;
+  }
+}
+
+/**
+ * Keeps the frames of the command on the air in RTC user memory, which
+ * survives a watchdog or OTA reset and costs no flash writes. The journal
+ * is the believed state before the command plus the keys queued since,
+ * and the transmit interrupt counts every frame that has left the LED
+ * straight into RTC memory. Replaying base + the counted frames gives the
+ * state the amp is in even if we reset halfway through a press loop.
+ */
+class Z906Journal {
+  public:
+    Z906Journal(uint8_t slot) : slot(slot), rtc() {}
+
+    /** Validates the RTC copy and lets irtx count its frames into it. A slot
+     *  past JOURNAL_SLOTS has no RTC memory, the journal stays closed then */
+    void begin(IRTransmitter& irtx);
+    /** Replaces state with the one the unfinished command left the amp in.
+     *  Returns false when the last command was committed */
+    bool replay(Z906State& state);
+    /** Notes frames of code about to be queued. Starts over from state
+     *  when the transmitter is idle, everything before is on the air then.
+     *  Folds the keys already on the air into the base when it is full */
+    void record(const Z906State& state, uint32_t code, uint16_t frames, bool idle);
+    /** The frames are on the air and the state is saved, nothing to replay */
+    void commit();
+
+    bool open() const { return rtc.length > 0; }
+    uint8_t room() const { return JOURNAL_SIZE - rtc.length; }
+
+  private:
+    struct Entry {
+      uint8_t key;          // Index in necWaveforms
+      uint8_t frames;       // The frame and its repeats
+    };
+    struct Record {
+      uint32_t magic;
+      uint32_t emitted;     // Frames on the air since base, counted by the transmit interrupt
+      Z906State base;
+      uint8_t length;
+      Entry entries[JOURNAL_SIZE];
+      uint32_t crc;
+    };
+    static_assert(sizeof(Record) <= JOURNAL_RTC_BLOCKS * 4, "Journal doesn't fit its RTC slot");
+
+    uint32_t offset() const { return JOURNAL_RTC_OFFSET + slot * JOURNAL_RTC_BLOCKS; }
+    uint32_t checksum() const;
+    /** Writes everything but emitted, which belongs to the interrupt */
+    void write();
+    void start(const Z906State& state);
+    void compact();
+
+    uint8_t slot;
+    Record rtc;             // RAM copy, emitted is only valid in RTC memory
+};
+
+#endif // Z906_JOURNAL_H_
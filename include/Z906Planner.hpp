@@ -0,0 +1,149 @@
+#ifndef Z906_PLANNER_H_
+#define Z906_PLANNER_H_
+
+#include <stdint.h>
+
+#include "Z906State.hpp"
+
+#define IR_SEQUENCE_SIZE    16
+#define POWER_ON_DELAY      3500  // ms the amp needs after power on before it takes other keys
+
+/* Fields of a Z906Target that are set */
+#define TARGET_INPUT        0x01
+#define TARGET_EFFECT       0x02
+#define TARGET_MODE         0x04
+#define TARGET_MUTE         0x08
+#define TARGET_LEVEL(i)     (0x10 << (i)) // i = 0..3, [Volume, Bass, Rear, Center]
+#define TARGET_LEVELS       0xF0
+
+/** The settings a scene or request wants, only the fields in the mask count.
+ *  effect is for the input the amp ends up on */
+struct Z906Target {
+  uint8_t fields;
+  Z906State state;
+  Effect effect;
+};
+
+/** count presses of code followed by gapMs of silence */
+struct IRStep {
+  uint32_t code;
+  uint8_t count;
+  uint16_t gapMs;
+};
+
+struct IRSequence {
+  IRStep steps[IR_SEQUENCE_SIZE];
+  uint8_t length;
+
+  void add(uint32_t code, uint8_t count, uint16_t gapMs = 0) {
+    if(count == 0 || length >= IR_SEQUENCE_SIZE) return;
+    steps[length].code = code;
+    steps[length].count = count;
+    steps[length].gapMs = gapMs;
+    length++;
+  }
+
+  uint16_t presses() const {
+    uint16_t total = 0;
+    for(uint8_t i = 0; i < length; i++) total += steps[i].count;
+    return total;
+  }
+};
+
+/** The direct IR code for an input */
+inline uint32_t inputCode(Input input) {
+  switch(input) {
+    case Input1: return INPUT1_IR;
+    case Input2: return INPUT2_IR;
+    case Input3: return INPUT3_IR;
+    case Input4: return INPUT4_IR;
+    case Input5: return INPUT5_IR;
+    default: return AUX_IR;
+  }
+}
+
+/** Number of modes the Level key cycles through (On plus the levels) with effect */
+inline uint8_t levelModes(Effect effect) {
+  return effect == Stereo ? 2 : effect == Music ? 3 : 4;
+}
+
+/** Adds the Level presses that take state from its mode to mode */
+inline void planMode(Z906State& state, Mode mode, IRSequence& seq) {
+  uint8_t limit = levelModes(state.currentEffect());
+  uint8_t presses = (mode - state.mode + limit) % limit;
+  seq.add(LEVEL_IR, presses);
+  state.mode = mode;
+}
+
+/**
+ * Plans the key presses that take the amp from state to target, in the
+ * order input, effect, mute, levels, mode. Levels are visited in the order
+ * the Level key cycles through them, starting at the current mode. Volume
+ * steps are one press each, like changeSoundLevel.
+ * state is updated to what the amp will be at afterwards. Returns the
+ * target fields that can't be reached (e.g. the center level in Stereo).
+ */
+inline uint8_t planSequence(Z906State& state, const Z906Target& target, IRSequence& seq) {
+  const Z906State& want = target.state;
+  seq.length = 0;
+
+  if((target.fields & TARGET_MODE) && want.mode == Off) {
+    if(state.mode != Off) seq.add(POWER_IR, 1);
+    state.mode = Off;
+    return target.fields & ~TARGET_MODE;
+  }
+  if(state.mode == Off) {
+    seq.add(POWER_IR, 1, POWER_ON_DELAY);
+    state.mode = On;
+  }
+
+  if((target.fields & TARGET_INPUT) && state.input != want.input) {
+    seq.add(inputCode(want.input), 1);
+    state.input = want.input;
+  }
+
+  if((target.fields & TARGET_EFFECT) && state.currentEffect() != target.effect) {
+    // The effect decides which levels exist, so change it from On mode
+    planMode(state, On, seq);
+    seq.add(EFFECT_IR, (target.effect - state.currentEffect() + EFFECT_COUNT) % EFFECT_COUNT);
+    state.setCurrentEffect(target.effect);
+  }
+
+  if((target.fields & TARGET_MUTE) && state.mute != want.mute) {
+    seq.add(MUTE_IR, 1);
+    state.mute = want.mute;
+  }
+
+  uint8_t unreachable = 0;
+  uint8_t limit = levelModes(state.currentEffect());
+  for(uint8_t i = 0; i < 4; i++) {
+    if((target.fields & TARGET_LEVEL(i)) && i >= limit) unreachable |= TARGET_LEVEL(i);
+  }
+
+  bool changedMode = false;
+  uint8_t first = state.mode;
+  for(uint8_t i = 0; i < limit; i++) {
+    Mode mode = (Mode)((first - 1 + i) % limit + 1);
+    uint8_t level = mode - 1;
+    if(!(target.fields & TARGET_LEVEL(level))) continue;
+    int8_t diff = want.soundLevel[level] - state.soundLevel[level];
+    if(diff == 0) continue;
+    changedMode |= mode != state.mode;
+    planMode(state, mode, seq);
+    seq.add(diff > 0 ? PLUS_IR : MINUS_IR, diff > 0 ? diff : -diff);
+    state.soundLevel[level] = want.soundLevel[level];
+  }
+
+  if(target.fields & TARGET_MODE) {
+    if(want.mode <= limit)
+      planMode(state, want.mode, seq);
+    else
+      unreachable |= TARGET_MODE;
+  } else if(changedMode) {
+    // Don't leave the amp waiting for the level timeout
+    planMode(state, On, seq);
+  }
+  return unreachable;
+}
+
+#endif // Z906_PLANNER_H_
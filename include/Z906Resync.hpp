@@ -0,0 +1,102 @@
+#ifndef Z906_RESYNC_H_
+#define Z906_RESYNC_H_
+
+#include <stdint.h>
+
+#include "Z906Planner.hpp"
+
+#define CONFIDENCE_MAX          100
+#define CONFIDENCE_BOOT         70    // We may have missed a power cycle while rebooting
+#define CONFIDENCE_FRAMES       20    // Frames we send per point lost, the amp misses few of ours
+#define CONFIDENCE_ORPHAN       20    // Lost by the levels for a repeat frame of a key we never saw
+#define CONFIDENCE_NOISE        2     // Lost by everything for a frame the decoder gave up on
+#define CONFIDENCE_POWER_CYCLE  50    // Lost by the levels when the amp powers on
+#define CONFIDENCE_DECAY        1     // Lost by everything every RESYNC_DECAY_MS while on
+#define RESYNC_DECAY_MS         600000
+#define RESYNC_THRESHOLD        50    // Parameters below this are resynced automatically
+#define RESYNC_MARGIN           6     // Extra Minus presses beyond LEVEL_MAX, for frames the amp misses
+#define RESYNC_STEPS            (LEVEL_MAX + RESYNC_MARGIN) // Minus presses that take any level to 0
+#define RESYNC_MIN_INTERVAL     60000 // ms between automatic resyncs
+
+/** Parameters that have an absolute bound to drive to (see planResync) */
+#define RESYNC_SUPPORTED        (TARGET_INPUT | TARGET_MODE | TARGET_LEVELS)
+
+/** Names of the TARGET_* bits, the same keys setSettings uses */
+static const char* const paramNames[] = { "input", "effect", "mode", "mute", "soundlevel", "basslevel", "rearlevel", "centerlevel" };
+#define PARAM_COUNT 8
+
+/** Lowers the confidence of the parameters in fields by amount */
+inline void lowerConfidence(uint8_t confidence[PARAM_COUNT], uint8_t fields, uint8_t amount) {
+  for(uint8_t i = 0; i < PARAM_COUNT; i++) {
+    if(!(fields & (1 << i))) continue;
+    confidence[i] = confidence[i] > amount ? confidence[i] - amount : 0;
+  }
+}
+
+/** Counts the frames we sent for the parameters in fields and lowers their
+ *  confidence a point for every CONFIDENCE_FRAMES of them. Ramps of our own
+ *  cost little this way, a missed or orphaned frame from the remote a lot */
+inline void chargeFrames(uint8_t confidence[PARAM_COUNT], uint8_t sentFrames[PARAM_COUNT], uint8_t fields, uint16_t frames) {
+  for(uint8_t i = 0; i < PARAM_COUNT; i++) {
+    if(!(fields & (1 << i))) continue;
+    uint32_t total = sentFrames[i] + frames;
+    uint32_t points = total / CONFIDENCE_FRAMES;
+    lowerConfidence(confidence, 1 << i, points > 255 ? 255 : points);
+    sentFrames[i] = total % CONFIDENCE_FRAMES;
+  }
+}
+
+/** The parameter a key press from us changes, for lowering its confidence */
+inline uint8_t keyField(const Z906State& state, uint32_t code) {
+  switch(code) {
+    case PLUS_IR:
+    case MINUS_IR:
+      return state.mode == Off ? 0 : TARGET_LEVEL(state.currentLevel());
+    case LEVEL_IR:
+    case POWER_IR:
+      return TARGET_MODE;
+    case EFFECT_IR:
+      return TARGET_EFFECT;
+    case MUTE_IR:
+      return TARGET_MUTE;
+    default:
+      return TARGET_INPUT;
+  }
+}
+
+/**
+ * Plans driving the parameters in fields to a known bound and back to the
+ * believed value. Input has direct codes and the mode falls back to On
+ * after the level timeout, so they need no saturation. Levels are taken to
+ * 0 with RESYNC_STEPS Minus repeat frames and raised back with Plus. The
+ * burst covers the whole range, a level we resync is one we're unsure of
+ * and the amp may be anywhere above what we believe. Effect and mute only toggle, they can't be resynced
+ * open loop. Expects the amp to be in On mode (idle past the level timeout).
+ * Returns the fields that were planned.
+ */
+inline uint8_t planResync(Z906State& state, uint8_t fields, IRSequence& seq) {
+  seq.length = 0;
+  fields &= RESYNC_SUPPORTED;
+  if(state.mode == Off) return 0;
+  state.mode = On;
+
+  if(fields & TARGET_INPUT)
+    seq.add(inputCode(state.input), 1);
+
+  uint8_t limit = levelModes(state.currentEffect());
+  bool changedMode = false;
+  for(uint8_t level = 0; level < limit; level++) {
+    if(!(fields & TARGET_LEVEL(level))) continue;
+    changedMode |= level != 0;
+    planMode(state, (Mode)(level + 1), seq);
+    seq.add(MINUS_IR, RESYNC_STEPS);
+    seq.add(PLUS_IR, state.soundLevel[level]);
+  }
+  for(uint8_t level = limit; level < 4; level++) fields &= ~TARGET_LEVEL(level);
+
+  if(changedMode)
+    planMode(state, On, seq);
+  return fields;
+}
+
+#endif // Z906_RESYNC_H_
@@ -0,0 +1,147 @@
+#ifndef Z906_STATE_H_
+#define Z906_STATE_H_
+
+#include <stdint.h>
+
+#include "NecDecoder.hpp"
+#include "LogitechIRCodes.h"
+
+enum Input : uint8_t { AUX, Input1, Input2, Input3, Input4, Input5 };
+static const char* const inputs[] { "AUX", "Input 1", "Input 2", "Input 3", "Input 4", "Input 5" };
+#define INPUT_COUNT   6
+
+enum Effect : uint8_t { Surround, Music, Stereo };
+static const char* const effects[] { "Surround", "Music", "Stereo" };
+#define EFFECT_COUNT  3
+
+// In mode On we'll change the soundlevel (defult)
+enum Mode : uint8_t { Off, On, BassLevel, RearLevel, CenterLevel};
+static const char* const modes[] = { "Off", "On", "Bass level", "Rear level", "Center level" };
+#define MODE_COUNT    5
+
+#define LEVEL_MAX     100 // The highest a level goes, Plus does nothing past it
+
+/** What we believe the amp is set to */
+struct Z906State {
+  int8_t soundLevel[4]; // [Volume, Bass, Rear, Center]
+  bool mute;
+  Input input;
+  Effect effectOnInput[INPUT_COUNT];
+  Mode mode;
+
+  /** Returns the soundlevel that the receiver is currently on */
+  uint8_t currentLevel() const {
+    return mode - 1;
+  }
+
+  /**
+   * Returns the current effect for the current input
+   * (Each input has it's on effect independent of the other inputs)
+   */
+  Effect currentEffect() const {
+    return effectOnInput[input];
+  }
+
+  void setCurrentEffect(Effect effect) {
+    effectOnInput[input] = effect;
+  }
+
+  /** Sets the current input to the next input */
+  void setNextInput() {
+    input = input >= 5 ? (Input)0 : (Input)(input + 1);
+  }
+
+  /** Sets the current effect to the next effect */
+  void setNextEffect() {
+    setCurrentEffect(currentEffect() >= 2 ? (Effect)0 : (Effect)(currentEffect() + 1));
+  }
+
+  /** Steps through the levels the current effect has */
+  void nextLevelOnCurrentEffect() {
+    int limit = 4;
+    switch(currentEffect()) {
+      case Surround:
+        limit = 4;
+        break;
+      case Music:
+        limit = 3;
+        break;
+      case Stereo:
+        limit = 2;
+        break;
+    }
+    mode = mode >= limit ? (Mode)1 : (Mode)(mode + 1);
+  }
+
+  /**
+   * Applies a key like the amp does, whoever sent it: Plus and Minus move
+   * the current level one step per frame within 0..LEVEL_MAX. Accepts the
+   * NEC codes and the hashes IRrecv falls back to (its 64 entry buffer is too
+   * short for a full NEC frame). Returns false for codes that aren't Z906 keys
+   */
+  bool applyKey(uint32_t code) {
+    switch(code) {
+      case POWER_IR:
+      case 0x63C98B53:
+        mode = mode == On ? Off : On;
+        break;
+      case INPUT_IR:
+      case 0xEFA4E63F:
+        setNextInput();
+        break;
+      case MUTE_IR:
+      case 0x92CA878C:
+        mute = !mute;
+        break;
+      case LEVEL_IR:
+      case 0x58B863E3:
+        nextLevelOnCurrentEffect();
+        break;
+      case MINUS_IR:
+      case 0x11E728E:
+        if(mode != Off && soundLevel[currentLevel()] > 0)
+          soundLevel[currentLevel()]--;
+        break;
+      case PLUS_IR:
+      case 0xABB1A8D2:
+        if(mode != Off && soundLevel[currentLevel()] < LEVEL_MAX)
+          soundLevel[currentLevel()]++;
+        break;
+      case EFFECT_IR:
+      case 0x48C7229F:
+        setNextEffect();
+        break;
+      default:
+        return false;
+    }
+    return true;
+  }
+};
+
+/** Returns true for keys the amp acts on again for every NEC repeat frame */
+inline bool isRepeatableKey(uint32_t code) {
+  return code == MINUS_IR || code == PLUS_IR || code == 0x11E728E || code == 0xABB1A8D2;
+}
+
+/** Name of a Z906 key, for logging */
+inline const char* keyName(uint32_t code) {
+  switch(code) {
+    case POWER_IR: case 0x63C98B53: return "Power";
+    case INPUT_IR: case 0xEFA4E63F: return "Input";
+    case MUTE_IR: case 0x92CA878C: return "Mute";
+    case LEVEL_IR: case 0x58B863E3: return "Level";
+    case MINUS_IR: case 0x11E728E: return "Minus";
+    case PLUS_IR: case 0xABB1A8D2: return "Plus";
+    case EFFECT_IR: case 0x48C7229F: return "Effect";
+    case INPUT1_IR: return "Input 1";
+    case INPUT2_IR: return "Input 2";
+    case INPUT3_IR: return "Input 3";
+    case INPUT4_IR: return "Input 4";
+    case INPUT5_IR: return "Input 5";
+    case AUX_IR: return "AUX";
+    case NEC_REPEAT: return "Repeat";
+    default: return "Unknown";
+  }
+}
+
+#endif // Z906_STATE_H_
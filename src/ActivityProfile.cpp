@@ -0,0 +1,50 @@
+#include "ActivityProfile.h"
+
+#include "DebugHelpers.hpp"
+
+ActivityProfile activity;
+
+ActivityProfile::ActivityProfile() : profile(Active), wakeReason("boot"), wakes(0),
+  wakeLatency(0), maxWakeLatency(0), lastActivity(0), entered(0), timing(false) {
+  spent[Active] = 0;
+  spent[Idle] = 0;
+}
+
+bool ActivityProfile::wake(const char* reason) {
+  lastActivity = millis();
+  if(profile == Active) return false;
+  enter(Active);
+  wakeReason = reason;
+  wakes++;
+  timing = true;
+  Log("[ActivityProfile] Active, woken by %s\n", reason);
+  return true;
+}
+
+void ActivityProfile::handled() {
+  lastActivity = millis();
+  if(!timing) return;
+  timing = false;
+  wakeLatency = millis() - entered;
+  if(wakeLatency > maxWakeLatency) maxWakeLatency = wakeLatency;
+}
+
+bool ActivityProfile::update(bool busy) {
+  if(busy) lastActivity = millis();
+  if(profile == Idle || millis() - lastActivity < PROFILE_IDLE_AFTER) return false;
+  enter(Idle);
+  timing = false;
+  Logln("[ActivityProfile] Idle");
+  return true;
+}
+
+uint32_t ActivityProfile::timeIn(Profile p) const {
+  return spent[p] + (p == profile ? millis() - entered : 0);
+}
+
+void ActivityProfile::enter(Profile p) {
+  unsigned long now = millis();
+  spent[profile] += now - entered;
+  entered = now;
+  profile = p;
+}
@@ -0,0 +1,135 @@
+#include "CommandRouter.h"
+
+#include "DebugHelpers.hpp"
+#include "RuntimeStats.h"
+#include "ActivityProfile.h"
+
+CommandRouter router;
+
+CommandRouter::CommandRouter() : onWake(NULL), onWait(NULL), onEvent(NULL), controllers(NULL), count(0), nextId(1) {}
+
+void CommandRouter::begin(Z906Controller* controllers, uint8_t count) {
+  this->controllers = controllers;
+  this->count = count;
+}
+
+int CommandRouter::post(uint8_t target, const String& req, String& response) {
+  if(req.length() > REQUEST_MAX_SIZE) {
+    stats.oversized++;
+    response = "{\"message\":\"Request too large\"}";
+    return 413;
+  }
+  if(!isValidRequest(req)) {
+    stats.malformed++;
+    response = "{\"message\":\"Invalid JSON\"}";
+    return 400;
+  }
+  if(onWake) onWake("command");
+  uint32_t id = queue(target, req, SourceHttp);
+  if(!id) {
+    response = "{\"message\":\"Busy, try again\"}";
+    return 503;
+  }
+  // Every pass runs at most one command, the ones ahead of ours first
+  while(!takeAnswer(id, response)) {
+    if(!onWait || !onWait()) {
+      if(takeAnswer(id, response)) break;
+      response = "{\"message\":\"Queued\",\"id\":" + String(id) + "}";
+      return 202;
+    }
+  }
+  return 200;
+}
+
+bool CommandRouter::receive(uint8_t target, const String& req, String& error) {
+  if(!isValidRequest(req)) {
+    stats.malformed++;
+    error = "Invalid JSON, dropped";
+    return false;
+  }
+  if(onWake) onWake("command");
+  if(queue(target, req, SourceMqtt)) return true;
+  error = "Command queue full, dropped";
+  return false;
+}
+
+uint32_t CommandRouter::queue(uint8_t target, const String& req, HistorySource source) {
+  Command command;
+  command.id = nextId;
+  command.target = target;
+  command.source = source;
+  command.queued = millis();
+  command.req = req;
+  if(!commands.push(std::move(command))) return 0;
+  return nextId++;
+}
+
+bool CommandRouter::runNext() {
+  Command* next = commands.front();
+  if(!next || !controllersReady(next->target) || !eventsRoom(next->target)) return false;
+  Command command;
+  commands.pop(command);
+  for(uint8_t i = 0; i < count; i++) {
+    if(command.target != COMMAND_ALL && command.target != i) continue;
+    String response = handle(i, command.req, command.source);
+    // A waiting POST needs its answer even when there's nothing in it
+    if(response.length() == 0 && command.source != SourceHttp) continue;
+    postEvent(controllers[i].stateTopic.c_str(), response, command.id);
+  }
+  stats.commandDone(millis() - command.queued);
+  activity.handled();
+  return true;
+}
+
+bool CommandRouter::controllersReady(uint8_t target) const {
+  for(uint8_t i = 0; i < count; i++) {
+    if((target == COMMAND_ALL || target == i) && !controllers[i].ready()) return false;
+  }
+  return true;
+}
+
+bool CommandRouter::eventsRoom(uint8_t target) const {
+  size_t needed = (target == COMMAND_ALL ? count : 1) * EVENTS_PER_COMMAND;
+  return events.size() + needed <= events.capacity();
+}
+
+/** Runs req on controller i, the changes it made are recorded as source's */
+String CommandRouter::handle(uint8_t i, const String& req, HistorySource source) {
+  Z906Controller& controller = controllers[i];
+  controller.source = source;
+  String response = controller.handleJSONReq(req);
+  controller.recordChanges(source);
+  controller.source = SourceAuto;
+  return response;
+}
+
+bool CommandRouter::takeAnswer(uint32_t id, String& response) {
+  Event event;
+  while(events.pop(event)) {
+    if(event.id == id) {
+      response = event.payload;
+      return true;
+    }
+    if(onEvent) onEvent(event);
+  }
+  return false;
+}
+
+bool CommandRouter::postEvent(const char* topic, String payload, uint32_t id) {
+  Event event;
+  event.id = id;
+  event.topic = topic;
+  event.payload = payload;
+  if(events.push(std::move(event))) return true;
+  Log("[postEvent] Queue full, dropped message to %s\n", topic);
+  return false;
+}
+
+bool postEvent(const char* topic, String payload) {
+  return router.postEvent(topic, payload);
+}
+
+bool isValidRequest(const String& req) {
+  StaticJsonDocument<REQUEST_DOC_SIZE> doc;
+  return !deserializeJson(doc, req);
+}
@@ -0,0 +1,147 @@
+#include "IRBindings.h"
+
+#include <LittleFS.h>
+#include <IRutils.h>
+
+#include "Z906State.hpp"
+#include "DebugHelpers.hpp"
+
+#define BINDINGS_MAGIC 0x5A394200 // "Z9B"
+
+IRBindings bindings;
+
+bool IRBindings::begin() {
+  memset(slots, 0, sizeof(slots));
+  learnKey = 0;
+  File file = LittleFS.open(BINDINGS_FILE, "r");
+  if(file) {
+    uint32_t magic = 0;
+    bool ok = file.read((uint8_t*)&magic, sizeof(magic)) == sizeof(magic) && magic == BINDINGS_MAGIC
+      && file.read((uint8_t*)slots, sizeof(slots)) == sizeof(slots);
+    file.close();
+    if(!ok) {
+      Logln("[IRBindings] Bad bindings file, starting over");
+      memset(slots, 0, sizeof(slots));
+    }
+  }
+  recount();
+  Log("[IRBindings] %d codes bound\n", count);
+  return true;
+}
+
+uint32_t IRBindings::find(decode_type_t protocol, uint64_t value, uint16_t bits) const {
+  if(count == 0) return 0;
+  int16_t i = findSlot(protocol, value, bits);
+  return i < 0 ? 0 : slots[i].key;
+}
+
+bool IRBindings::bind(decode_type_t protocol, uint64_t value, uint16_t bits, uint32_t key) {
+  if(bits > 64 || key == 0) return false;
+  int16_t i = findSlot(protocol, value, bits);
+  if(i >= 0) {
+    slots[i].key = key;
+  } else {
+    if(count + deleted >= BINDING_MAX_LOAD) rebuild();
+    if(count >= BINDING_MAX_LOAD) return false;
+    Slot slot = { value, key, (int16_t)protocol, (uint8_t)bits, Used };
+    insert(slot);
+    recount();
+  }
+  return save();
+}
+
+uint8_t IRBindings::unbind(uint32_t key) {
+  uint8_t removed = 0;
+  for(uint8_t i = 0; i < BINDING_SLOTS; i++) {
+    if(slots[i].state != Used || (key != 0 && slots[i].key != key)) continue;
+    slots[i].state = Deleted;
+    removed++;
+  }
+  if(removed == 0) return 0;
+  recount();
+  save();
+  return removed;
+}
+
+void IRBindings::list(JsonArray bindings) const {
+  for(uint8_t i = 0; i < BINDING_SLOTS; i++) {
+    const Slot& slot = slots[i];
+    if(slot.state != Used) continue;
+    JsonObject binding = bindings.createNestedObject();
+    binding["key"] = keyName(slot.key);
+    binding["protocol"] = typeToString((decode_type_t)slot.protocol);
+    binding["value"] = uint64ToString(slot.value, 16);
+    binding["bits"] = slot.bits;
+  }
+}
+
+void IRBindings::learn(uint32_t key) {
+  learnKey = key;
+  learnStarted = millis();
+}
+
+/** Fibonacci hashing, the top bits of the product are the best mixed */
+uint8_t IRBindings::hash(int16_t protocol, uint64_t value, uint16_t bits) {
+  uint64_t h = (value ^ ((uint64_t)(uint16_t)protocol << 48) ^ ((uint64_t)bits << 40)) * 0x9E3779B97F4A7C15ULL;
+  return h >> 58; // 6 bits for the 64 slots
+}
+
+int16_t IRBindings::findSlot(int16_t protocol, uint64_t value, uint16_t bits) const {
+  uint8_t i = hash(protocol, value, bits);
+  for(uint8_t probes = 0; probes < BINDING_SLOTS; probes++) {
+    const Slot& slot = slots[i];
+    if(slot.state == Empty) return -1;
+    if(slot.state == Used && slot.value == value && slot.protocol == protocol && slot.bits == bits)
+      return i;
+    i = (i + 1) % BINDING_SLOTS;
+  }
+  return -1;
+}
+
+void IRBindings::insert(const Slot& slot) {
+  uint8_t i = hash(slot.protocol, slot.value, slot.bits);
+  while(slots[i].state == Used) i = (i + 1) % BINDING_SLOTS;
+  slots[i] = slot;
+}
+
+/** Drops the deleted markers so probe sequences stay short */
+void IRBindings::rebuild() {
+  Slot old[BINDING_SLOTS];
+  memcpy(old, slots, sizeof(slots));
+  memset(slots, 0, sizeof(slots));
+  for(uint8_t i = 0; i < BINDING_SLOTS; i++) {
+    if(old[i].state == Used) insert(old[i]);
+  }
+  recount();
+}
+
+void IRBindings::recount() {
+  count = 0;
+  deleted = 0;
+  foreign = 0;
+  for(uint8_t i = 0; i < BINDING_SLOTS; i++) {
+    if(slots[i].state == Deleted) deleted++;
+    if(slots[i].state != Used) continue;
+    count++;
+    if(slots[i].protocol != decode_type_t::NEC || slots[i].bits != 32) foreign++;
+  }
+}
+
+bool IRBindings::save() {
+  File file = LittleFS.open(BINDINGS_FILE, "w");
+  if(!file) return false;
+  uint32_t magic = BINDINGS_MAGIC;
+  bool ok = file.write((const uint8_t*)&magic, sizeof(magic)) == sizeof(magic)
+    && file.write((const uint8_t*)slots, sizeof(slots)) == sizeof(slots);
+  file.close();
+  Log("[IRBindings] Saved %d codes\n", count);
+  return ok;
+}
+
+uint32_t keyByName(const char* name) {
+  if(strcmp(name, "Unknown") == 0) return 0;
+  for(size_t i = 0; i < NEC_WAVEFORM_COUNT; i++) {
+    if(strcmp(keyName(necWaveforms[i].code), name) == 0) return necWaveforms[i].code;
+  }
+  return 0;
+}
@@ -0,0 +1,223 @@
+#include "IRTransmitter.h"
+
+#include <esp8266_peri.h>
+
+#include "DebugHelpers.hpp"
+
+#define IR_TX_MIN_ARM   microsecondsToClockCycles(5) // Closer deadlines are handled right away
+#define IR_TX_GPIO_PINS 16  // GPIO16 has a register of its own
+
+IRTransmitter* IRTransmitter::channels[IR_TX_MAX_CHANNELS];
+uint8_t IRTransmitter::channelCount = 0;
+void (*IRTransmitter::onSend)() = NULL;
+
+IRTransmitter::IRTransmitter(uint8_t pin) : pin(pin), framesSent(0), refused(0), frameCounter(NULL), head(0), tail(0), running(false), attached(false), carrier(false), carrierHigh(false) {}
+
+bool IRTransmitter::begin() {
+  pinMode(pin, OUTPUT);
+  digitalWrite(pin, LOW);
+  if(attached) return true;
+  if(pin >= IR_TX_GPIO_PINS) {
+    Err("[IRTransmitter] Pin %d can't carry the carrier\n", pin);
+    return false;
+  }
+  if(channelCount >= IR_TX_MAX_CHANNELS) {
+    Err("[IRTransmitter] No channel left for pin %d\n", pin);
+    return false;
+  }
+  if(channelCount == 0) {
+    timer0_isr_init();
+    timer0_attachInterrupt(&IRTransmitter::onTimer);
+  }
+  channels[channelCount++] = this;
+  attached = true;
+  return true;
+}
+
+bool IRTransmitter::send(uint32_t code, uint16_t repeat, uint16_t gapMs, uint8_t times) {
+  const NecWaveform* waveform = findNecWaveform(code);
+  if(!waveform || times == 0) return false;
+  return enqueue(waveform->timings, NEC_FRAME_LENGTH, repeat, gapMs, times);
+}
+
+bool IRTransmitter::sendRepeat(uint16_t repeat, uint16_t gapMs) {
+  if(repeat == 0) return true;
+  return enqueue(necRepeatWaveform, NEC_REPEAT_LENGTH, repeat - 1, gapMs, 1);
+}
+
+bool IRTransmitter::anyBusy() {
+  for(uint8_t i = 0; i < channelCount; i++) {
+    if(channels[i]->busy()) return true;
+  }
+  return false;
+}
+
+bool IRTransmitter::anyOnAir() {
+  for(uint8_t i = 0; i < channelCount; i++) {
+    if(channels[i]->onAir()) return true;
+  }
+  return false;
+}
+
+bool IRTransmitter::enqueue(const uint16_t* timings, uint8_t length, uint16_t repeat, uint16_t gapMs, uint8_t times) {
+  // Without a channel nothing would ever run the frame and busy() would stay true
+  if(!attached) return false;
+
+  // Never wait for the interrupt to catch up, that would stall the loop for
+  // as long as the queued frames take. Callers check room() first
+  uint8_t next = (head + 1) % IR_TX_QUEUE_SIZE;
+  if(next == tail) {
+    refused++;
+    Err("[IRTransmitter] Queue full on pin %d\n", pin);
+    return false;
+  }
+  if(onSend) onSend();
+
+  queue[head].timings = timings;
+  queue[head].length = length;
+  queue[head].repeat = repeat;
+  queue[head].gapMs = gapMs;
+  queue[head].times = times;
+  head = next;
+
+  noInterrupts();
+  if(!running) {
+    running = true;
+    loadNext();
+    deadline = ESP.getCycleCount();
+    tick();
+    schedule();
+  }
+  interrupts();
+  return true;
+}
+
+bool IRTransmitter::loadNext() {
+  if(tail == head) return false;
+  const Frame& frame = queue[tail];
+  pressTimings = frame.timings;
+  pressLength = frame.length;
+  pressRepeat = frame.repeat;
+  timesLeft = frame.times;
+  gapMs = frame.gapMs;
+  tail = (tail + 1) % IR_TX_QUEUE_SIZE;
+  startPress();
+  return true;
+}
+
+void IRTransmitter::startPress() {
+  timings = pressTimings;
+  length = pressLength;
+  repeatLeft = pressRepeat;
+  segment = 0;
+  elapsed = 0;
+  phase = Segments;
+}
+
+/** Ends the current mark/space and moves the deadline to the end of the next one.
+ *  The deadline advances from the previous one so timer latency doesn't add up */
+void IRTransmitter::tick() {
+  uint32_t duration;
+  for(;;) {
+    if(phase == Segments && segment < length) {
+      duration = timings[segment];
+      if(segment % 2 == 0)
+        startCarrier();
+      else
+        stopCarrier();
+      segment++;
+      elapsed += duration;
+      break;
+    }
+    if(phase == Segments) {
+      // Pad every frame to the NEC frame period, like IRsend does
+      stopCarrier();
+      framesSent++;
+      if(frameCounter) (*frameCounter)++;
+      phase = Padding;
+      duration = NEC_FRAME_PERIOD - elapsed;
+      break;
+    }
+    if(repeatLeft > 0) {
+      repeatLeft--;
+      timings = necRepeatWaveform;
+      length = NEC_REPEAT_LENGTH;
+      segment = 0;
+      elapsed = 0;
+      phase = Segments;
+      continue;
+    }
+    if(phase == Padding && gapMs > 0) {
+      phase = Gap;
+      duration = gapMs * 1000UL;
+      break;
+    }
+    if(--timesLeft > 0) {
+      startPress();
+      continue;
+    }
+    if(!loadNext()) {
+      running = false;
+      return;
+    }
+  }
+  deadline += microsecondsToClockCycles(duration);
+}
+
+/** A mark starts at deadline with the carrier high. Single register writes,
+ *  nothing here waits on another interrupt */
+void IRTransmitter::startCarrier() {
+  GPOS = 1 << pin;
+  carrier = true;
+  carrierHigh = true;
+  carrierAt = deadline + microsecondsToClockCycles(NEC_CARRIER_HIGH);
+}
+
+void IRTransmitter::stopCarrier() {
+  GPOC = 1 << pin;
+  carrier = false;
+}
+
+/** Next half period, it advances from the previous edge like the deadline does */
+void IRTransmitter::toggleCarrier() {
+  carrierHigh = !carrierHigh;
+  if(carrierHigh) {
+    GPOS = 1 << pin;
+    carrierAt += microsecondsToClockCycles(NEC_CARRIER_HIGH);
+  } else {
+    GPOC = 1 << pin;
+    carrierAt += microsecondsToClockCycles(NEC_CARRIER_LOW);
+  }
+}
+
+/** Runs every transmitter that is due and arms timer0 for the next deadline
+ *  or carrier edge */
+void IRTransmitter::schedule() {
+  for(;;) {
+    uint32_t now = ESP.getCycleCount();
+    uint32_t next = 0;
+    bool pending = false;
+    for(uint8_t i = 0; i < channelCount; i++) {
+      IRTransmitter* channel = channels[i];
+      if(!channel->running) continue;
+      if((int32_t)(channel->deadline - now) < (int32_t)IR_TX_MIN_ARM) {
+        channel->tick();
+        if(!channel->running) continue;
+      }
+      if(channel->carrier && (int32_t)(channel->carrierAt - now) < (int32_t)IR_TX_MIN_ARM) channel->toggleCarrier();
+      uint32_t due = channel->carrier && (int32_t)(channel->carrierAt - channel->deadline) < 0 ? channel->carrierAt : channel->deadline;
+      if(!pending || (int32_t)(due - next) < 0) next = due;
+      pending = true;
+    }
+    if(!pending) return;
+    if((int32_t)(next - ESP.getCycleCount()) >= (int32_t)IR_TX_MIN_ARM) {
+      timer0_write(next);
+      return;
+    }
+  }
+}
+
+void IRTransmitter::onTimer() {
+  // timer0 also fires when the cycle counter wraps, schedule() ignores idle channels
+  schedule();
+}
@@ -0,0 +1,27 @@
+#include "NecWaveform.h"
+
+const NecWaveform necWaveforms[NEC_WAVEFORM_COUNT] = {
+  NEC_WAVEFORM(POWER_IR),
+  NEC_WAVEFORM(INPUT_IR),
+  NEC_WAVEFORM(MUTE_IR),
+  NEC_WAVEFORM(LEVEL_IR),
+  NEC_WAVEFORM(PLUS_IR),
+  NEC_WAVEFORM(EFFECT_IR),
+  NEC_WAVEFORM(MINUS_IR),
+  NEC_WAVEFORM(INPUT1_IR),
+  NEC_WAVEFORM(INPUT2_IR),
+  NEC_WAVEFORM(INPUT3_IR),
+  NEC_WAVEFORM(INPUT4_IR),
+  NEC_WAVEFORM(INPUT5_IR),
+  NEC_WAVEFORM(AUX_IR),
+  NEC_WAVEFORM(TEST_IR),
+};
+
+const uint16_t necRepeatWaveform[NEC_REPEAT_LENGTH] = { NEC_HDR_MARK, NEC_RPT_SPACE, NEC_BIT_MARK };
+
+const NecWaveform* findNecWaveform(uint32_t code) {
+  for(const NecWaveform& waveform : necWaveforms) {
+    if(waveform.code == code) return &waveform;
+  }
+  return NULL;
+}
@@ -0,0 +1,56 @@
+#include "RuntimeStats.h"
+
+RuntimeStats stats;
+
+RuntimeStats::RuntimeStats() {
+  reset();
+}
+
+void RuntimeStats::commandDone(uint32_t latencyMs) {
+  uint8_t bucket = 0;
+  while(bucket < STATS_LATENCY_BUCKETS - 1 && latencyMs >= (1UL << bucket)) bucket++;
+  latency[bucket]++;
+  commands++;
+  if(latencyMs > maxLatency) maxLatency = latencyMs;
+}
+
+void RuntimeStats::loopPass(uint32_t us) {
+  if(us > maxLoop) maxLoop = us;
+}
+
+void RuntimeStats::sampleHeap() {
+  uint32_t heap = ESP.getFreeHeap();
+  uint32_t block = ESP.getMaxFreeBlockSize();
+  if(heap < heapLow) heapLow = heap;
+  if(block < blockLow) blockLow = block;
+}
+
+uint32_t RuntimeStats::latencyPercentile(uint8_t percent) const {
+  if(commands == 0) return 0;
+  uint32_t wanted = ((uint64_t)commands * percent + 99) / 100;
+  uint32_t seen = 0;
+  for(uint8_t i = 0; i < STATS_LATENCY_BUCKETS - 1; i++) {
+    seen += latency[i];
+    if(seen >= wanted) return 1UL << i;
+  }
+  return maxLatency;
+}
+
+bool RuntimeStats::healthy() const {
+  return latencyPercentile(99) <= STATS_LATENCY_LIMIT && maxLoop <= STATS_LOOP_LIMIT
+    && heapLow >= STATS_HEAP_FLOOR;
+}
+
+void RuntimeStats::reset() {
+  memset(latency, 0, sizeof(latency));
+  commands = 0;
+  maxLatency = 0;
+  maxLoop = 0;
+  heapLow = UINT32_MAX;
+  blockLow = UINT32_MAX;
+  malformed = 0;
+  oversized = 0;
+  wifiDrops = 0;
+  mqttReconnects = 0;
+  since = millis();
+}
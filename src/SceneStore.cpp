@@ -0,0 +1,60 @@
+#include "SceneStore.h"
+
+#include <LittleFS.h>
+
+#include "DebugHelpers.hpp"
+
+SceneStore scenes;
+
+bool SceneStore::begin() {
+  if(!LittleFS.begin()) {
+    Logln("[SceneStore] Mounting LittleFS failed");
+    return false;
+  }
+  return true;
+}
+
+bool SceneStore::save(const char* name, const String& json) {
+  if(!validName(name)) return false;
+  File file = LittleFS.open(path(name), "w");
+  if(!file) return false;
+  bool ok = file.print(json) == json.length();
+  file.close();
+  Log("[SceneStore] Saved %s: %s\n", name, json.c_str());
+  return ok;
+}
+
+bool SceneStore::load(const char* name, String& json) {
+  if(!validName(name)) return false;
+  File file = LittleFS.open(path(name), "r");
+  if(!file) return false;
+  json = file.readString();
+  file.close();
+  return true;
+}
+
+bool SceneStore::remove(const char* name) {
+  return validName(name) && LittleFS.remove(path(name));
+}
+
+void SceneStore::list(JsonArray names) {
+  Dir dir = LittleFS.openDir(SCENE_DIR);
+  while(dir.next()) {
+    String name = dir.fileName();
+    name.remove(name.length() - 5); // ".json"
+    names.add(name);
+  }
+}
+
+bool SceneStore::validName(const char* name) {
+  size_t length = strlen(name);
+  if(length == 0 || length >= SCENE_NAME_SIZE) return false;
+  for(size_t i = 0; i < length; i++) {
+    if(!isalnum(name[i]) && name[i] != '-' && name[i] != '_') return false;
+  }
+  return true;
+}
+
+String SceneStore::path(const char* name) {
+  return String(SCENE_DIR) + name + ".json";
+}
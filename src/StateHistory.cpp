@@ -0,0 +1,220 @@
+#include "StateHistory.h"
+
+#include <LittleFS.h>
+
+#include "DebugHelpers.hpp"
+
+#define HISTORY_MAGIC 0x5A394831 // "Z9H1"
+
+StateHistory history;
+
+/** Splits the unit << 6 | source << 3 | field byte */
+static void unpackTag(uint8_t tag, StateHistory::Entry& entry) {
+  entry.unit = tag >> 6;
+  entry.source = (HistorySource)((tag >> 3) & 0x07);
+  entry.field = tag & 0x07;
+}
+
+StateHistory::StateHistory() : nextSeq(0), firstSeq(0), tail(0), used(0), tailSeq(0),
+  tailTime(0), lastTime(0), seqLimit(0), boot(0) {}
+
+void StateHistory::begin() {
+#ifdef HISTORY_ROLLOVER
+  // Carry on with the sequence numbers and boot count the files end with
+  static const char* const paths[] = { HISTORY_OLD_FILE, HISTORY_FILE };
+  bool found = false;
+  for(uint8_t i = 0; i < 2; i++) {
+    File file = LittleFS.open(paths[i], "r");
+    if(!file) continue;
+    ChunkHeader header;
+    while(file.read((uint8_t*)&header, sizeof(header)) == sizeof(header)) {
+      if(!found) firstSeq = header.seq;
+      found = true;
+      nextSeq = header.seq + header.count;
+      boot = header.boot + 1;
+      file.seek(header.length, SeekCur);
+    }
+    file.close();
+  }
+
+  // The boot count and the records that were only in RAM
+  File file = LittleFS.open(HISTORY_HEADER_FILE, "r");
+  if(file) {
+    Header header;
+    if(file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) && header.magic == HISTORY_MAGIC) {
+      if(header.boot + 1 > boot) boot = header.boot + 1;
+      if(header.seqLimit > nextSeq) nextSeq = header.seqLimit;
+    }
+    file.close();
+  }
+  tailSeq = nextSeq;
+  if(!found) firstSeq = nextSeq;
+  seqLimit = nextSeq;
+  saveHeader();
+  Log("[StateHistory] Boot %d, records %u..%u in LittleFS\n", boot, firstSeq, nextSeq);
+#endif
+}
+
+/** Counts the boot and reserves the next HISTORY_SEQ_RESERVE sequence numbers */
+void StateHistory::saveHeader() {
+  seqLimit += HISTORY_SEQ_RESERVE;
+  Header header = { HISTORY_MAGIC, seqLimit, boot, 0 };
+  File file = LittleFS.open(HISTORY_HEADER_FILE, "w");
+  if(!file || file.write((const uint8_t*)&header, sizeof(header)) != sizeof(header))
+    Logln("[StateHistory] Can't write " HISTORY_HEADER_FILE);
+  file.close();
+}
+
+void StateHistory::record(uint8_t unit, HistorySource source, uint8_t field, uint8_t value) {
+  uint32_t now = millis();
+  uint32_t dt = used == 0 ? 0 : now - lastTime;
+  uint8_t bytes[7];
+  size_t length = 0;
+  do {
+    bytes[length] = dt & 0x7F;
+    dt >>= 7;
+    if(dt) bytes[length] |= 0x80;
+    length++;
+  } while(dt);
+  bytes[length++] = (unit & 0x03) << 6 | (source & 0x07) << 3 | (field & 0x07);
+  bytes[length++] = value;
+
+  while(used + length > HISTORY_SIZE) {
+#ifdef HISTORY_ROLLOVER
+    rollover();
+#else
+    dropOldest();
+#endif
+  }
+
+  if(used == 0) tailTime = now;
+  for(size_t i = 0; i < length; i++) {
+    buffer[(tail + used + i) % HISTORY_SIZE] = bytes[i];
+  }
+  used += length;
+  lastTime = now;
+  nextSeq++;
+#ifdef HISTORY_ROLLOVER
+  if(nextSeq >= seqLimit) saveHeader();
+#endif
+}
+
+void StateHistory::read(uint32_t from, Reader reader, void* context) const {
+  bool more = true;
+#ifdef HISTORY_ROLLOVER
+  if(from < tailSeq) {
+    readFile(HISTORY_OLD_FILE, from, reader, context, more);
+    readFile(HISTORY_FILE, from, reader, context, more);
+  }
+#endif
+
+  Entry entry;
+  entry.seq = tailSeq;
+  entry.time = tailTime;
+  entry.boot = boot;
+  for(size_t i = 0; more && i < used; entry.seq++) {
+    uint32_t dt;
+    size_t length = recordLength(i, &dt);
+    if(i > 0) entry.time += dt;
+    unpackTag(at(i + length - 2), entry);
+    entry.value = at(i + length - 1);
+    if(entry.seq >= from) more = reader(entry, context);
+    i += length;
+  }
+}
+
+size_t StateHistory::recordLength(size_t i, uint32_t* dt) const {
+  uint32_t value = 0;
+  size_t n = 0;
+  uint8_t b;
+  do {
+    b = at(i + n);
+    value |= (uint32_t)(b & 0x7F) << (7 * n);
+    n++;
+  } while((b & 0x80) && n < 5);
+  if(dt) *dt = value;
+  return n + 2;
+}
+
+void StateHistory::dropOldest() {
+  size_t length = recordLength(0, NULL);
+  tail = (tail + length) % HISTORY_SIZE;
+  used -= length;
+  tailSeq++;
+  if(used > 0) {
+    // The new oldest record's delta was from the one just dropped
+    uint32_t dt;
+    recordLength(0, &dt);
+    tailTime += dt;
+  }
+#ifndef HISTORY_ROLLOVER
+  firstSeq = tailSeq;
+#endif
+}
+
+/** Appends the oldest half of the ring to HISTORY_FILE as one chunk */
+void StateHistory::rollover() {
+  size_t length = 0;
+  uint16_t count = 0;
+  while(length < HISTORY_SIZE / 2 && length < used) {
+    length += recordLength(length, NULL);
+    count++;
+  }
+
+  File file = LittleFS.open(HISTORY_FILE, "a");
+  if(file) {
+    ChunkHeader header = { tailSeq, tailTime, boot, count, (uint16_t)length, 0 };
+    file.write((const uint8_t*)&header, sizeof(header));
+    size_t first = length < HISTORY_SIZE - tail ? length : HISTORY_SIZE - tail;
+    file.write(buffer + tail, first);
+    if(length > first) file.write(buffer, length - first);
+    bool full = file.size() > HISTORY_FILE_MAX;
+    file.close();
+
+    if(full) {
+      // Keep one old file, what was in it is gone
+      LittleFS.remove(HISTORY_OLD_FILE);
+      LittleFS.rename(HISTORY_FILE, HISTORY_OLD_FILE);
+      File old = LittleFS.open(HISTORY_OLD_FILE, "r");
+      if(old && old.read((uint8_t*)&header, sizeof(header)) == sizeof(header))
+        firstSeq = header.seq;
+      old.close();
+    }
+  } else {
+    Logln("[StateHistory] Can't open " HISTORY_FILE ", dropping records");
+  }
+
+  while(count--) dropOldest();
+}
+
+void StateHistory::readFile(const char* path, uint32_t from, Reader reader, void* context, bool& more) const {
+  if(!more) return;
+  File file = LittleFS.open(path, "r");
+  if(!file) return;
+  ChunkHeader header;
+  while(more && file.read((uint8_t*)&header, sizeof(header)) == sizeof(header)) {
+    if(header.seq + header.count <= from) {
+      file.seek(header.length, SeekCur);
+      continue;
+    }
+    Entry entry;
+    entry.seq = header.seq;
+    entry.time = header.time;
+    entry.boot = header.boot;
+    for(uint16_t n = 0; more && n < header.count; n++, entry.seq++) {
+      uint32_t dt = 0;
+      uint8_t shift = 0;
+      int b;
+      do {
+        b = file.read();
+        dt |= (uint32_t)(b & 0x7F) << shift;
+        shift += 7;
+      } while((b & 0x80) && shift < 35);
+      if(n > 0) entry.time += dt;
+      unpackTag(file.read(), entry);
+      entry.value = file.read();
+      if(entry.seq >= from) more = reader(entry, context);
+    }
+  }
+  file.close();
+}
@@ -0,0 +1,106 @@
+#include "TimeSync.h"
+
+#include <ESP8266WiFi.h>
+
+#include "DebugHelpers.hpp"
+
+#define TIME_SYNC_MAGIC 0x5A39 // "Z9"
+
+TimeSync timeSync;
+
+TimeSync::TimeSync() : offset(0), roundTrip(0), chipId(0), referenceId(0), referenceSeen(0),
+  lastSent(0), haveOffset(false), sampleIndex(0) {}
+
+void TimeSync::begin() {
+  chipId = ESP.getChipId();
+  referenceId = chipId;
+  for(uint8_t i = 0; i < TIME_SYNC_SAMPLES; i++) {
+    sampleRoundTrip[i] = UINT32_MAX;
+  }
+  udp.begin(TIME_SYNC_PORT);
+  Log("[TimeSync] Listening on %d, chip id %08X\n", TIME_SYNC_PORT, chipId);
+}
+
+void TimeSync::handle() {
+  Packet packet;
+  while(udp.parsePacket() == sizeof(Packet)) {
+    udp.read((uint8_t*)&packet, sizeof(Packet));
+    if(packet.magic == TIME_SYNC_MAGIC && packet.chipId != chipId)
+      onPacket(packet, udp.remoteIP());
+  }
+  udp.flush();
+
+  uint32_t ms = millis();
+  if(!isReference() && ms - referenceSeen > TIME_SYNC_EXPIRE) {
+    Log("[TimeSync] Reference %08X is gone\n", referenceId);
+    referenceId = chipId;
+    haveOffset = false;
+  }
+
+  if(ms - lastSent < TIME_SYNC_INTERVAL) return;
+  lastSent = ms;
+
+  memset(&packet, 0, sizeof(packet));
+  packet.type = Beacon;
+  send(IPAddress(255, 255, 255, 255), packet);
+
+  if(!isReference()) {
+    packet.type = Request;
+    packet.t0 = millis();
+    send(referenceIP, packet);
+  }
+}
+
+void TimeSync::send(IPAddress ip, Packet& packet) {
+  packet.magic = TIME_SYNC_MAGIC;
+  packet.chipId = chipId;
+  udp.beginPacket(ip, TIME_SYNC_PORT);
+  udp.write((const uint8_t*)&packet, sizeof(Packet));
+  udp.endPacket();
+}
+
+void TimeSync::onPacket(Packet& packet, IPAddress from) {
+  uint32_t received = millis();
+  switch(packet.type) {
+    case Beacon:
+      if(packet.chipId <= referenceId) {
+        if(packet.chipId != referenceId) {
+          Log("[TimeSync] Following %08X at %s\n", packet.chipId, from.toString().c_str());
+          haveOffset = false;
+          for(uint8_t i = 0; i < TIME_SYNC_SAMPLES; i++) {
+            sampleRoundTrip[i] = UINT32_MAX;
+          }
+        }
+        referenceId = packet.chipId;
+        referenceIP = from;
+        referenceSeen = received;
+      }
+      break;
+    case Request:
+      if(isReference() || haveOffset) {
+        packet.t1 = received + offset;
+        packet.type = Response;
+        packet.t2 = now();
+        send(from, packet);
+      }
+      break;
+    case Response: {
+      if(packet.chipId != referenceId) break;
+      uint32_t t3 = received;
+      sampleRoundTrip[sampleIndex] = (t3 - packet.t0) - (packet.t2 - packet.t1);
+      sampleOffset[sampleIndex] = ((int32_t)(packet.t1 - packet.t0) + (int32_t)(packet.t2 - t3)) / 2;
+      sampleIndex = (sampleIndex + 1) % TIME_SYNC_SAMPLES;
+
+      // The shortest round trip had the least queueing, trust that one
+      uint8_t best = 0;
+      for(uint8_t i = 1; i < TIME_SYNC_SAMPLES; i++) {
+        if(sampleRoundTrip[i] < sampleRoundTrip[best]) best = i;
+      }
+      offset = sampleOffset[best];
+      roundTrip = sampleRoundTrip[best];
+      haveOffset = true;
+      Debugf("[TimeSync] Offset %d ms, round trip %u ms\n", offset, roundTrip);
+      break;
+    }
+  }
+}
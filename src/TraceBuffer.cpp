@@ -0,0 +1,47 @@
+#include "TraceBuffer.h"
+
+TraceBuffer trace;
+
+TraceBuffer::TraceBuffer() {
+  clear();
+}
+
+void TraceBuffer::record(Kind kind, uint8_t unit, const void* data, size_t length) {
+  if(length > TRACE_MAX_PAYLOAD) length = TRACE_MAX_PAYLOAD;
+  size_t needed = TRACE_RECORD_HEADER + length;
+  while(used + needed > TRACE_SIZE) dropOldest();
+
+  uint32_t now = millis();
+  uint8_t header[TRACE_RECORD_HEADER] = {
+    (uint8_t)now, (uint8_t)(now >> 8), (uint8_t)(now >> 16), (uint8_t)(now >> 24),
+    (uint8_t)(kind << 4 | (unit & 0x0F)), (uint8_t)length
+  };
+  size_t head = (tail + used) % TRACE_SIZE;
+  for(size_t i = 0; i < needed; i++) {
+    buffer[head] = i < TRACE_RECORD_HEADER ? header[i] : ((const uint8_t*)data)[i - TRACE_RECORD_HEADER];
+    head = (head + 1) % TRACE_SIZE;
+  }
+  used += needed;
+  records++;
+}
+
+void TraceBuffer::clear() {
+  tail = 0;
+  used = 0;
+  records = 0;
+  dropped = 0;
+}
+
+void TraceBuffer::read(void (*write)(const uint8_t* data, size_t length)) const {
+  size_t first = used < TRACE_SIZE - tail ? used : TRACE_SIZE - tail;
+  if(first > 0) write(buffer + tail, first);
+  if(used > first) write(buffer, used - first);
+}
+
+void TraceBuffer::dropOldest() {
+  size_t length = TRACE_RECORD_HEADER + buffer[(tail + TRACE_RECORD_HEADER - 1) % TRACE_SIZE];
+  tail = (tail + length) % TRACE_SIZE;
+  used -= length;
+  records--;
+  dropped++;
+}
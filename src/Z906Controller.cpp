@@ -0,0 +1,1015 @@
+#include "Z906Controller.h"
+
+#include <EEPROM.h>
+#include <IRutils.h>
+
+#include "DebugHelpers.hpp"
+#include "TimeSync.h"
+#include "TraceBuffer.h"
+
+#define ARRAY_SIZE(A) (sizeof(A) / sizeof((A)[0]))
+
+static int8_t findString(const char* s, const char* const array[], uint8_t len);
+static bool parseLevel(JsonVariantConst level, int8_t& value);
+static bool onlyTargetKeys(JsonObjectConst json);
+
+void (*Z906Controller::onReset)() = NULL;
+
+Z906Controller::Z906Controller(const char* name, uint8_t irPin, uint8_t onLedPin, uint8_t slot) :
+  name(name), group(""), isOn(false), source(SourceAuto), lastResyncMs(0), onLedPin(onLedPin), slot(slot), irtx(irPin), journal(slot),
+  lastMode(On), levelTimeout(0), rampLevel(0), rampSource(SourceAuto), boundHold(BOUND_HOLD_TIMEOUT), boundEchoed(0), holdUnsaved(false), heldBound(false), scheduled(0), sceneCacheNext(0),
+  resyncing(0), resyncStarted(0), lastResync(0), lastActivity(0), lastDecay(0) {
+  memset(&state, 0, sizeof(state));
+  state.mode = Off;
+  stateVersion = 0;
+  memset(sceneCache, 0, sizeof(sceneCache));
+  memset(confidence, CONFIDENCE_BOOT, sizeof(confidence));
+  memset(sentFrames, 0, sizeof(sentFrames));
+}
+
+void Z906Controller::begin(const char* clientRoot) {
+  String root = clientRoot;
+  if(name[0] != '\0')
+    root += String("/") + name;
+  commandTopic = root + "/cmnd/json";
+  stateTopic = root + "/state/json";
+  debugTopic = root + "/debug";
+
+  pinMode(onLedPin, INPUT);
+  irtx.begin();
+  journal.begin(irtx);
+  loadSettings();
+  recorded = state;
+}
+
+void Z906Controller::loadSettings() {
+  for(int8_t i = 0; i < 4; i++) {
+    state.soundLevel[i] = EEPROM.read(eepromAddr(SOUND_LEVEL_ADDR + i));
+    state.soundLevel[i] = constrain(state.soundLevel[i], 0, LEVEL_MAX);
+  }
+
+  state.input = (Input)EEPROM.read(eepromAddr(CURRENT_INPUT_ADDR));
+  state.input = state.input < INPUT_COUNT ? state.input : AUX;
+
+  for(uint8_t i= 0; i < INPUT_COUNT; i++) {
+    state.effectOnInput[i] = (Effect)EEPROM.read(eepromAddr(EFFECT_ON_AUX + i));
+    state.effectOnInput[i] = state.effectOnInput[i] < EFFECT_COUNT ? state.effectOnInput[i] : Surround;
+  }
+
+  state.mute = (bool)EEPROM.read(eepromAddr(MUTE_ADDR));
+
+  // We were reset in the middle of a command, the EEPROM holds where it
+  // was going, the journal where it got to
+  if(journal.replay(state)) {
+    saveSettings();
+    journal.commit();
+  }
+}
+
+void Z906Controller::saveSettings() {
+  stateVersion++;
+  for(uint8_t i = 0; i < 4; i++) {
+    EEPROM.write(eepromAddr(SOUND_LEVEL_ADDR + i), state.soundLevel[i]);
+  }
+  EEPROM.write(eepromAddr(CURRENT_INPUT_ADDR), state.input);
+  for(uint8_t i = 0; i < INPUT_COUNT; i++) {
+    EEPROM.write(eepromAddr(EFFECT_ON_AUX + i), state.effectOnInput[i]);
+  }
+  EEPROM.write(eepromAddr(MUTE_ADDR), state.mute);
+  if(EEPROM.commit())
+    Logln("Successfully saved to EEPROM");
+  else
+    Logln("Failed to save to EEPROM");
+}
+
+/** The level soundLevel[i] ends up at, i.e. the target of a running ramp */
+int8_t Z906Controller::targetLevel(uint8_t i) const {
+  int8_t level = state.soundLevel[i];
+  if(volumeRamp.active() && i == rampLevel) {
+    int16_t left = volumeRamp.total - volumeRamp.done;
+    level += volumeRamp.code == PLUS_IR ? left : -left;
+  }
+  return level;
+}
+
+void Z906Controller::getSettings(JsonObject json) {
+  JsonObject settings = json.createNestedObject("settings");
+  settings["mode"] = modes[state.mode];
+  if(state.mute)
+    settings["soundlevel"] = "mute";
+  else {
+    settings["soundlevel"] = targetLevel(0);
+    settings["basslevel"] = targetLevel(1);
+    settings["rearlevel"] = targetLevel(2);
+    settings["centerlevel"] = targetLevel(3);
+  }
+  settings["input"] = inputs[state.input];
+  settings["effect"] = effects[state.currentEffect()];
+}
+
+void Z906Controller::printSettings() {
+  Serial.printf("\nInput: %s\n", inputs[state.input]);
+  Serial.printf("Soundlevel: %d\t", state.soundLevel[0]);
+  Serial.printf("Bass: %d\t", state.soundLevel[1]);
+  Serial.printf("Rear: %d\n", state.soundLevel[2]);
+  Serial.printf("Center: %d\n", state.soundLevel[3]);
+  Serial.printf("Effect: %s\n\n", effects[state.currentEffect()]);
+}
+
+void Z906Controller::sendStates() {
+  const size_t bufferSize = JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(7);
+  DynamicJsonDocument doc(bufferSize);
+  JsonObject json = doc.to<JsonObject>();
+  getSettings(json);
+  String payload = "";
+  serializeJson(doc, payload);
+  postEvent(stateTopic.c_str(), payload);
+}
+
+/** Queues the code for transmission on this amp's IR LED, followed by gapMs
+ *  of silence. False when the transmitter won't take it, nothing is journaled then */
+bool Z906Controller::sendIR(uint32_t code, uint16_t repeat, uint16_t gapMs) {
+  if(!irtx.accepts()) {
+    Err("[sendIR] Transmitter on pin %d refused %08X\n", irtx.pin, code);
+    return false;
+  }
+  noteSent(state, code, repeat + 1);
+  return irtx.send(code, repeat, gapMs);
+}
+
+/** Journals frames about to be queued. Every frame sent may be missed by
+ *  the amp, the direct input codes set the input no matter what it was though */
+void Z906Controller::noteSent(const Z906State& sent, uint32_t code, uint16_t frames) {
+  lastActivity = millis();
+  journal.record(sent, code, frames, !irtx.busy());
+  uint8_t traced[6];
+  memcpy(traced, &code, 4);
+  memcpy(traced + 4, &frames, 2);
+  trace.record(TraceBuffer::IRSent, slot, traced, sizeof(traced));
+
+  uint8_t field = keyField(sent, code);
+  if(field == TARGET_INPUT) {
+    confidence[0] = CONFIDENCE_MAX;
+  } else {
+    chargeFrames(confidence, sentFrames, field, frames);
+  }
+}
+
+bool Z906Controller::turnOn() {
+  if(state.mode == Off) {
+    // The gap keeps the keys queued after it away while the amp boots
+    if(!sendIR(POWER_IR, 0, POWER_ON_DELAY)) return false;
+    state.mode = On;
+    saveSettings();
+  }
+  checkIfStillOn();
+  return true;
+}
+
+bool Z906Controller::turnOff() {
+  if(state.mode != Off) {
+    if(!sendIR(POWER_IR)) return false;
+    state.mode = Off;
+    saveSettings();
+  }
+  checkIfStillOn();
+  return true;
+}
+
+/** Starts ramping the current sound level to level over durationMs. With a
+ *  duration of 0 the steps follow the default acceleration curve. The level
+ *  is updated for every step sent and saved when the ramp is done */
+void Z906Controller::rampSoundLevel(int8_t level, uint32_t durationMs) {
+  level = constrain(level, 0, LEVEL_MAX);
+  rampLevel = state.currentLevel();
+  int8_t diff = level - state.soundLevel[rampLevel];
+  Log("[rampSoundLevel] Ramping sound level %d -> %d over %u ms\n", state.soundLevel[rampLevel], level, durationMs);
+  uint32_t code = diff > 0 ? PLUS_IR : MINUS_IR;
+  rampSource = source;
+  if(durationMs > 0)
+    volumeRamp.startTimed(code, abs(diff), durationMs, millis());
+  else
+    volumeRamp.start(code, abs(diff), millis(), rampAccelerate);
+}
+
+/** Stops a running ramp where it is */
+void Z906Controller::cancelRamp() {
+  if(volumeRamp.active()) {
+    Log("[cancelRamp] Stopped after %d of %d steps\n", volumeRamp.done, volumeRamp.total);
+    volumeRamp.cancel();
+    saveSettings();
+  }
+}
+
+/** Sends ir code and saves settings to change to wanted sound level */
+void Z906Controller::changeSoundLevel(int8_t level) {
+  rampSoundLevel(level, 0);
+}
+
+void Z906Controller::resetSettings() {
+  state.soundLevel[0] = 10;
+  state.soundLevel[1] = 25;
+  state.soundLevel[2] = 25;
+  state.soundLevel[3] = 25;
+  state.input = Input1;
+  for(uint8_t i= 0; i < INPUT_COUNT; i++) {
+    state.effectOnInput[i] = Surround;
+  }
+  saveSettings();
+}
+
+void Z906Controller::checkIfStillOn() {
+  bool lastBool = isOn;
+  Mode previousMode = state.mode;
+  isOn = digitalRead(onLedPin);
+  if(isOn) {
+    state.mode = state.mode == Off ? On : state.mode;
+  } else {
+    state.mode = Off;
+  }
+  if(state.mode != previousMode) stateVersion++;
+
+  if(!lastBool && isOn) {
+    // The amp comes back on in On mode, but may have lost levels changed
+    // on its console while we weren't looking
+    confidence[2] = CONFIDENCE_MAX;
+    lowerConfidence(confidence, TARGET_LEVELS, CONFIDENCE_POWER_CYCLE);
+  }
+
+  if(lastBool != isOn) {
+    uint8_t level = isOn;
+    trace.record(TraceBuffer::OnLed, slot, &level, sizeof(level));
+    sendStates();
+  }
+  Debugf("[checkIfStillON] %s\n", isOn ? "On" : "Off");
+}
+
+void Z906Controller::receiveIR(decode_type_t protocol, uint64_t value, uint16_t bits, bool repeat) {
+  uint32_t code = repeat ? NEC_REPEAT : (uint32_t)value;
+  trace.record(TraceBuffer::IRFrame, slot, &code, sizeof(code));
+
+  if(repeat) {
+    if(heldBound)
+      handleBoundKey(NEC_REPEAT);
+    else
+      handleIRCode(NEC_REPEAT);
+    return;
+  }
+
+  bool z906 = protocol == decode_type_t::NEC && bits == 32 && findNecWaveform(code);
+  if(!z906 && protocol != decode_type_t::UNKNOWN && bindings.learning()) {
+    learnIRCode(protocol, value, bits);
+    return;
+  }
+  uint32_t key = z906 ? 0 : bindings.find(protocol, value, bits);
+  heldBound = key != 0;
+  if(key)
+    handleBoundKey(key);
+  else
+    handleIRCode(code);
+}
+
+/** Binds the code to the key learn mode waits for and publishes the result */
+void Z906Controller::learnIRCode(decode_type_t protocol, uint64_t value, uint16_t bits) {
+  uint32_t key = bindings.learnKey;
+  bindings.stopLearning();
+  bool saved = bindings.bind(protocol, value, bits, key);
+
+  DynamicJsonDocument doc(JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(5) + 64);
+  JsonObject learned = doc.createNestedObject("learned");
+  learned["key"] = keyName(key);
+  learned["protocol"] = typeToString(protocol);
+  learned["value"] = uint64ToString(value, 16);
+  learned["bits"] = bits;
+  learned["saved"] = saved;
+  String payload = "";
+  serializeJson(doc, payload);
+  postEvent(stateTopic.c_str(), payload);
+}
+
+void Z906Controller::handleIRCode(uint32_t code) {
+  lastActivity = millis();
+  uint32_t key = remoteHold.onFrame(code, millis());
+  bool repeat = code == NEC_REPEAT;
+  if(repeat && isRepeatableKey(key)) {
+    Logln("[handleIR] Repeat.");
+    code = key;
+  } else if(repeat) {
+    Logln("[handleIR] Not repeatable.");
+    if(key == NEC_REPEAT) {
+      // Repeats of a key we never saw, a level may have moved without us
+      lowerConfidence(confidence, TARGET_LEVELS, CONFIDENCE_ORPHAN);
+    }
+    return;
+  } else {
+    // The remote takes over from a ramp
+    cancelRamp();
+  }
+
+  if(!state.applyKey(code)) {
+    Log("No such ir code case: %X\n", code);
+    return;
+  }
+  Log("[handleIR] %s button pressed.\n", keyName(code));
+
+  // Things that has to be done in all standard states
+  if(repeat) {
+    // Don't commit the EEPROM ~9 times a second while a key is held
+    holdUnsaved = true;
+    stateVersion++;
+    return;
+  }
+  saveSettings();
+  sendStates();
+}
+
+void Z906Controller::handleBoundKey(uint32_t code) {
+  lastActivity = millis();
+  uint32_t key = boundHold.onFrame(code, millis());
+  bool repeat = code == NEC_REPEAT;
+  if(repeat && !isRepeatableKey(key)) return;
+  // A held key mustn't pile frames up behind the transmitter. Once only the
+  // padding of our last frame is left the echo goes on right behind it
+  if(isRepeatableKey(key) && irtx.onAir()) return;
+  if(irtx.room() == 0) return;
+
+  uint16_t frames = 1;
+  if(repeat) {
+    // The ones the remote sent while the receiver was off go in the same burst
+    uint16_t due = boundHold.repeatsBy(millis());
+    if(due <= boundEchoed) return;
+    frames = due - boundEchoed;
+    boundEchoed = due;
+    Log("[handleBoundKey] %s (held, %u repeats)\n", keyName(key), frames);
+    noteSent(state, key, frames);
+    irtx.sendRepeat(frames);
+  } else {
+    Log("[handleBoundKey] %s\n", keyName(key));
+    boundEchoed = 0;
+    cancelRamp();
+    // No gap, so the repeats of a held key follow the frame
+    noteSent(state, key, 1);
+    irtx.send(key);
+  }
+  while(frames--) applySent(state, key);
+
+  if(isRepeatableKey(key)) {
+    // Saved when the key is released, like a held key on the Z906 remote
+    holdUnsaved = true;
+    stateVersion++;
+    return;
+  }
+  saveSettings();
+  sendStates();
+}
+
+void Z906Controller::recordChanges(HistorySource source) {
+  if(memcmp(&recorded, &state, sizeof(state)) == 0) return;
+  if(state.input != recorded.input)
+    history.record(slot, source, 0, state.input);
+  if(state.currentEffect() != recorded.currentEffect())
+    history.record(slot, source, 1, state.currentEffect());
+  if(state.mode != recorded.mode)
+    history.record(slot, source, 2, state.mode);
+  if(state.mute != recorded.mute)
+    history.record(slot, source, 3, state.mute);
+  for(uint8_t i = 0; i < 4; i++) {
+    if(state.soundLevel[i] != recorded.soundLevel[i])
+      history.record(slot, source, 4 + i, state.soundLevel[i]);
+  }
+  recorded = state;
+}
+
+void Z906Controller::missedFrame() {
+  lowerConfidence(confidence, 0xFF, CONFIDENCE_NOISE);
+}
+
+void Z906Controller::service() {
+  // A step that doesn't fit waits for the next call, the ramp catches up
+  IRRamp::Step step = irtx.room() > 0 ? volumeRamp.poll(millis()) : IRRamp::None;
+  if(step != IRRamp::None) {
+    noteSent(state, volumeRamp.code, 1);
+    if(step == IRRamp::Frame)
+      irtx.send(volumeRamp.code);
+    else
+      irtx.sendRepeat(1);
+    state.soundLevel[rampLevel] += volumeRamp.code == PLUS_IR ? 1 : -1;
+    stateVersion++;
+    if(!volumeRamp.active()) {
+      Log("[service] Ramp done, %d steps in %lu ms\n", volumeRamp.done, millis() - volumeRamp.startedAt);
+      recordChanges(rampSource);
+      saveSettings();
+      sendStates();
+    }
+  }
+
+  if(holdUnsaved && !remoteHold.held(millis()) && !boundHold.held(millis())) {
+    holdUnsaved = false;
+    saveSettings();
+    sendStates();
+  }
+
+  // We need to go back to On-mode after a while
+  if(isOn && state.mode >= BassLevel) {
+    if(state.mode != lastMode) {
+      levelTimeout = millis() + LEVEL_TIMEOUT;
+    } else if(millis() > levelTimeout) {
+      state.mode = On;
+      saveSettings();
+      Logln("[service] Ending level mode..");
+      sendStates();
+    }
+  }
+  lastMode = state.mode;
+
+  for(uint8_t i = 0; i < scheduled && ready(); i++) {
+    if((int32_t)(timeSync.now() - schedule[i].at) < 0) continue;
+    Log("[service] Running command scheduled for %u, now %u\n", schedule[i].at, timeSync.now());
+    String req = schedule[i].req;
+    schedule[i] = schedule[--scheduled];
+    postEvent(stateTopic.c_str(), handleJSONReq(req));
+    break;
+  }
+
+  // A resync is done once the transmitter has sent all of it
+  if(resyncing && !irtx.busy()) {
+    lastResyncMs = millis() - resyncStarted;
+    DynamicJsonDocument doc(JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(PARAM_COUNT));
+    JsonObject report = doc.createNestedObject("resync");
+    JsonArray params = report.createNestedArray("params");
+    for(uint8_t i = 0; i < PARAM_COUNT; i++) {
+      if(resyncing & (1 << i)) params.add(paramNames[i]);
+    }
+    report["ms"] = lastResyncMs;
+    String payload = "";
+    serializeJson(doc, payload);
+    postEvent(debugTopic.c_str(), payload);
+    Log("[service] Resync done in %lu ms\n", lastResyncMs);
+    resyncing = 0;
+    sendStates();
+  }
+
+  // Everything drifts a little while the amp is on, the console and other
+  // remotes can change it without us seeing
+  if(isOn && millis() - lastDecay > RESYNC_DECAY_MS) {
+    lastDecay = millis();
+    lowerConfidence(confidence, 0xFF, CONFIDENCE_DECAY);
+  }
+
+  // Resync what we're unsure of once nobody has touched the amp for a while
+  // (and it's back in On mode)
+  if(isOn && !resyncing && !irtx.busy() && !volumeRamp.active()
+     && millis() - lastActivity > LEVEL_TIMEOUT + 1000
+     && (lastResync == 0 || millis() - lastResync > RESYNC_MIN_INTERVAL)) {
+    uint8_t unsure = 0;
+    for(uint8_t i = 0; i < PARAM_COUNT; i++) {
+      if(confidence[i] < RESYNC_THRESHOLD) unsure |= 1 << i;
+    }
+    unsure &= RESYNC_SUPPORTED;
+    if(unsure) {
+      lastResync = millis();
+      Log("[service] Low confidence (%02X), resyncing\n", unsure);
+      resync(unsure);
+    }
+  }
+
+  // Everything is on the air and saved, nothing to replay after a reset
+  if(journal.open() && !irtx.busy() && !volumeRamp.active() && !holdUnsaved) {
+    journal.commit();
+  }
+
+  // Keep the cached scenes compiled against the current state, one per call
+  if(!volumeRamp.active() && !irtx.busy()) {
+    for(uint8_t i = 0; i < SCENE_CACHE_SIZE; i++) {
+      CompiledScene& scene = sceneCache[i];
+      if(scene.name[0] == '\0' || scene.version == stateVersion) continue;
+      if(!compileScene(scene)) scene.name[0] = '\0';
+      break;
+    }
+  }
+
+  // Level timeouts, resyncs and scheduled commands (a ramp is recorded once done)
+  if(!volumeRamp.active()) recordChanges(SourceAuto);
+}
+
+/** Plans the scene's key presses from the current state, false if it can't be loaded */
+bool Z906Controller::compileScene(CompiledScene& scene) {
+  String json;
+  if(!scenes.load(scene.name, json)) return false;
+  StaticJsonDocument<REQUEST_DOC_SIZE> doc;
+  if(deserializeJson(doc, json)) return false;
+  Z906Target target;
+  if(!parseTarget(doc.as<JsonObjectConst>(), target)) return false;
+
+  scene.result = state;
+  scene.unreachable = planSequence(scene.result, target, scene.seq);
+  scene.version = stateVersion;
+  Log("[compileScene] %s: %d steps, %d presses\n", scene.name, scene.seq.length, scene.seq.presses());
+  return true;
+}
+
+/** Returns the scene compiled against the current state, from the cache if possible */
+Z906Controller::CompiledScene* Z906Controller::compileScene(const char* name) {
+  CompiledScene* scene = NULL;
+  for(uint8_t i = 0; i < SCENE_CACHE_SIZE; i++) {
+    if(strcmp(sceneCache[i].name, name) == 0) scene = &sceneCache[i];
+  }
+  if(scene && scene->version == stateVersion) return scene;
+  if(!scene) {
+    if(!SceneStore::validName(name)) return NULL;
+    scene = &sceneCache[sceneCacheNext];
+    sceneCacheNext = (sceneCacheNext + 1) % SCENE_CACHE_SIZE;
+    strcpy(scene->name, name);
+  }
+  if(compileScene(*scene)) return scene;
+  scene->name[0] = '\0';
+  return NULL;
+}
+
+/** Queues all steps back to back on the transmitter, without waiting for
+ *  it. Callers check ready() first, a step that doesn't fit is dropped */
+void Z906Controller::runSequence(const IRSequence& seq) {
+  Z906State sent = state;
+  for(uint8_t i = 0; i < seq.length; i++) {
+    const IRStep& step = seq.steps[i];
+    noteSent(sent, step.code, step.count);
+    // Follow input, effect and mode so Plus/Minus count against the right level
+    for(uint8_t k = 0; k < INPUT_COUNT; k++) {
+      if(inputCode((Input)k) == step.code) sent.input = (Input)k;
+    }
+    if(step.code == POWER_IR || step.code == LEVEL_IR || step.code == EFFECT_IR) {
+      for(uint8_t j = 0; j < step.count; j++) sent.applyKey(step.code);
+    }
+    uint16_t gap = step.gapMs ? step.gapMs : MS_BETWEEN_SENDING_IR;
+    if(isRepeatableKey(step.code)) {
+      // One frame and repeat frames, one step each (like a ramp)
+      irtx.send(step.code, step.count - 1, gap);
+    } else if(step.count > 1 && step.gapMs) {
+      // Only the last press waits gapMs
+      irtx.send(step.code, 0, MS_BETWEEN_SENDING_IR, step.count - 1);
+      irtx.send(step.code, 0, step.gapMs);
+    } else {
+      // Separate presses, one queue entry for all of them
+      irtx.send(step.code, 0, gap, step.count);
+    }
+  }
+}
+
+bool Z906Controller::applyScene(const char* name) {
+  CompiledScene* scene = compileScene(name);
+  if(!scene) return false;
+  Log("[applyScene] Applying %s, %d presses\n", name, scene->seq.presses());
+  volumeRamp.cancel();
+  runSequence(scene->seq);
+  state = scene->result;
+  saveSettings();
+  sendStates();
+  return true;
+}
+
+uint8_t Z906Controller::resync(uint8_t fields) {
+  if(resyncing || state.mode == Off) return 0;
+  volumeRamp.cancel();
+  IRSequence seq;
+  Z906State believed = state;
+  fields = planResync(believed, fields, seq);
+  if(!fields) return 0;
+  Log("[resync] Resyncing %02X, %d presses\n", fields, seq.presses());
+  runSequence(seq);
+  state = believed;
+  for(uint8_t i = 0; i < PARAM_COUNT; i++) {
+    if(fields & (1 << i)) confidence[i] = CONFIDENCE_MAX;
+  }
+  resyncing = fields;
+  resyncStarted = millis();
+  lastResync = resyncStarted;
+  saveSettings();
+  return fields;
+}
+
+bool Z906Controller::applyBatch(JsonArrayConst ops, JsonObject json) {
+  JsonArray results = json.createNestedArray("results");
+  Z906Target merged;
+  memset(&merged, 0, sizeof(merged));
+  uint8_t opFields[BATCH_SIZE];
+  uint8_t count = 0;
+  int8_t invalid = -1;
+
+  // Later operations win, like they would one after the other. The effect
+  // is for the input the batch ends on (see Z906Target). A key parseTarget()
+  // doesn't know is a typo, not something to leave out silently
+  for(JsonVariantConst op : ops) {
+    Z906Target target;
+    if(count >= BATCH_SIZE || !op.is<JsonObjectConst>() || !onlyTargetKeys(op.as<JsonObjectConst>())
+      || !parseTarget(op.as<JsonObjectConst>(), target) || !target.fields) {
+      invalid = count;
+      break;
+    }
+    opFields[count++] = target.fields;
+    if(target.fields & TARGET_INPUT) merged.state.input = target.state.input;
+    if(target.fields & TARGET_EFFECT) merged.effect = target.effect;
+    if(target.fields & TARGET_MODE) merged.state.mode = target.state.mode;
+    if(target.fields & TARGET_MUTE) merged.state.mute = target.state.mute;
+    for(uint8_t i = 0; i < 4; i++) {
+      if(target.fields & TARGET_LEVEL(i)) merged.state.soundLevel[i] = target.state.soundLevel[i];
+    }
+    merged.fields |= target.fields;
+  }
+
+  if(invalid >= 0) {
+    for(uint8_t i = 0; i < ops.size(); i++) results.add(i == invalid ? "invalid" : "skipped");
+    return false;
+  }
+
+  Log("[applyBatch] %d operations\n", count);
+  uint8_t unreachable = applyTarget(merged, json);
+
+  for(uint8_t i = 0; i < count; i++) {
+    uint8_t after = 0;
+    for(uint8_t j = i + 1; j < count; j++) after |= opFields[j];
+    if(opFields[i] & unreachable)
+      results.add("unreachable");
+    else if((opFields[i] & ~after) == 0)
+      results.add("overridden");
+    else
+      results.add("ok");
+  }
+  getSettings(json);
+  return true;
+}
+
+uint8_t Z906Controller::applyTarget(const Z906Target& target, JsonObject json) {
+  Z906State result = state;
+  IRSequence seq;
+  uint8_t unreachable = planSequence(result, target, seq);
+  Log("[applyTarget] %d steps, %d presses\n", seq.length, seq.presses());
+  volumeRamp.cancel();
+  runSequence(seq);
+  state = result;
+  if(seq.length) saveSettings();
+  json["presses"] = seq.presses();
+  return unreachable;
+}
+
+/** Keeps req until the shared clock reaches at, returns false when full */
+bool Z906Controller::scheduleJSONReq(uint32_t at, String req) {
+  if(scheduled >= SCHEDULE_SIZE) return false;
+  schedule[scheduled].at = at;
+  schedule[scheduled].req = req;
+  scheduled++;
+  return true;
+}
+
+String Z906Controller::handleJSONReq(String req) {
+  StaticJsonDocument<REQUEST_DOC_SIZE> reqDoc;
+  auto error = deserializeJson(reqDoc, req);
+
+  if (error) {
+    Err("deserializeJson() failed with code ");
+    Err(error.c_str());
+    return "";
+  }
+
+  Serial.print("[handleJSON] Payload: ");
+  serializeJson(reqDoc, Serial);
+  Serial.println("");
+
+  const size_t bufferSize = JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(7);
+  DynamicJsonDocument resDoc(bufferSize);
+  JsonObject json = resDoc.to<JsonObject>();
+
+  String response = "";
+  String method = reqDoc["method"];
+
+  // Every controller on the group topic gets a group command, the ones
+  // outside the group it names drop it
+  const char* forGroup = reqDoc["group"] | GROUP_ALL;
+  if(strcmp(forGroup, GROUP_ALL) != 0 && strcmp(forGroup, group) != 0) {
+    Log("[handleJSON] Command for group '%s', not ours\n", forGroup);
+    return "";
+  }
+
+  // Group commands carry the time on the shared clock they should run at,
+  // so every unit in the group sends its IR at the same instant
+  if(reqDoc.containsKey("at")) {
+    uint32_t at = reqDoc["at"];
+    int32_t wait = (int32_t)(at - timeSync.now());
+    Log("[handleJSON] Group '%s' command at %u, %d ms from now%s\n", forGroup, at, wait, timeSync.synced() ? "" : " (clock not synced)");
+    if(wait > 0) {
+      reqDoc.remove("at");
+      String later = "";
+      serializeJson(reqDoc, later);
+      if(scheduleJSONReq(at, later)) {
+        json["scheduled"] = at;
+      } else {
+        json["message"] = "Too many scheduled commands";
+      }
+      json["time"] = timeSync.now();
+      serializeJson(resDoc, response);
+      return response;
+    } else if(wait < -SCHEDULE_LATE_LIMIT) {
+      json["message"] = "Too late, command dropped";
+      json["time"] = timeSync.now();
+      serializeJson(resDoc, response);
+      return response;
+    }
+  }
+
+  if(method == "turnOn") {
+    Logln("[handleJSON] Calling turnOn");
+    if(!turnOn()) json["message"] = "IR transmitter busy, try again";
+  } else if(method == "turnOff") {
+    Logln("[handleJSON] Calling turnOff");
+    if(!turnOff()) json["message"] = "IR transmitter busy, try again";
+  }
+
+  // Getters 
+  else if(method == "getSettings") {
+    Logln("[handleJSON] Calling getSettings");
+    getSettings(json);
+  } else if(method == "getMode") {
+    Logln("[handleJSON] Calling getMode");
+    Logln(modes[state.mode]);
+    json["mode"] = modes[state.mode];
+  } else if(method == "getSoundLevel") {
+    Logln("[handleJSON] Calling getSoundLevel");
+    json["soundlevel"] = state.soundLevel[0];
+  } else if(method == "getInput") {
+    Logln("[handleJSON] Calling getInput");
+    json["input"] = inputs[state.input];
+  } else if(method == "getEffect") {
+    Logln("[handleJSON] Calling getEffect");
+    json["effect"] = effects[state.currentEffect()];
+  } else if(method == "getTime") {
+    Logln("[handleJSON] Calling getTime");
+    json["time"] = timeSync.now();
+    json["synced"] = timeSync.synced();
+  }
+
+  // Setters
+  else if(method == "setSettings") {
+    // One planned sequence like a batch: the power on delay is a gap on the
+    // transmitter, so the answer doesn't wait for the amp to boot
+    int8_t soundlevel;
+    Z906Target target;
+    if(!reqDoc["soundlevel"].isNull() && !parseLevel(reqDoc["soundlevel"], soundlevel)) {
+      json["message"] = "Invalid soundlevel";
+    } else if(!parseTarget(reqDoc.as<JsonObjectConst>(), target)) {
+      json["message"] = "Invalid settings";
+    } else if(!target.fields) {
+      json["message"] = "You didn't specify input, effect or soundlevel";
+    } else {
+      Logln("[handleJSON] Calling setSettings");
+      DynamicJsonDocument settingsDoc(JSON_OBJECT_SIZE(3) + JSON_ARRAY_SIZE(PARAM_COUNT) + JSON_OBJECT_SIZE(7));
+      JsonObject result = settingsDoc.to<JsonObject>();
+      uint8_t unreachable = applyTarget(target, result);
+      if(unreachable) {
+        JsonArray skipped = result.createNestedArray("unreachable");
+        for(uint8_t i = 0; i < PARAM_COUNT; i++) {
+          if(unreachable & (1 << i)) skipped.add(paramNames[i]);
+        }
+      }
+      getSettings(result);
+      serializeJson(settingsDoc, response);
+      Log("[handleJSON] Response: %s\n", response.c_str());
+      return response;
+    }
+  }
+
+  else if(method == "rampSoundLevel") {
+    Logln("[handleJSON] Calling rampSoundLevel");
+    if(state.mode == Off) {
+      json["message"] = "The speakers are off";
+    } else {
+      int8_t soundlevel;
+      if(parseLevel(reqDoc["soundlevel"], soundlevel)) {
+        rampSoundLevel(soundlevel, reqDoc["duration"] | 0);
+        json["steps"] = volumeRamp.total;
+      } else {
+        json["message"] = "Invalid soundlevel";
+      }
+    }
+  } else if(method == "cancelRamp") {
+    Logln("[handleJSON] Calling cancelRamp");
+    cancelRamp();
+    getSettings(json);
+  }
+
+  // Scenes
+  else if(method == "applyScene") {
+    Logln("[handleJSON] Calling applyScene");
+    const char* name = reqDoc["name"] | "";
+    if(applyScene(name)) {
+      getSettings(json);
+    } else {
+      json["message"] = "No such scene";
+    }
+  } else if(method == "saveScene") {
+    Logln("[handleJSON] Calling saveScene");
+    const char* name = reqDoc["name"] | "";
+    JsonObject scene = reqDoc["scene"];
+    Z906Target target;
+    String sceneJson = "";
+    serializeJson(scene, sceneJson);
+    if(scene.isNull() || !parseTarget(scene, target)) {
+      json["message"] = "Invalid scene";
+    } else if(!scenes.save(name, sceneJson)) {
+      json["message"] = "Could not save scene";
+    } else {
+      for(uint8_t i = 0; i < SCENE_CACHE_SIZE; i++) {
+        if(strcmp(sceneCache[i].name, name) == 0) sceneCache[i].version = stateVersion - 1;
+      }
+      json["message"] = "Scene saved";
+    }
+  } else if(method == "deleteScene") {
+    Logln("[handleJSON] Calling deleteScene");
+    const char* name = reqDoc["name"] | "";
+    for(uint8_t i = 0; i < SCENE_CACHE_SIZE; i++) {
+      if(strcmp(sceneCache[i].name, name) == 0) sceneCache[i].name[0] = '\0';
+    }
+    json["message"] = scenes.remove(name) ? "Scene deleted" : "No such scene";
+  } else if(method == "listScenes") {
+    Logln("[handleJSON] Calling listScenes");
+    DynamicJsonDocument listDoc(512);
+    scenes.list(listDoc.createNestedArray("scenes"));
+    serializeJson(listDoc, response);
+    return response;
+  }
+
+  // Other remotes
+  else if(method == "learn") {
+    Logln("[handleJSON] Calling learn");
+    uint32_t key = keyByName(reqDoc["key"] | "");
+    if(key == 0) {
+      json["message"] = "No such key";
+    } else {
+      bindings.learn(key);
+      json["message"] = "Press the key on the other remote";
+      json["timeout"] = LEARN_TIMEOUT;
+    }
+  } else if(method == "unlearn") {
+    Logln("[handleJSON] Calling unlearn");
+    const char* name = reqDoc["key"] | "";
+    uint32_t key = keyByName(name);
+    if(name[0] != '\0' && key == 0) {
+      json["message"] = "No such key";
+    } else {
+      json["removed"] = bindings.unbind(key);
+    }
+  } else if(method == "listBindings") {
+    Logln("[handleJSON] Calling listBindings");
+    DynamicJsonDocument listDoc(JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(bindings.count)
+      + bindings.count * (JSON_OBJECT_SIZE(4) + 32));
+    bindings.list(listDoc.createNestedArray("bindings"));
+    serializeJson(listDoc, response);
+    return response;
+  }
+
+  // Many settings at once, one IR sequence, one save and one publish
+  else if(method == "batch") {
+    Logln("[handleJSON] Calling batch");
+    JsonArrayConst ops = reqDoc["ops"];
+    if(ops.isNull() || ops.size() == 0 || ops.size() > BATCH_SIZE) {
+      json["message"] = "ops must be an array of operations";
+      json["max"] = BATCH_SIZE;
+    } else {
+      DynamicJsonDocument batchDoc(JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(BATCH_SIZE) + JSON_OBJECT_SIZE(7));
+      JsonObject batch = batchDoc.to<JsonObject>();
+      if(!applyBatch(ops, batch)) batch["message"] = "Invalid operation, nothing was sent";
+      serializeJson(batchDoc, response);
+      Log("[handleJSON] Response: %s\n", response.c_str());
+      return response;
+    }
+  }
+
+  // Drift
+  else if(method == "resync") {
+    Logln("[handleJSON] Calling resync");
+    uint8_t fields = RESYNC_SUPPORTED;
+    JsonArrayConst params = reqDoc["params"];
+    if(!params.isNull()) {
+      fields = 0;
+      for(JsonVariantConst param : params) {
+        int8_t i = findString(param | "", paramNames, PARAM_COUNT);
+        if(i >= 0) fields |= 1 << i;
+      }
+    }
+    if(state.mode == Off) {
+      json["message"] = "The speakers are off";
+    } else if(resyncing) {
+      json["message"] = "Already resyncing";
+    } else {
+      fields = resync(fields);
+      DynamicJsonDocument resyncDoc(JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(PARAM_COUNT));
+      JsonArray done = resyncDoc.createNestedArray("resync");
+      for(uint8_t i = 0; i < PARAM_COUNT; i++) {
+        if(fields & (1 << i)) done.add(paramNames[i]);
+      }
+      serializeJson(resyncDoc, response);
+      return response;
+    }
+  } else if(method == "getConfidence") {
+    Logln("[handleJSON] Calling getConfidence");
+    DynamicJsonDocument confidenceDoc(JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(PARAM_COUNT));
+    JsonObject values = confidenceDoc.createNestedObject("confidence");
+    for(uint8_t i = 0; i < PARAM_COUNT; i++) values[paramNames[i]] = confidence[i];
+    confidenceDoc["lastResyncMs"] = lastResyncMs;
+    serializeJson(confidenceDoc, response);
+    return response;
+  }
+
+  // reset
+  else if(method == "reset") {
+    if(onReset) onReset();
+    resetSettings();
+    json["message"] = "Settings resetted";
+    getSettings(json);
+  }
+
+  // just else 
+  else {
+    String error = "Method: \"" + String(method) + "\" does not exist";
+    Logln(error.c_str());
+    postEvent(debugTopic.c_str(), error);
+  }
+
+  serializeJson(resDoc, response);
+  Log("[handleJSON] Response: %s\n", response.c_str());
+  return response;
+}
+
+/** Like getStringIndex, but -1 when s isn't in array */
+static int8_t findString(const char* s, const char* const array[], uint8_t len) {
+  for(uint8_t i = 0; i < len; i++) {
+    if(strcmp(s, array[i]) == 0) return i;
+  }
+  return -1;
+}
+
+/** A level has to be an integer the amp can show, 0 to LEVEL_MAX */
+static bool parseLevel(JsonVariantConst level, int8_t& value) {
+  if(!level.is<int>() || level.as<int>() < 0 || level.as<int>() > LEVEL_MAX) return false;
+  value = level.as<int>();
+  return true;
+}
+
+static const char* const levelKeys[] = { "soundlevel", "basslevel", "rearlevel", "centerlevel" };
+
+/** json has nothing but the keys parseTarget() reads */
+static bool onlyTargetKeys(JsonObjectConst json) {
+  static const char* const keys[] = { "input", "effect", "mode", "mute" };
+  for(auto pair : json) {
+    const char* key = pair.key().c_str();
+    if(findString(key, keys, 4) < 0 && findString(key, levelKeys, 4) < 0) return false;
+  }
+  return true;
+}
+
+bool parseTarget(JsonObjectConst json, Z906Target& target) {
+  memset(&target, 0, sizeof(target));
+
+  const char* input = json["input"];
+  if(input) {
+    int8_t i = findString(input, inputs, INPUT_COUNT);
+    if(i < 0) return false;
+    target.state.input = (Input)i;
+    target.fields |= TARGET_INPUT;
+  }
+
+  const char* effect = json["effect"];
+  if(effect) {
+    int8_t i = findString(effect, effects, EFFECT_COUNT);
+    if(i < 0) return false;
+    target.effect = (Effect)i;
+    target.fields |= TARGET_EFFECT;
+  }
+
+  const char* mode = json["mode"];
+  if(mode) {
+    int8_t i = findString(mode, modes, MODE_COUNT);
+    if(i < 0) return false;
+    target.state.mode = (Mode)i;
+    target.fields |= TARGET_MODE;
+  }
+
+  if(json.containsKey("mute")) {
+    target.state.mute = json["mute"];
+    target.fields |= TARGET_MUTE;
+  }
+
+  for(uint8_t i = 0; i < 4; i++) {
+    JsonVariantConst level = json[levelKeys[i]];
+    if(level.isNull()) continue;
+    if(!parseLevel(level, target.state.soundLevel[i])) return false;
+    target.fields |= TARGET_LEVEL(i);
+  }
+  return true;
+}
+
+uint8_t getStringIndex(String s, const char* const array[], uint8_t len) {
+  Log("[getStringIndex] Length of array: %d\n", len);
+  for(uint8_t i = 0; i < len; i++) {
+    if(s == array[i]) return i;
+  }
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include "Z906Journal.h"
+
+#include <stddef.h>
+#include <coredecls.h>
+
+#include "DebugHelpers.hpp"
+
+#define JOURNAL_MAGIC   0x5A394A00 // "Z9J", the slot goes in the low byte
+#ifndef JOURNAL_RTC_MEM
+  #define JOURNAL_RTC_MEM ((volatile uint32_t*)0x60001200) // RTC user memory, as rtcUserMemoryRead() sees it
+#endif
+
+void Z906Journal::begin(IRTransmitter& irtx) {
+  if(slot >= JOURNAL_SLOTS) {
+    Err("[Journal] Slot %d is past the RTC user memory, not journaling\n", slot);
+    return;
+  }
+  ESP.rtcUserMemoryRead(offset(), (uint32_t*)&rtc, sizeof(rtc));
+  if(rtc.magic != (JOURNAL_MAGIC | slot) || rtc.crc != checksum() || rtc.length > JOURNAL_SIZE) {
+    // Power on, or something else scribbled over it
+    memset(&rtc, 0, sizeof(rtc));
+    rtc.magic = JOURNAL_MAGIC | slot;
+    ESP.rtcUserMemoryWrite(offset(), (uint32_t*)&rtc, sizeof(rtc));
+    write();
+  }
+  irtx.frameCounter = JOURNAL_RTC_MEM + offset() + offsetof(Record, emitted) / 4;
+}
+
+/** Applies the first frames of entry to state. Each frame of a key the amp
+ *  doesn't repeat is a press of its own (see Z906Controller::runSequence) */
+static void applyEntry(Z906State& state, uint32_t code, uint8_t frames) {
+  while(frames--) applySent(state, code);
+}
+
+bool Z906Journal::replay(Z906State& state) {
+  if(!open()) return false;
+  uint32_t emitted;
+  ESP.rtcUserMemoryRead(offset() + offsetof(Record, emitted) / 4, &emitted, sizeof(emitted));
+
+  uint32_t budget = emitted;
+  uint16_t total = 0;
+  state = rtc.base;
+  for(uint8_t i = 0; i < rtc.length; i++) {
+    const Entry& entry = rtc.entries[i];
+    if(entry.key >= NEC_WAVEFORM_COUNT) break;
+    uint32_t code = necWaveforms[entry.key].code;
+    total += entry.frames;
+    uint8_t frames = budget < entry.frames ? budget : entry.frames;
+    budget -= frames;
+    applyEntry(state, code, frames);
+  }
+  Log("[Journal] Slot %d: replayed %u of %u frames\n", slot, emitted > total ? total : emitted, total);
+  return true;
+}
+
+void Z906Journal::record(const Z906State& state, uint32_t code, uint16_t frames, bool idle) {
+  const NecWaveform* waveform = findNecWaveform(code);
+  if(!waveform) return; // The transmitter refuses it, nothing to count
+  uint8_t key = waveform - necWaveforms;
+  if(slot >= JOURNAL_SLOTS) return;
+  if(idle) start(state);
+  if(rtc.length == JOURNAL_SIZE) compact();
+
+  while(frames > 0 && rtc.length < JOURNAL_SIZE) {
+    Entry& entry = rtc.entries[rtc.length++];
+    entry.key = key;
+    entry.frames = frames > 255 ? 255 : frames;
+    frames -= entry.frames;
+  }
+  write();
+}
+
+void Z906Journal::commit() {
+  if(!open()) return;
+  rtc.length = 0;
+  write();
+}
+
+void Z906Journal::start(const Z906State& state) {
+  uint32_t emitted = 0;
+  ESP.rtcUserMemoryWrite(offset() + offsetof(Record, emitted) / 4, &emitted, sizeof(emitted));
+  rtc.base = state;
+  rtc.length = 0;
+}
+
+/** Moves the entries the interrupt has sent in full into the base. Runs
+ *  with interrupts off, emitted must not move while base catches up */
+void Z906Journal::compact() {
+  volatile uint32_t* emitted = JOURNAL_RTC_MEM + offset() + offsetof(Record, emitted) / 4;
+  noInterrupts();
+  uint32_t budget = *emitted;
+  uint8_t done = 0;
+  while(done < rtc.length && rtc.entries[done].frames <= budget) {
+    const Entry& entry = rtc.entries[done++];
+    if(entry.key < NEC_WAVEFORM_COUNT) applyEntry(rtc.base, necWaveforms[entry.key].code, entry.frames);
+    budget -= entry.frames;
+  }
+  *emitted = budget;
+  rtc.length -= done;
+  memmove(rtc.entries, rtc.entries + done, rtc.length * sizeof(Entry));
+  write();
+  interrupts();
+  if(done == 0) Err("[Journal] Slot %d is full, dropping frames\n", slot);
+}
+
+uint32_t Z906Journal::checksum() const {
+  const uint8_t* from = (const uint8_t*)&rtc.base;
+  return crc32(from, (const uint8_t*)&rtc.crc - from);
+}
+
+void Z906Journal::write() {
+  rtc.crc = checksum();
+  size_t start = offsetof(Record, base);
+  ESP.rtcUserMemoryWrite(offset() + start / 4, (uint32_t*)((uint8_t*)&rtc + start), sizeof(rtc) - start);
+}
@@ -33,6 +33,16 @@
 #include <TaskScheduler.h>
 
 #include "DebugHelpers.hpp"
+#include "NecDecoder.hpp"
+#include "Z906Controller.h"
+#include "TimeSync.h"
+#include "SceneStore.h"
+#include "CommandRouter.h"
+#include "TraceBuffer.h"
+#include "IRBindings.h"
+#include "RuntimeStats.h"
+#include "ActivityProfile.h"
+#include "ETag.hpp"
 #include "Secret.h"
 
 #define ARRAY_SIZE(A) (sizeof(A) / sizeof((A)[0]))
@@ -44,8 +54,8 @@
 #define ON_LED                D0    // The pin that is connected to the on-led on speaker system
 #define IR_LED                D2    // The IR LED pin
 #define RECV_IR               D1    // The ir reciever pin
-#define MS_BETWEEN_SENDING_IR 20    // Amount of ms to leap between sending commands in a row
-#include "LogitechIRCodes.h"
+#define RECV_IR_UNIT          0     // The controller the remote codes from RECV_IR belong to
+#define IR_RECV_NEC_DECODER         // Decode the remote with NecDecoder when IRrecv isn't needed (comment out to always use IRrecv)
 
 bool OTA_ON = true; // Turn on OTA
 
@@ -55,10 +65,13 @@ bool OTA_ON = true; // Turn on OTA
 #define MQTTCategory        "speaker"
 
 #define ClientRoot          MQTTCategory "/" MQTTClientId
+#define UNIT_GROUP          "all"   // Group the controllers on this board take group commands for
+#define GroupTopic          MQTTCategory "/group/" UNIT_GROUP "/cmnd/json"
+// A "group" in the payload narrows a group command down to the controllers
+// whose group it is, set in setupControllers(), e.g. controllers[1].group = "downstairs"
 
-// Some examples on how the routes should be
-#define CommandTopic        ClientRoot "/cmnd/json"
-#define StateTopic          ClientRoot "/state/json"
+// Some examples on how the routes should be (each controller has its own
+// cmnd/json, state/json and debug topics, see Z906Controller)
 #define DebugTopic          ClientRoot "/debug"
 #define WillTopic           ClientRoot "/will"
 #define WillQoS             0
@@ -66,56 +79,42 @@ bool OTA_ON = true; // Turn on OTA
 const char* willMessage = MQTTClientId " has disconnected...";
 
 #define FirstMessage        "I communicate via JSON!"
-#define MQTT_MAX_PACKET_SIZE 192 //Remember to set this in platformio.ini
+#define MQTT_MAX_PACKET_SIZE 512 //Remember to set this in platformio.ini
 
 WiFiClient wificlient;  // is needed for the mqtt client
 PubSubClient mqttclient;
 
 ESP8266WebServer server(80);
+#define STATE_DOC_SIZE      (JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(7))
+String bootTag;             // Part of every ETag, new on every boot
 
-#define CAPTURE_BUFFER_SIZE 64
+bool irReceiveSuspended = false;
+bool irrecvActive = false;  // IRrecv has the receiver pin, else the NecDecoder
+
+NecDecoder necDecoder;
+volatile uint32_t lastIREdge = 0;
+
+#define CAPTURE_BUFFER_SIZE 128   // Room for the common TV remote protocols (NEC needs 68)
 #define MIN_UNKNOWN_SIZE    12
 IRrecv irrecv(RECV_IR, CAPTURE_BUFFER_SIZE);
-IRsend irsend(IR_LED);
 decode_results results;  // Somewhere to store the results
 
-/********************************* Variables **********************************/
-
-int8_t soundLevel[4]; // [Volume, Bass, Rear, Center]
-
-bool mute;
-bool isOn = false;
-
-enum Input : byte { AUX, Input1, Input2, Input3, Input4, Input5 };
-const char* inputs[] { "AUX", "Input 1", "Input 2", "Input 3", "Input 4", "Input 5" };
-Input currentInput;
-
-enum Effect : byte { Surround, Music, Stereo };
-const char* effects[] { "Surround", "Music", "Stereo" };
-Effect currentEffectOnInput[5];
-
-// In mode On we'll change the soundlevel (defult)
-enum Mode : byte { Off, On, BassLevel, RearLevel, CenterLevel};
-const char* modes[] = { "Off", "On", "Bass level", "Rear level", "Center level" };
-Mode currentMode = Off;
-Mode lastMode = On;
-
-#define LEVEL_TIMEOUT 5000
-unsigned long levelTimeout;
-
-/* EEPROM Addresses */
-#define SOUND_LEVEL_ADDR        1
-#define BASS_LEVEL_ADDR         2
-#define REAR_LEVEL_ADDR         3
-#define CENTER_LEVEL_ADDR       4
-#define CURRENT_INPUT_ADDR      5
-#define EFFECT_ON_AUX           6
-#define EFFECT_ON_INPUT1        7
-#define EFFECT_ON_INPUT2        8
-#define EFFECT_ON_INPUT3        9
-#define EFFECT_ON_INPUT4        10
-#define EFFECT_ON_INPUT5        11
-#define MUTE_ADDR               12
+/******************************** Controllers *********************************/
+// One controller per Z906, each with its own IR LED, on-led pin and EEPROM slot.
+// The first one keeps the topics directly under ClientRoot.
+Z906Controller controllers[] = {
+  Z906Controller("", IR_LED, ON_LED, 0),
+  // Z906Controller("kitchen", D5, D6, 1),
+};
+#define CONTROLLER_COUNT ARRAY_SIZE(controllers)
+static_assert(CONTROLLER_COUNT <= IR_TX_MAX_CHANNELS, "Every controller needs its own IR transmitter channel");
+
+/********************************** Queues ************************************/
+// The network context (web server, MQTT, OTA, time sync) and the IR context
+// (IR receive and transmit, the controllers) only talk through the router's
+// queues, so a slow broker doesn't hold up the IR and an IR burst doesn't
+// hold up the network
+#define EVENTS_PER_PASS     4     // Events published per pass of the network context
 
 /*********************************** Tasks ************************************/
 // Declare task methods
@@ -125,268 +124,88 @@ void checkMQTTStatusCallback();
 void blinkStatusLedCallback();
 void blinkStatusLedDisabledCallback();
 void sendStatesMQTT();
+void reportStatsCallback();
+String getChipStatsJSON();
+String getStatsJSON();
+void wake(const char* reason);
+void publishEvent(const Event& event);
 
 Scheduler taskManager;
 Task tCheckIfStillOn(TASK_SECOND, TASK_FOREVER, &checkIfStillOn, &taskManager);
-Task tCheckMQTTStatus(TASK_MINUTE, TASK_FOREVER, &checkMQTTStatusCallback, &taskManager);
+Task tCheckMQTTStatus(10 * TASK_SECOND, TASK_FOREVER, &checkMQTTStatusCallback, &taskManager);
 Task tWifiStatus(TASK_SECOND, TASK_FOREVER, &checkWifiStatusCallback, &taskManager);
 Task tBlink(200, 3, &blinkStatusLedCallback, &taskManager, false, NULL, &blinkStatusLedDisabledCallback);
 Task tSendStatesMQTT(TASK_MINUTE, TASK_FOREVER, &sendStatesMQTT, &taskManager);
-
-/** Returns the soundlevel that the receiver is currently on */
-uint8_t currentLevel() {
-  return currentMode - 1;
-}
-
-/** 
- * Returns the current effect for the current input
- * (Each input has it's on effect independent of the other inputs)
- */
-Effect currentEffect() {
-  return currentEffectOnInput[currentInput];
-}
-
-void setCurrentEffect(Effect effect) {
-  currentEffectOnInput[currentInput] = effect;
+Task tReportStats(15 * TASK_MINUTE, TASK_FOREVER, &reportStatsCallback, &taskManager);
+
+// Task intervals and Wi-Fi sleep for each ActivityProfile. Idle uses modem
+// sleep, not light sleep: the IR receiver interrupt and the transmitter's
+// timer need the CPU running
+#define ACTIVE_ON_LED_INTERVAL  250
+#define ACTIVE_WIFI_INTERVAL    TASK_SECOND
+#define ACTIVE_STATES_INTERVAL  TASK_MINUTE
+#define IDLE_ON_LED_INTERVAL    (2 * TASK_SECOND)
+#define IDLE_WIFI_INTERVAL      (10 * TASK_SECOND)
+#define IDLE_STATES_INTERVAL    (10 * TASK_MINUTE)
+#define IDLE_LOOP_DELAY         10    // ms loop() sleeps per pass when idle, the IR is buffered by interrupts
+
+/** Pin change interrupt, hands the length of the ended mark/space to the decoder.
+ *  The receiver output is active low, so a rising edge ends a mark */
+ICACHE_RAM_ATTR void onIREdge() {
+  uint32_t now = micros();
+  necDecoder.feed(now - lastIREdge, digitalRead(RECV_IR) == HIGH);
+  lastIREdge = now;
+}
+
+/** IRrecv decodes every protocol, the NecDecoder is lighter and does for the
+ *  Z906 remote. IRrecv takes over while learning or when a bound code needs it */
+bool wantIRrecv() {
+  #ifdef IR_RECV_NEC_DECODER
+    return bindings.learning() || bindings.needsIRrecv();
+  #else
+    return true;
+  #endif
 }
 
-void loadSettings() {
-  for(int8_t i = 0; i < 4; i++) {
-    soundLevel[i] = EEPROM.read(SOUND_LEVEL_ADDR + i);
-    if(soundLevel[i] > 128 || soundLevel[i] < 0) {
-      soundLevel[i] = 0;
-    }
-  }
-
-  currentInput = (Input)EEPROM.read(CURRENT_INPUT_ADDR);
-  currentInput = currentInput < 6 ? currentInput : AUX;
-
-  for(uint8_t i= 0; i < 6; i++) {
-    currentEffectOnInput[i] = (Effect)EEPROM.read(EFFECT_ON_AUX + i);
-    currentEffectOnInput[i] = currentEffectOnInput[i] < 3 ? currentEffectOnInput[i] : Surround;
+void enableIRIn() {
+  if(irrecvActive) {
+    irrecv.enableIRIn();
+    irrecv.resume();
+  } else {
+    lastIREdge = micros();
+    attachInterrupt(digitalPinToInterrupt(RECV_IR), onIREdge, CHANGE);
   }
-
-  mute = (bool)EEPROM.read(MUTE_ADDR);
 }
 
-void saveSettings() {
-  for(uint8_t i = 0; i < 4; i++) {
-    EEPROM.write(SOUND_LEVEL_ADDR + i, soundLevel[i]);
-  }
-  EEPROM.write(CURRENT_INPUT_ADDR, currentInput);
-  for(uint8_t i = 0; i < 6; i++) {
-    EEPROM.write(EFFECT_ON_AUX + i, currentEffectOnInput[i]);
-  }
-  EEPROM.write(MUTE_ADDR, mute);
-  if(EEPROM.commit())
-    Logln("Successfully saved to EEPROM");
+void disableIRIn() {
+  if(irrecvActive)
+    irrecv.disableIRIn();
   else
-    Logln("Failed to save to EEPROM");
-}
-
-void getSettings(JsonObject json) {
-  JsonObject settings = json.createNestedObject("settings");
-  settings["mode"] = modes[currentMode];
-  if(mute)
-    settings["soundlevel"] = "mute";
-  else {
-    settings["soundlevel"] = soundLevel[0];
-    settings["basslevel"] = soundLevel[1];
-    settings["rearlevel"] = soundLevel[2];
-    settings["centerlevel"] = soundLevel[3];
-  }
-  settings["input"] = inputs[currentInput];
-  settings["effect"] = effects[currentEffect()];
-}
-
-void sendIR(uint64_t data, uint16_t repeat) {
-  irrecv.disableIRIn();
-  irsend.sendNEC(data, 32, repeat);
-  irrecv.enableIRIn();
-  irrecv.resume();
-}
-
-void sendIR(uint64_t data) {
-  irrecv.disableIRIn();
-  irsend.sendNEC(data, 32);
-  irrecv.enableIRIn();
-  irrecv.resume();
-}
-
-void turnOn() {
-  if(currentMode == Off) {
-    sendIR(POWER_IR);
-    currentMode = On;
-    saveSettings();
-  }
-  checkIfStillOn();
-}
-
-void turnOff() {
-  if(currentMode != Off) {
-    sendIR(POWER_IR);
-    currentMode = Off;
-    saveSettings();
-  }
-  checkIfStillOn();
-}
-
-void togglePower() {
-  sendIR(POWER_IR);
-  currentMode = currentMode == On ? Off : On;
-  saveSettings();
-}
-
-/** Sets the current input to the next input, but does not save or send 
- *  anything */
-void setNextInput() {
-  currentInput = currentInput >= 5 ? (Input)0 : (Input)(currentInput + 1);
-}
-
-/** Sets the current input to the next input, but does not save or send anything
- *  anything */
-void setNextEffect() {
-  Effect effect = currentEffect() >= 2 ? (Effect)0 : (Effect)(currentEffect() + 1);
-  setCurrentEffect(effect);
-}
-
-void toggleInput() {
-  sendIR(INPUT_IR);
-  setNextInput();
-  saveSettings();
-}
-
-void toggleMute() {
-  sendIR(MUTE_IR);
-  mute = !mute;
-  saveSettings();
-}
-
-/** Sends ir code and saves settings to change to wanted input */
-void changeInput(Input input) {
-  Log("[changeInput] Changing input to: %s\n", inputs[input]);
-  switch(input) {
-    case AUX:
-      sendIR(AUX_IR);
-      break;
-    case Input1:
-      sendIR(INPUT1_IR);
-      break;
-    case Input2:
-      sendIR(INPUT2_IR);
-      break;
-    case Input3:
-      sendIR(INPUT3_IR);
-      break;
-    case Input4:
-      sendIR(INPUT4_IR);
-      break;
-    case Input5:
-      sendIR(INPUT5_IR);
-      break;
-    default:
-      Logln("\tNo such input!");
-  }
-  Logln("");
-  currentInput = input;
-  saveSettings();
-}
-
-/** Sends ir code and saves settings to change to wanted effect */
-void changeEffect(Effect effect) {
-  Log("[changeEffect] Changing effect from: %s to: %s\n", effects[currentEffect()], effects[effect]);
-  int8_t diff = effect - currentEffectOnInput[currentInput];
-  int8_t ir_send_times = (diff >= 0) ? diff : (abs(diff) + 1) % 3;
-  Log("[changeEffect] Diff: %d\t\tBlasting ir %d times\n", diff, ir_send_times);
-
-  for(uint8_t i = 0; i < ir_send_times; i++) {
-    sendIR(EFFECT_IR);
-    delay(MS_BETWEEN_SENDING_IR);
-  }
-
-  currentEffectOnInput[currentInput] = effect;
-  saveSettings();
+    detachInterrupt(digitalPinToInterrupt(RECV_IR));
 }
 
-/** Sends ir code and saves settings to change to wanted sound level */
-void changeSoundLevel(int8_t level) {
-  if(level < 0)
-    level = 0;
-  int8_t diff = level - soundLevel[currentLevel()];
-  Log("[changeSoundLevel] Setting sound level %d -> %d\tDiff: %d\n", soundLevel[currentLevel()], level, diff);
-  if(diff > 1) {
-    sendIR(PLUS_IR, diff);
-  } else if(diff < 0) {
-    sendIR(MINUS_IR, -diff);
+/** Keeps the receiver from picking up our own frames, called by the transmitters */
+void suspendIRIn() {
+  if(!irReceiveSuspended) {
+    disableIRIn();
+    irReceiveSuspended = true;
   }
-  soundLevel[currentLevel()] = level;
-  saveSettings();
 }
 
-/** Sends ir code and saves settings to change to wanted mode (Level) */
-void changeMode(Mode mode) {
-  Log("[changeMode] Changing mode from: %s to: %s\n", modes[currentMode], modes[mode]);
-  int8_t diff = (mode - 1) - (currentMode - 1);
-  int8_t ir_send_times = (diff >= 0) ? diff : (abs(diff) + 1) % 4;
-  Log("[changeMode] Diff: %d\t\tBlasting ir %d times\n", diff, ir_send_times);
-
-  for(uint8_t i = 0; i < ir_send_times; i++) {
-    sendIR(LEVEL_IR);
-    delay(MS_BETWEEN_SENDING_IR);
+/** Turns the receiver back on once everything queued is off the air. The
+ *  padding after the last frame is silent, a held bound key's next repeat
+ *  is heard in it and its echo follows without a gap */
+void serviceIR() {
+  if(irReceiveSuspended && !IRTransmitter::anyOnAir()) {
+    enableIRIn();
+    irReceiveSuspended = false;
   }
-
-  currentMode = mode;
-  saveSettings();
-}
-
-/** Checks if speaker system is still on */
-void checkIfStillOn() {
-  bool lastBool = isOn;
-  isOn = digitalRead(ON_LED);
-  if(isOn) {
-    currentMode = currentMode == Off ? On : currentMode;
-  } else {
-    currentMode = Off;
+  if(!irReceiveSuspended && irrecvActive != wantIRrecv()) {
+    disableIRIn();
+    irrecvActive = !irrecvActive;
+    enableIRIn();
+    Log("[IR] Receiving with %s\n", irrecvActive ? "IRrecv" : "NecDecoder");
   }
-
-  if(lastBool != isOn) {
-    sendStatesMQTT();
-  }
-  Debugf("[checkIfStillON] %s\n", isOn ? "On" : "Off");
-}
-
-/** Returns the strings index in const char[] array*/ 
-uint8_t getStringIndex(String s, const char* array[], uint8_t len) {
-  Log("[getStringIndex] Length of array: %d\n", len);
-  for(uint8_t i = 0; i < len; i++) {
-    if(s == array[i]) return i;
-  }
-  return NULL;
-}
-
-void nextLevelOnCurrentEffect() {
-  int limit = 4;
-  switch(currentEffect()) {
-    case Surround:
-      limit = 4;
-      break;
-    case Music:
-      limit = 3;
-      break;
-    case Stereo:
-      limit = 2;
-      break;
-  }
-  currentMode = currentMode >= limit ? (Mode)1 : (Mode)(currentMode + 1);
-}
-
-void printSettings() {
-  Serial.printf("\nInput: %s\n", inputs[currentInput]);
-  Serial.printf("Soundlevel: %d\t", soundLevel[0]);
-  Serial.printf("Bass: %d\t", soundLevel[1]);
-  Serial.printf("Rear: %d\n", soundLevel[2]);
-  Serial.printf("Center: %d\n", soundLevel[3]);
-  Serial.printf("Effect: %s\n\n", effects[currentEffect()]);
 }
 
 void blinkStatusLed(int8_t times, unsigned long interval, TaskOnEnable onEnable, TaskOnDisable onDisable) {
@@ -500,17 +319,33 @@ void setupWifiManager() {
 
 void setupIR() {
   Logln("[IRSend] Begin");
-  irsend.begin();
+  IRTransmitter::onSend = &suspendIRIn;
+  pinMode(RECV_IR, INPUT);
   irrecv.setUnknownThreshold(MIN_UNKNOWN_SIZE);
-  irrecv.enableIRIn();
+  irrecvActive = wantIRrecv();
+  enableIRIn();
 }
 
 void setupEEPROM() {
   EEPROM.begin(512);
-  mute = false; // Reset mute in memory
-  EEPROM.write(MUTE_ADDR, mute);
+  for(uint8_t i = 0; i < CONTROLLER_COUNT; i++) {
+    EEPROM.write(i * EEPROM_SLOT_SIZE + MUTE_ADDR, false); // Reset mute in memory
+  }
   EEPROM.commit();
-  loadSettings();
+}
+
+void setupControllers() {
+  router.begin(controllers, CONTROLLER_COUNT);
+  router.onWake = wake;
+  // The contexts take turns in loop(), a POST lets the IR context have its
+  // turns while it waits for its answer
+  router.onWait = []() { return router.runNext(); };
+  router.onEvent = publishEvent;
+  Z906Controller::onReset = []() { blinkStatusLed(2, 300); };
+  for(uint8_t i = 0; i < CONTROLLER_COUNT; i++) {
+    controllers[i].begin(ClientRoot);
+    controllers[i].printSettings();
+  }
 }
 
 bool publishMQTT(const char* topic, const char* payload){
@@ -528,17 +363,23 @@ bool publishMQTT(const char* topic, const char* payload){
   return returnBool;
 }
 
-/** Connects to the MQTT broker and subscribes to the topic */
+/** Connects to the MQTT broker and subscribes to the topic. Tries once,
+ *  tCheckMQTTStatus tries again, so a broker that's down doesn't hold up the IR */
 bool connectMQTT() {
-  while (!mqttclient.connected()) {
+  if (!mqttclient.connected()) {
     Log("[MQTT] Connecting to MQTT server... ");
 
     //if connected, subscribe to the topic(s) we want to be notified about
     if (mqttclient.connect(MQTTClientId, MQTTUsername, MQTTPassword, WillTopic,\
         WillQoS, WillRetain, willMessage)) {
       Logln("MTQQ Connected!");
-      if (mqttclient.subscribe(CommandTopic))
-        Log("[MQTT] Sucessfully subscribed to %s\n", CommandTopic);
+      for(uint8_t i = 0; i < CONTROLLER_COUNT; i++) {
+        const char* topic = controllers[i].commandTopic.c_str();
+        if (mqttclient.subscribe(topic))
+          Log("[MQTT] Sucessfully subscribed to %s\n", topic);
+      }
+      if (mqttclient.subscribe(GroupTopic))
+        Log("[MQTT] Sucessfully subscribed to %s\n", GroupTopic);
       publishMQTT(DebugTopic, FirstMessage);
       return true;
     }
@@ -551,16 +392,51 @@ bool publishMQTT(const char* topic, String payload){
   return publishMQTT(topic, payload.c_str());
 }
 
+/** Publishes an event from the IR context. An empty one answered a POST
+ *  that didn't wait for it */
+void publishEvent(const Event& event) {
+  if(event.payload.length() > 0) publishMQTT(event.topic.c_str(), event.payload);
+}
+
+/** Publishes what the IR context queued, a few per call */
+void flushEvents() {
+  static uint32_t reportedDrops = 0;
+  Event event;
+  for(uint8_t i = 0; i < EVENTS_PER_PASS && router.popEvent(event); i++) {
+    publishEvent(event);
+  }
+  uint32_t drops = router.events.dropped.load();
+  if(drops != reportedDrops && mqttclient.connected()) {
+    reportedDrops = drops;
+    publishMQTT(DebugTopic, "{\"droppedEvents\":" + String(drops) + "}");
+  }
+}
+
+/** Sets the task intervals and Wi-Fi sleep mode for activity.profile */
+void applyProfile() {
+  bool idle = activity.profile == ActivityProfile::Idle;
+  tCheckIfStillOn.setInterval(idle ? IDLE_ON_LED_INTERVAL : ACTIVE_ON_LED_INTERVAL);
+  tWifiStatus.setInterval(idle ? IDLE_WIFI_INTERVAL : ACTIVE_WIFI_INTERVAL);
+  tSendStatesMQTT.setInterval(idle ? IDLE_STATES_INTERVAL : ACTIVE_STATES_INTERVAL);
+  WiFi.setSleepMode(idle ? WIFI_MODEM_SLEEP : WIFI_NONE_SLEEP);
+}
+
+/** Switches to the active profile, if we weren't already */
+void wake(const char* reason) {
+  if(activity.wake(reason)) applyProfile();
+}
+
 void checkMQTTStatusCallback() {
   Log("Checking MQTT connection..");
   if(!mqttclient.connected()) {
     Log("[checkMQTTStatusCallback] Reconnecting to MQTT server...\n");
+    stats.mqttReconnects++;
     connectMQTT();
   }
 }
 
 String payloadToString(byte* payload, int length) {
-  char message_buff[length];
+  char message_buff[length + 1];
   int i = 0;
   for (i = 0; i < length; i++) {
       message_buff[i] = payload[i];
@@ -569,146 +445,150 @@ String payloadToString(byte* payload, int length) {
   return String(message_buff);
 }
 
-/** For handling requests, both the MQTT and REST requests are parsed here
- * Returns: response string (with settings formatted as json)
- */  
-String handleJSONReq(String req) {
-  StaticJsonDocument<256> reqDoc;
-  auto error = deserializeJson(reqDoc, req);
-
-  if (error) {
-    Err("deserializeJson() failed with code ");
-    Err(error.c_str());
-    return "";
-  }
-
-  Serial.print("[handleJSON] Payload: ");
-  serializeJson(reqDoc, Serial);
-  Serial.println("");
-
-  const size_t bufferSize = JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(7);
-  DynamicJsonDocument resDoc(bufferSize);
-  JsonObject json = resDoc.to<JsonObject>();
-
-  String response = "";
-  String method = reqDoc["method"];
-
-  if(method == "turnOn") {
-    Logln("[handleJSON] Calling turnOn");
-    turnOn();
-  } else if(method == "turnOff") {
-    Logln("[handleJSON] Calling turnOff");
-    turnOff();
-  }
-
-  // Getters 
-  else if(method == "getSettings") {
-    Logln("[handleJSON] Calling getSettings");
-    getSettings(json);
-  } else if(method == "getMode") {
-    Logln("[handleJSON] Calling getMode");
-    Logln(modes[currentMode]);
-    json["mode"] = modes[currentMode];
-  } else if(method == "getSoundLevel") {
-    Logln("[handleJSON] Calling getSoundLevel");
-    json["soundlevel"] = soundLevel;
-  } else if(method == "getInput") {
-    Logln("[handleJSON] Calling getInput");
-    json["input"] = inputs[currentInput];
-  } else if(method == "getEffect") {
-    Logln("[handleJSON] Calling getEffect");
-    json["effect"] = effects[currentEffect()];
-  }
-
-  // Setters
-  else if(method == "setSettings") {
-    if(currentMode != On) {
-       /* Turn on the speakers if they're not yet on 
-      (THIS COULD CAUSE PROBLEMS IF YOU'RE STUPID AS ME AND FORGETS ABOUT THIS)*/
-      turnOn();
-      // If the speakers was Off or in Level mode we have to wait until
-      // it's for sure is in On mode
-      delay(3500); // change dis later to a more appropriate value
-    }
-
-    bool somethingChanged = false;
-
-    const char* input = reqDoc["input"];
-    if(input) {
-      Logln("[setSettings] Input setting detected");
-      changeInput((Input)getStringIndex(input, inputs, ARRAY_SIZE(inputs)));
-      somethingChanged = true;
-    }
-
-    const char* effect = reqDoc["effect"];
-    if(effect) {
-      Logln("[setSettings] Effect setting detected");
-      changeEffect((Effect)getStringIndex(effect, effects, ARRAY_SIZE(effects)));
-      somethingChanged = true;
-    }
-
-    const char* modeStr = reqDoc["mode"];
-    if(modeStr) {
-      Logln("[setSettings] Mode setting detected");
-      changeMode((Mode)getStringIndex(modeStr, modes, ARRAY_SIZE(modes)));
-      somethingChanged = true;
-    }
-
-    int soundlevel = reqDoc["soundlevel"];
-    if(soundlevel) {
-      Logln("[setSettings] Soundlevel setting detected");
-      changeSoundLevel(soundlevel);
-      somethingChanged = true;
-    }
-
-    if(somethingChanged) {
-      getSettings(json);
-    } else {
-      json["message"] = "You didn't specify input, effect or soundlevel";
-    }
-  }
-
-  // reset
-  else if(method = "reset") {
-    blinkStatusLed(2, 300);
-    soundLevel[0] = 10;
-    soundLevel[1] = 25;
-    soundLevel[2] = 25;
-    soundLevel[3] = 25;
-    currentInput = Input1;
-    for(uint8_t i= 0; i < 5; i++) {
-      currentEffectOnInput[i] = Surround;
-    }
-    saveSettings();
-    json["message"] = "Settings resetted";
-    getSettings(json);
-  }
-
-  // just else 
-  else {
-    String error = "Method: \"" + String(method) + "\" does not exist";
-    Logln(error.c_str());
-    publishMQTT(DebugTopic, error);
-  }
-
-  serializeJson(resDoc, response);
-  Log("[handleJSON] Response: %s\n", response.c_str());
-  return response;
+/** GET of a controller resource, tagged with the controller's state version */
+void serveState(Z906Controller* controller, void (*fill)(Z906Controller*, JsonObject)) {
+  if(notModified(server, makeETag(bootTag, String(controller->stateVersion)))) return;
+  StaticJsonDocument<STATE_DOC_SIZE> doc;
+  fill(controller, doc.to<JsonObject>());
+  String payload = "";
+  serializeJson(doc, payload);
+  server.send(200, "application/json", payload);
+}
+
+/** Where a GET /history response is at */
+struct HistoryPage {
+  long limit;
+  long sent;
+  uint32_t next;
+};
+
+/** Sends one history record as JSON, false once the page is full */
+bool sendHistoryEntry(const StateHistory::Entry& entry, void* context) {
+  HistoryPage* page = (HistoryPage*)context;
+  char value[16];
+  switch(entry.field) {
+    case 0: strncpy(value, entry.value < INPUT_COUNT ? inputs[entry.value] : "?", sizeof(value)); break;
+    case 1: strncpy(value, entry.value < EFFECT_COUNT ? effects[entry.value] : "?", sizeof(value)); break;
+    case 2: strncpy(value, entry.value < MODE_COUNT ? modes[entry.value] : "?", sizeof(value)); break;
+    case 3: strncpy(value, entry.value ? "true" : "false", sizeof(value)); break;
+    default: snprintf(value, sizeof(value), "%d", entry.value);
+  }
+  value[sizeof(value) - 1] = '\0';
+  bool quoted = entry.field < 3;
+
+  char record[160];
+  snprintf(record, sizeof(record), "%s{\"seq\":%u,\"t\":%u,\"boot\":%u,\"unit\":%u,\"source\":\"%s\",\"field\":\"%s\",\"value\":%s%s%s}",
+    page->sent > 0 ? "," : "", entry.seq, entry.time, entry.boot, entry.unit,
+    entry.source <= SourceAuto ? historySources[entry.source] : "?", paramNames[entry.field],
+    quoted ? "\"" : "", value, quoted ? "\"" : "");
+  server.sendContent(record);
+  page->next = entry.seq + 1;
+  return ++page->sent < page->limit;
 }
 
 void setupWebServer() {
   Logln("[Webserver] Initializing...");
+  static const char* etagHeaders[] = { "If-None-Match" };
+  server.collectHeaders(etagHeaders, 1);
+  bootTag = newBootTag();
+
   server.on("/", HTTP_GET, [](){
     server.send(200, "text/plain", "It works!");
   });
 
-  server.on("/", HTTP_POST, [](){
-    // Print message
-    Logln("\nPOST \"\\\": ");
-    server.send(200, "application/json", \
-      handleJSONReq(server.arg("plain")));
+  // State changes, oldest first from ?from=<seq> (the newest by default), at
+  // most ?limit=<n>. Streamed record by record, "next" is where the next page starts
+  server.on("/history", HTTP_GET, [](){
+    HistoryPage page;
+    page.limit = server.hasArg("limit") ? server.arg("limit").toInt() : HISTORY_PAGE_SIZE;
+    page.limit = constrain(page.limit, 1, HISTORY_PAGE_MAX);
+    page.sent = 0;
+    uint32_t newest = history.nextSeq > page.limit ? history.nextSeq - page.limit : 0;
+    uint32_t from = server.hasArg("from") ? server.arg("from").toInt() : newest;
+    page.next = from > history.firstSeq ? from : history.firstSeq;
+
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "application/json", "");
+    server.sendContent("{\"records\":[");
+    history.read(from, &sendHistoryEntry, &page);
+    char tail[96];
+    snprintf(tail, sizeof(tail), "],\"first\":%u,\"next\":%u,\"now\":%lu}", history.firstSeq, page.next, millis());
+    server.sendContent(tail);
+    server.sendContent("");
   });
 
+  // The recorded inputs, see TraceBuffer for the format
+  server.on("/trace", HTTP_GET, [](){
+    TraceBuffer::FileHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.now = millis();
+    header.dropped = trace.dropped;
+    server.setContentLength(sizeof(header) + trace.size());
+    server.send(200, "application/octet-stream", "");
+    server.sendContent((const char*)&header, sizeof(header));
+    trace.read([](const uint8_t* data, size_t length) {
+      server.sendContent((const char*)data, length);
+    });
+  });
+  server.on("/trace", HTTP_DELETE, [](){
+    trace.clear();
+    server.send(204);
+  });
+
+  // The chip never changes while we run
+  server.on("/chip", HTTP_GET, [](){
+    if(notModified(server, makeETag(bootTag, "chip"))) return;
+    server.send(200, "application/json", getChipStatsJSON());
+  });
+
+  // Latency, heap and fault counters, DELETE starts them over
+  server.on("/stats", HTTP_GET, [](){
+    server.send(200, "application/json", getStatsJSON());
+  });
+  server.on("/stats", HTTP_DELETE, [](){
+    stats.reset();
+    server.send(204);
+  });
+
+  // POST / goes to the first controller, POST /<name> to the named ones.
+  // The request is queued for the IR context like an MQTT command and
+  // answered once it ran, right away when the transmitter has room (sending
+  // only queues the IR). Otherwise the caller gets 202 and the answer goes
+  // out on the state topic
+  for(uint8_t i = 0; i < CONTROLLER_COUNT; i++) {
+    Z906Controller* controller = &controllers[i];
+    server.on(String("/") + controller->name, HTTP_POST, [controller, i](){
+      // Print message
+      Log("\nPOST \"/%s\": \n", controller->name);
+      String req = server.arg("plain");
+      trace.record(TraceBuffer::Http, i, req.c_str(), req.length());
+      String response;
+      int status = router.post(i, req, response);
+      if(status == 503) server.sendHeader("Retry-After", "1");
+      server.send(status, "application/json", response);
+    });
+
+    // GET /state, /state/volume and /state/input (under /<name> for named ones)
+    String root = controller->name[0] == '\0' ? "" : String("/") + controller->name;
+    server.on(root + "/state", HTTP_GET, [controller](){
+      serveState(controller, [](Z906Controller* c, JsonObject json) {
+        c->getSettings(json);
+      });
+    });
+    server.on(root + "/state/volume", HTTP_GET, [controller](){
+      serveState(controller, [](Z906Controller* c, JsonObject json) {
+        json["soundlevel"] = c->state.soundLevel[0];
+        json["mute"] = c->state.mute;
+      });
+    });
+    server.on(root + "/state/input", HTTP_GET, [controller](){
+      serveState(controller, [](Z906Controller* c, JsonObject json) {
+        json["input"] = inputs[c->state.input];
+        json["effect"] = effects[c->state.currentEffect()];
+      });
+    });
+  }
+
   // Start webserver
   server.begin();
   Logln("[Webserver] Done.");
@@ -722,8 +602,15 @@ void mqttCallback(char* topic, byte* payload, int length) {
   Logln("[MQTT][callback] Callback update.");
   Logln(String("[MQTT][callback] Topic: " + topicStr));
 
-  if(topicStr.equals(CommandTopic))
-    publishMQTT(StateTopic, handleJSONReq(payloadStr));
+  uint8_t target = COMMAND_ALL;
+  for(uint8_t i = 0; i < CONTROLLER_COUNT; i++) {
+    if(topicStr.equals(controllers[i].commandTopic)) target = i;
+  }
+  if(target == COMMAND_ALL && !topicStr.equals(GroupTopic)) return;
+  trace.record(TraceBuffer::Mqtt, target, payload, length);
+  String error;
+  if(!router.receive(target, payloadStr, error))
+    publishMQTT(DebugTopic, error + ": " + payloadStr);
 }
 
 void WiFiDisconnectedCallback() {
@@ -739,6 +626,7 @@ void checkWifiStatusCallback() {
   Debugf("[checkWifiStatusCallback]");
   if(WiFi.getMode() != 1 && WiFi.status() != WL_CONNECTED) {
     Logln("[checkWifiStatusCallback] Not connected to WiFi...");
+    stats.wifiDrops++;
     blinkStatusLed(TASK_FOREVER, 500);
     tWifiStatus.setCallback(&WiFiDisconnectedCallback);
   }
@@ -750,68 +638,33 @@ void setupMQTT() {
   connectMQTT();
 }
 
-uint64_t lastState = 0;
+/** Hands what the receiver decoded to the controller the remote belongs to */
 void handleIR() {
-  if (irrecv.decode(&results)) {
-    const size_t bufferSize = JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(7);
-    DynamicJsonDocument doc(bufferSize);
-    JsonObject json = doc.to<JsonObject>();
-    String resp = "";
-
-    uint64_t state = results.value;
-
-    if(state == 0xFFFFFFFF &&
-      (lastState == 0x11E728E || lastState == 0xABB1A8D2)) {
-      Logln("[handleIR] Repeat.");
-      state = lastState;
+  Z906Controller& controller = controllers[RECV_IR_UNIT];
+  if(irrecvActive) {
+    if(irrecv.decode(&results)) {
+      irrecv.resume();
+      bool repeat = results.repeat && results.decode_type == decode_type_t::NEC;
+      wake("ir");
+      controller.receiveIR(results.decode_type, results.value, results.bits, repeat);
+      controller.recordChanges(SourceRemote);
+      activity.handled();
     }
+    return;
+  }
 
-    switch (state) {
-      case 0xFFFFFFFF:
-        Logln("[handleIR] Not repeatable.");
-        break;
-      case 0x63C98B53:
-        Logln("[handleIR] Power button pressed.");
-        currentMode = currentMode == On ? Off : On;
-        break;
-      case 0xEFA4E63F:
-        Logln("[handleIR] Input button pressed.");
-        setNextInput();
-        break;
-      case 0x92CA878C:
-        Logln("[handleIR] Mute button pressed.");
-        mute = !mute;
-        break;
-      case 0x58B863E3:
-        Logln("[handleIR] Level button pressed.");
-        nextLevelOnCurrentEffect();
-        break;
-      case 0x11E728E:
-        Logln("[handleIR] Minus button pressed.");
-        soundLevel[currentLevel()] -= soundLevel[currentLevel()] < 2 ? 0 : 1;
-        break;
-      case 0xABB1A8D2:
-        Logln("[handleIR] Plus button pressed.");
-        soundLevel[currentLevel()] += soundLevel[currentLevel()] >= 100 ? 0 : 2;
-        break;
-      case 0x48C7229F:
-        Logln("[handleIR] Effect button pressed.");
-        setNextEffect();
-        break;
-      default:
-        Log("No such ir code case: %X\n", results.value);
-        irrecv.resume();
-        return;
-    }
-    // Things that has to be done in all standard states
-    if(state != 0xFFFFFFFF) {
-      lastState = state;
-    }
-    saveSettings();
-    getSettings(json);
-    serializeJson(doc, Serial);
-    publishMQTT(StateTopic, resp);
-    irrecv.resume();
+  static uint32_t lastErrors = 0;
+  if(necDecoder.errors != lastErrors) {
+    // Something that looked like a frame got lost, maybe a remote press
+    lastErrors = necDecoder.errors;
+    controller.missedFrame();
+  }
+  if(necDecoder.available()) {
+    uint32_t code = necDecoder.read();
+    wake("ir");
+    controller.receiveIR(decode_type_t::NEC, code, NEC_BITS, code == NEC_REPEAT);
+    controller.recordChanges(SourceRemote);
+    activity.handled();
   }
 }
 
@@ -819,7 +672,7 @@ void handleIR() {
 String getChipStatsJSON() {
   const size_t bufferSize = JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(4);
   DynamicJsonDocument doc(bufferSize);
-  JsonObject root = doc.as<JsonObject>();
+  JsonObject root = doc.to<JsonObject>();
   JsonObject chip = root.createNestedObject("chip");
 
   chip["id"] = String(ESP.getFlashChipId(), HEX);
@@ -832,6 +685,68 @@ String getChipStatsJSON() {
   return resp;
 }
 
+/** Returns a json formatted string with the RuntimeStats and the queue,
+ *  receiver and confidence figures that go with them */
+String getStatsJSON() {
+  const size_t bufferSize = JSON_OBJECT_SIZE(9) + JSON_OBJECT_SIZE(5) + JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(7)
+    + JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(6) + JSON_ARRAY_SIZE(CONTROLLER_COUNT);
+  DynamicJsonDocument doc(bufferSize);
+  JsonObject root = doc.to<JsonObject>();
+  root["uptime"] = millis();
+  root["since"] = stats.since;
+  root["healthy"] = stats.healthy();
+
+  JsonObject cmds = root.createNestedObject("commands");
+  cmds["run"] = stats.commands;
+  cmds["dropped"] = router.commands.dropped.load();
+  cmds["p50"] = stats.latencyPercentile(50);
+  cmds["p99"] = stats.latencyPercentile(99);
+  cmds["max"] = stats.maxLatency;
+  root.createNestedObject("events")["dropped"] = router.events.dropped.load();
+  root["loopMaxUs"] = stats.maxLoop;
+
+  JsonObject profile = root.createNestedObject("profile");
+  profile["now"] = activity.profile == ActivityProfile::Idle ? "idle" : "active";
+  profile["activeMs"] = activity.timeIn(ActivityProfile::Active);
+  profile["idleMs"] = activity.timeIn(ActivityProfile::Idle);
+  profile["wakes"] = activity.wakes;
+  profile["wokenBy"] = activity.wakeReason;
+  profile["wakeToCommandMs"] = activity.wakeLatency;
+  profile["wakeToCommandMaxMs"] = activity.maxWakeLatency;
+
+  JsonObject heap = root.createNestedObject("heap");
+  heap["free"] = ESP.getFreeHeap();
+  heap["low"] = stats.heapLow;
+  heap["blockLow"] = stats.blockLow;
+
+  JsonObject faults = root.createNestedObject("faults");
+  faults["malformed"] = stats.malformed;
+  faults["oversized"] = stats.oversized;
+  faults["wifiDrops"] = stats.wifiDrops;
+  faults["mqttReconnects"] = stats.mqttReconnects;
+  faults["irErrors"] = necDecoder.errors;
+  faults["traceDropped"] = trace.dropped;
+
+  // How far the believed state may have drifted, the least sure parameter
+  JsonArray confidence = root.createNestedArray("confidence");
+  for(uint8_t i = 0; i < CONTROLLER_COUNT; i++) {
+    uint8_t least = CONFIDENCE_MAX;
+    for(uint8_t j = 0; j < PARAM_COUNT; j++) {
+      if(controllers[i].confidence[j] < least) least = controllers[i].confidence[j];
+    }
+    confidence.add(least);
+  }
+
+  String resp;
+  serializeJson(doc, resp);
+  return resp;
+}
+
+/** Publishes the stats, right away when a limit was just broken */
+void reportStatsCallback() {
+  publishMQTT(DebugTopic, getStatsJSON());
+}
+
 /** Prints chip status to serial */
 void printChipStatus() {
   uint32_t realSize = ESP.getFlashChipRealSize();
@@ -853,14 +768,21 @@ void printChipStatus() {
   }
 }
 
+void checkIfStillOn() {
+  for(uint8_t i = 0; i < CONTROLLER_COUNT; i++) {
+    bool wasOn = controllers[i].isOn;
+    controllers[i].checkIfStillOn();
+    controllers[i].recordChanges(SourcePower);
+    if(controllers[i].isOn == wasOn) continue;
+    wake("power");
+    activity.handled();
+  }
+}
+
 void sendStatesMQTT() {
-  const size_t bufferSize = JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(7);
-  DynamicJsonDocument doc(bufferSize);
-  JsonObject json = doc.to<JsonObject>();
-  getSettings(json);
-  String payload = "";
-  serializeJson(doc, payload);
-  publishMQTT(StateTopic, payload);
+  for(uint8_t i = 0; i < CONTROLLER_COUNT; i++) {
+    controllers[i].sendStates();
+  }
 }
 
 void testingFunction() {
@@ -886,9 +808,9 @@ void testingFunction() {
   Serial.println("2: " + two);
   Serial.println(getStringIndex("Input3", inputs, ARRAY_SIZE(inputs)));
 
-  loadSettings();
+  controllers[0].loadSettings();
   unsigned long start = micros();
-  saveSettings();
+  controllers[0].saveSettings();
   unsigned long finish = micros();
   Serial.printf("Done, took %lu µs", finish - start);
 }
@@ -901,7 +823,6 @@ void setup() {
     printChipStatus();
   #endif
 
-  pinMode(ON_LED, INPUT);
   pinMode(STATUS_LED, OUTPUT);
   digitalWrite(STATUS_LED, HIGH);
 
@@ -911,23 +832,29 @@ void setup() {
   setupWifiManager();
   setupOTA();
   setupEEPROM();
-  printSettings();
+  scenes.begin();
+  bindings.begin();
+  history.begin();
+  setupControllers();
   setupWebServer();
   setupMQTT();
   setupIR();
+  timeSync.begin();
 
   tCheckIfStillOn.enable();
   tSendStatesMQTT.enable();
   tCheckMQTTStatus.enable();
+  tReportStats.enable();
+  applyProfile();
   Serial.println("Ready");
   Serial.print("IP address: ");
   Serial.println(WiFi.localIP());
   digitalWrite(STATUS_LED, LOW);
 }
 
-void loop() {
-  taskManager.execute();
-
+/** Web server, MQTT, OTA and time sync. Only reaches the IR context through
+ *  the command and event queues */
+void networkContext() {
   if(OTA_ON) {
     noInterrupts();
     ArduinoOTA.handle();
@@ -936,24 +863,38 @@ void loop() {
 
   server.handleClient();
   mqttclient.loop();
-  handleIR();
+  timeSync.handle();
+  flushEvents();
+}
 
-  // We need to go back to On-mode after a while
-  if(isOn && currentMode >= BassLevel) {
-    if(currentMode != lastMode) {
-      levelTimeout = millis() + LEVEL_TIMEOUT;
-    } else if(millis() > levelTimeout) {
-      currentMode = On;
-      saveSettings();
-      const size_t bufferSize = JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(7);
-      DynamicJsonDocument doc(bufferSize);
-      JsonObject json = doc.to<JsonObject>();
-      String resp = "";
-      getSettings(json);
-      serializeJson(doc, resp);
-      Logln("[Loop] Ending level mode..");
-      publishMQTT(StateTopic, resp);
-    }
+/** Remote codes, queued commands (one per pass so the receiver and the ramps
+ *  get their turn in between) and the controllers */
+void irContext() {
+  handleIR();
+  router.runNext();
+  for(uint8_t i = 0; i < CONTROLLER_COUNT; i++) {
+    controllers[i].service();
   }
-  lastMode = currentMode;
-}
\ No newline at end of file
+  serviceIR();
+}
+
+void loop() {
+  static bool wasHealthy = true;
+  uint32_t start = micros();
+  taskManager.execute();
+  networkContext();
+  irContext();
+  stats.loopPass(micros() - start);
+  stats.sampleHeap();
+  if(wasHealthy && !stats.healthy()) {
+    Logln("[loop] Over a RuntimeStats limit");
+    tReportStats.forceNextIteration();
+  }
+  wasHealthy = stats.healthy();
+
+  // Stay active while an amp is on or IR is on its way out
+  bool busy = IRTransmitter::anyBusy() || irReceiveSuspended;
+  for(uint8_t i = 0; i < CONTROLLER_COUNT; i++) busy |= controllers[i].isOn;
+  if(activity.update(busy)) applyProfile();
+  if(activity.profile == ActivityProfile::Idle) delay(IDLE_LOOP_DELAY);
+}
@@ -0,0 +1,297 @@
+#ifndef HOST_ARDUINO_H_
+#define HOST_ARDUINO_H_
+
+/*
+ * Just enough of the ESP8266 Arduino core to run the firmware's sources on
+ * the host (pio test -e native). Time only moves when the code waits or a
+ * test calls hostAdvance(), and the timer0 interrupt fires on the way, so
+ * every run is deterministic.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+#include <atomic>
+#include <type_traits>
+
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+#define F(s) (s)
+#define PROGMEM
+
+#define LOW     0
+#define HIGH    1
+#define INPUT   0
+#define OUTPUT  1
+
+#define DEC 10
+#define HEX 16
+
+#define F_CPU 80000000L
+#define clockCyclesPerMicrosecond() (F_CPU / 1000000L)
+#define microsecondsToClockCycles(a) ((a) * clockCyclesPerMicrosecond())
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#define HOST_PIN_COUNT 17
+
+/******************************** Clock ***************************************/
+typedef void (*timercallback)(void);
+
+struct HostClock {
+  std::atomic<uint64_t> cycles; // Only one thread moves it, test_router_threads reads it from two
+  timercallback timer0;
+  uint32_t timer0Deadline;
+  bool timer0Armed;
+  int32_t millisSkew;   // Added to millis(), lets a test run units whose clocks disagree
+};
+inline HostClock hostClock = {};
+
+/** Moves the clock us forward, running the timer0 interrupt whenever it's due */
+inline void hostAdvance(uint32_t us) {
+  uint64_t end = hostClock.cycles + (uint64_t)us * clockCyclesPerMicrosecond();
+  while(hostClock.timer0Armed && hostClock.timer0) {
+    uint32_t left = hostClock.timer0Deadline - (uint32_t)hostClock.cycles;
+    if(hostClock.cycles + left > end) break;
+    hostClock.cycles += left;
+    hostClock.timer0Armed = false;
+    hostClock.timer0();
+  }
+  hostClock.cycles = end;
+}
+
+inline unsigned long millis() { return (uint32_t)(hostClock.cycles / (F_CPU / 1000) + hostClock.millisSkew); }
+inline unsigned long micros() { return hostClock.cycles / clockCyclesPerMicrosecond(); }
+inline void delay(unsigned long ms) { hostAdvance(ms * 1000); }
+inline void delayMicroseconds(unsigned int us) { hostAdvance(us); }
+/** Busy waits spin on yield(), so it has to let some time pass */
+inline void yield() { hostAdvance(10); }
+
+inline void timer0_isr_init() {}
+inline void timer0_attachInterrupt(timercallback userFunc) { hostClock.timer0 = userFunc; }
+inline void timer0_detachInterrupt() { hostClock.timer0 = nullptr; }
+inline void timer0_write(uint32_t count) {
+  hostClock.timer0Deadline = count;
+  hostClock.timer0Armed = true;
+}
+
+// Interrupts only run from hostAdvance(), there is nothing to mask
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+/********************************* Pins ***************************************/
+inline uint8_t hostPins[HOST_PIN_COUNT];
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t pin, uint8_t value) { if(pin < HOST_PIN_COUNT) hostPins[pin] = value; }
+inline int digitalRead(uint8_t pin) { return pin < HOST_PIN_COUNT ? hostPins[pin] : LOW; }
+
+/******************************** String **************************************/
+class String {
+  public:
+    String(const char* s = "") : s(s ? s : "") {}
+    String(const std::string& s) : s(s) {}
+    explicit String(char c) : s(1, c) {}
+    template<typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, char>::value, int>::type = 0>
+    explicit String(T value, unsigned char base = DEC) {
+      char buffer[24];
+      if(base == HEX) snprintf(buffer, sizeof(buffer), "%llx", (unsigned long long)value);
+      else if(std::is_signed<T>::value) snprintf(buffer, sizeof(buffer), "%lld", (long long)value);
+      else snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)value);
+      s = buffer;
+    }
+    explicit String(double value, unsigned char decimals = 2) {
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+      s = buffer;
+    }
+
+    String& operator=(const char* other) { s = other ? other : ""; return *this; }
+    const char* c_str() const { return s.c_str(); }
+    unsigned int length() const { return s.length(); }
+    bool isEmpty() const { return s.empty(); }
+    bool reserve(unsigned int size) { s.reserve(size); return true; }
+    char charAt(unsigned int i) const { return i < s.length() ? s[i] : 0; }
+    char operator[](unsigned int i) const { return charAt(i); }
+
+    bool concat(const String& other) { s += other.s; return true; }
+    bool concat(const char* other) { if(!other) return false; s += other; return true; }
+    bool concat(char c) { s += c; return true; }
+    template<typename T> String& operator+=(const T& other) { concat(other); return *this; }
+    String& operator+=(int n) { s += std::to_string(n); return *this; }
+    String& operator+=(unsigned int n) { s += std::to_string(n); return *this; }
+    String& operator+=(long n) { s += std::to_string(n); return *this; }
+    String& operator+=(unsigned long n) { s += std::to_string(n); return *this; }
+
+    bool equals(const String& other) const { return s == other.s; }
+    bool equals(const char* other) const { return other && s == other; }
+    bool operator==(const String& other) const { return s == other.s; }
+    bool operator==(const char* other) const { return equals(other); }
+    bool operator!=(const String& other) const { return s != other.s; }
+    bool operator!=(const char* other) const { return !equals(other); }
+    bool operator<(const String& other) const { return s < other.s; }
+
+    bool startsWith(const String& prefix) const { return s.compare(0, prefix.s.length(), prefix.s) == 0; }
+    bool endsWith(const String& suffix) const {
+      return s.length() >= suffix.s.length() && s.compare(s.length() - suffix.s.length(), suffix.s.length(), suffix.s) == 0;
+    }
+    int indexOf(char c, unsigned int from = 0) const { size_t i = s.find(c, from); return i == std::string::npos ? -1 : i; }
+    int indexOf(const String& other, unsigned int from = 0) const { size_t i = s.find(other.s, from); return i == std::string::npos ? -1 : i; }
+    String substring(unsigned int from) const { return from < s.length() ? String(s.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const { return from < to && from < s.length() ? String(s.substr(from, to - from)) : String(); }
+    void remove(unsigned int index) { if(index < s.length()) s.erase(index); }
+    void remove(unsigned int index, unsigned int count) { if(index < s.length()) s.erase(index, count); }
+    long toInt() const { return atol(s.c_str()); }
+
+  private:
+    std::string s;
+};
+
+/** What String + something gives in the core, ArduinoJson knows it by name */
+class StringSumHelper : public String {
+  public:
+    StringSumHelper(const String& s) : String(s) {}
+};
+
+inline StringSumHelper operator+(const String& a, const String& b) { String sum(a); sum.concat(b); return sum; }
+inline StringSumHelper operator+(const String& a, const char* b) { String sum(a); sum.concat(b); return sum; }
+inline StringSumHelper operator+(const char* a, const String& b) { String sum(a); sum.concat(b); return sum; }
+inline StringSumHelper operator+(const String& a, char b) { String sum(a); sum.concat(b); return sum; }
+template<typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, char>::value, int>::type = 0>
+inline StringSumHelper operator+(const String& a, T b) { String sum(a); sum.concat(String(b)); return sum; }
+
+/******************************** Serial **************************************/
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+      size_t n = 0;
+      while(size--) n += write(*buffer++);
+      return n;
+    }
+    size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+      char buffer[256];
+      va_list args;
+      va_start(args, format);
+      int length = vsnprintf(buffer, sizeof(buffer), format, args);
+      va_end(args);
+      if(length < 0) return 0;
+      return write((const uint8_t*)buffer, (size_t)length < sizeof(buffer) ? length : sizeof(buffer) - 1);
+    }
+    size_t print(const char* s) { return write(s); }
+    size_t print(const String& s) { return write(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(long n, int base = DEC) { return printf(base == HEX ? "%lX" : "%ld", n); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned long n, int base = DEC) { return printf(base == HEX ? "%lX" : "%lu", n); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(double n) { return printf("%.2f", n); }
+    size_t println() { return write("\r\n"); }
+    template<typename T> size_t println(const T& value) { return print(value) + println(); }
+    template<typename T> size_t println(const T& value, int base) { return print(value, base) + println(); }
+};
+
+/** The log goes nowhere unless a test sets echo */
+class HostSerial : public Print {
+  public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t c) override {
+      if(echo) fputc(c, stdout);
+      return 1;
+    }
+    using Print::write;
+    bool echo = false;
+};
+inline HostSerial Serial;
+
+/********************************* Heap ***************************************/
+/* The board's heap after the firmware's globals. A test that replaces
+ * malloc() can count what the firmware allocates in hostHeap while it has
+ * counting set, ESP.getFreeHeap() reports what's left. What the host
+ * stand-ins keep for the tests (waveforms, files) isn't on the board's
+ * heap, they allocate it with HostUntracked */
+#define HOST_HEAP_SIZE    40000
+#define HOST_HEAP_BLOCK   30000   // Largest free block with nothing allocated
+
+struct HostHeap {
+  size_t live = 0;        // Bytes
+  size_t peak = 0;
+  volatile bool counting = false;   // The compiler takes malloc() for not reading it
+};
+inline HostHeap hostHeap;
+
+template<typename T> struct HostUntracked {
+  typedef T value_type;
+  HostUntracked() {}
+  template<typename U> HostUntracked(const HostUntracked<U>&) {}
+  T* allocate(size_t n) {
+    bool counting = hostHeap.counting;
+    hostHeap.counting = false;
+    T* p = (T*)malloc(n * sizeof(T));
+    hostHeap.counting = counting;
+    return p;
+  }
+  void deallocate(T* p, size_t) { free(p); }
+  template<typename U> bool operator==(const HostUntracked<U>&) const { return true; }
+  template<typename U> bool operator!=(const HostUntracked<U>&) const { return false; }
+};
+
+/********************************** ESP ***************************************/
+#define HOST_RTC_USER_BLOCKS 128
+
+class HostESP {
+  public:
+    uint32_t getCycleCount() { return (uint32_t)hostClock.cycles; }
+    uint32_t getChipId() { return chipId; }
+
+    /** Same bounds as the core: 512 bytes of user memory in 4 byte blocks */
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size) {
+      if(offset * 4 + size > sizeof(rtcUserMemory) || size == 0) {
+        rtcRefused++;
+        return false;
+      }
+      memcpy(data, (uint8_t*)rtcUserMemory + offset * 4, size);
+      return true;
+    }
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size) {
+      if(offset * 4 + size > sizeof(rtcUserMemory) || size == 0) {
+        rtcRefused++;
+        return false;
+      }
+      memcpy((uint8_t*)rtcUserMemory + offset * 4, data, size);
+      return true;
+    }
+
+    uint32_t getFreeHeap() { return hostHeap.live < HOST_HEAP_SIZE ? HOST_HEAP_SIZE - hostHeap.live : 0; }
+    uint32_t getMaxFreeBlockSize() { return hostHeap.live < HOST_HEAP_BLOCK ? HOST_HEAP_BLOCK - hostHeap.live : 0; }
+    uint32_t getFlashChipRealSize() { return 4 * 1024 * 1024; }
+    uint16_t getVcc() { return 3300; }
+    uint32_t random() { return randomState = randomState * 1664525 + 1013904223; }
+    void restart() {}
+    void reset() {}
+
+    volatile uint32_t rtcUserMemory[HOST_RTC_USER_BLOCKS];
+    uint32_t rtcRefused = 0;  // Accesses the core would have refused
+    uint32_t chipId = 0x00906906;
+    uint32_t randomState = 0x906; // The hardware RNG, repeatable on the host
+};
+inline HostESP ESP;
+
+// Z906Journal's frame counter points straight into RTC user memory
+#define JOURNAL_RTC_MEM (ESP.rtcUserMemory)
+
+inline uint32_t system_get_free_heap_size() { return ESP.getFreeHeap(); }
+inline uint8_t system_get_boot_version() { return 0; }
+inline uint8_t system_get_cpu_freq() { return F_CPU / 1000000L; }
+inline const char* system_get_sdk_version() { return "host"; }
+inline uint32_t system_get_chip_id() { return 0; }
+inline uint32_t spi_flash_get_id() { return 0; }
+
+#endif // HOST_ARDUINO_H_
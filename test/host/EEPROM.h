@@ -0,0 +1,27 @@
+#ifndef HOST_EEPROM_H_
+#define HOST_EEPROM_H_
+
+/* The emulated EEPROM, a RAM buffer. commits counts the flash writes the
+ * board would have done */
+
+#include <Arduino.h>
+
+class HostEEPROM {
+  public:
+    void begin(size_t size) { this->size = size < sizeof(bytes) ? size : sizeof(bytes); }
+    uint8_t read(int address) const { return address >= 0 && (size_t)address < size ? bytes[address] : 0; }
+    void write(int address, uint8_t value) {
+      if(address >= 0 && (size_t)address < size) bytes[address] = value;
+    }
+    bool commit() {
+      commits++;
+      return size > 0;
+    }
+
+    uint8_t bytes[4096] = {};
+    size_t size = 0;
+    uint32_t commits = 0;
+};
+inline HostEEPROM EEPROM;
+
+#endif // HOST_EEPROM_H_
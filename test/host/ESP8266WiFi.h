@@ -0,0 +1,25 @@
+#ifndef HOST_ESP8266WIFI_H_
+#define HOST_ESP8266WIFI_H_
+
+#include <Arduino.h>
+#include "IPAddress.h"
+#include "WiFiUdp.h"
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+class HostWiFi {
+  public:
+    IPAddress localIP() const { return hostLan.localIP; }
+    wl_status_t status() const { return hostLan.down ? WL_DISCONNECTED : WL_CONNECTED; }
+    bool isConnected() const { return !hostLan.down; }
+    int32_t RSSI() const { return -60; }
+};
+inline HostWiFi WiFi;
+
+#endif // HOST_ESP8266WIFI_H_
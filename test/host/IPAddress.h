@@ -0,0 +1,29 @@
+#ifndef HOST_IPADDRESS_H_
+#define HOST_IPADDRESS_H_
+
+#include <Arduino.h>
+
+class IPAddress {
+  public:
+    IPAddress() : address(0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) :
+      address(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+    explicit IPAddress(uint32_t address) : address(address) {}
+
+    bool isSet() const { return address != 0; }
+    uint32_t v4() const { return address; }
+    bool operator==(const IPAddress& other) const { return address == other.address; }
+    bool operator!=(const IPAddress& other) const { return address != other.address; }
+
+    String toString() const {
+      char buffer[16];
+      snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", (unsigned)(address & 0xFF), (unsigned)((address >> 8) & 0xFF),
+        (unsigned)((address >> 16) & 0xFF), (unsigned)(address >> 24));
+      return String(buffer);
+    }
+
+  private:
+    uint32_t address;
+};
+
+#endif // HOST_IPADDRESS_H_
@@ -0,0 +1,20 @@
+#ifndef HOST_IRREMOTEESP8266_H_
+#define HOST_IRREMOTEESP8266_H_
+
+/* The protocol ids of IRremoteESP8266, the sources only keep and compare them */
+
+#include <Arduino.h>
+
+enum decode_type_t {
+  UNKNOWN = -1,
+  UNUSED = 0,
+  RC5,
+  RC6,
+  NEC,
+  SONY,
+  PANASONIC,
+  JVC,
+  SAMSUNG,
+};
+
+#endif // HOST_IRREMOTEESP8266_H_
@@ -0,0 +1,18 @@
+#ifndef HOST_IRUTILS_H_
+#define HOST_IRUTILS_H_
+
+#include <Arduino.h>
+#include "IRremoteESP8266.h"
+
+inline String typeToString(const decode_type_t protocol, const bool isRepeat = false) {
+  static const char* const names[] = { "UNUSED", "RC5", "RC6", "NEC", "SONY", "PANASONIC", "JVC", "SAMSUNG" };
+  String name = protocol >= UNUSED && protocol <= SAMSUNG ? names[protocol] : "UNKNOWN";
+  if(isRepeat) name += " (Repeat)";
+  return name;
+}
+
+inline String uint64ToString(uint64_t value, uint8_t base = 10) {
+  return String(value, base);
+}
+
+#endif // HOST_IRUTILS_H_
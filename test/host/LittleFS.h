@@ -0,0 +1,163 @@
+#ifndef HOST_LITTLEFS_H_
+#define HOST_LITTLEFS_H_
+
+/* LittleFS in RAM. Every path is a byte vector in hostFs.files, so a test
+ * can look at or corrupt what was written. A File works on its own copy
+ * and writes it back on close(), like a file the board lost power with
+ * open would not have. It's flash, not heap: the bytes are HostUntracked */
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+typedef std::vector<uint8_t, HostUntracked<uint8_t>> HostFileData;
+
+struct HostFs {
+  std::map<std::string, HostFileData> files;
+  bool mounted = false;
+  bool broken = false;    // begin() and open() fail, like a corrupt partition
+  uint32_t writes = 0;    // Files closed after writing
+};
+inline HostFs hostFs;
+
+class File {
+  public:
+    File() {}
+    File(const std::string& path, bool writing, HostFileData data, size_t at) :
+      path(path), writing(writing), data(data), at(at), isOpen(true) {}
+    ~File() { close(); }
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+    File(File&& other) { *this = std::move(other); }
+    File& operator=(File&& other) {
+      close();
+      path = other.path;
+      writing = other.writing;
+      data = std::move(other.data);
+      at = other.at;
+      isOpen = other.isOpen;
+      other.isOpen = false;
+      return *this;
+    }
+
+    explicit operator bool() const { return isOpen; }
+    size_t size() const { return data.size(); }
+    size_t position() const { return at; }
+    int available() const { return isOpen ? data.size() - at : 0; }
+
+    size_t write(const uint8_t* buffer, size_t size) {
+      if(!isOpen || !writing) return 0;
+      if(at + size > data.size()) data.resize(at + size);
+      memcpy(data.data() + at, buffer, size);
+      at += size;
+      return size;
+    }
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+    size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+
+    int read() {
+      if(available() <= 0) return -1;
+      return data[at++];
+    }
+    size_t read(uint8_t* buffer, size_t size) {
+      size_t left = available();
+      if(size > left) size = left;
+      memcpy(buffer, data.data() + at, size);
+      at += size;
+      return size;
+    }
+    String readString() {
+      String s;
+      while(available() > 0) s += (char)read();
+      return s;
+    }
+    bool seek(long offset, SeekMode mode = SeekSet) {
+      long base = mode == SeekSet ? 0 : mode == SeekCur ? (long)at : (long)data.size();
+      if(base + offset < 0 || base + offset > (long)data.size()) return false;
+      at = base + offset;
+      return true;
+    }
+
+    void close() {
+      if(!isOpen) return;
+      isOpen = false;
+      if(writing) {
+        hostFs.files[path] = data;
+        hostFs.writes++;
+      }
+    }
+
+  private:
+    std::string path;
+    bool writing = false;
+    HostFileData data;
+    size_t at = 0;
+    bool isOpen = false;
+};
+
+class Dir {
+  public:
+    Dir() {}
+    Dir(const std::string& path) : prefix(path.back() == '/' ? path : path + "/") {
+      for(const auto& file : hostFs.files) {
+        if(file.first.compare(0, prefix.size(), prefix) == 0) names.push_back(file.first.substr(prefix.size()));
+      }
+    }
+    bool next() { return ++at < (int)names.size(); }
+    String fileName() const { return String(names[at].c_str()); }
+    size_t fileSize() const { return hostFs.files[prefix + names[at]].size(); }
+
+  private:
+    std::string prefix;
+    std::vector<std::string> names;
+    int at = -1;
+};
+
+class HostLittleFS {
+  public:
+    bool begin() { return hostFs.mounted = !hostFs.broken; }
+    void end() { hostFs.mounted = false; }
+    bool format() {
+      hostFs.files.clear();
+      return true;
+    }
+    bool exists(const char* path) const { return hostFs.files.count(path) > 0; }
+    bool exists(const String& path) const { return exists(path.c_str()); }
+    bool mkdir(const char*) { return true; }
+    bool mkdir(const String&) { return true; }
+
+    File open(const char* path, const char* mode) {
+      if(!hostFs.mounted || hostFs.broken) return File();
+      auto it = hostFs.files.find(path);
+      if(mode[0] == 'r') {
+        if(it == hostFs.files.end()) return File();
+        return File(path, mode[1] == '+', it->second, 0);
+      }
+      HostFileData data;
+      if(mode[0] == 'a' && it != hostFs.files.end()) data = it->second;
+      size_t at = data.size();
+      return File(path, true, data, at);
+    }
+    File open(const String& path, const char* mode) { return open(path.c_str(), mode); }
+    Dir openDir(const char* path) { return Dir(path); }
+    Dir openDir(const String& path) { return Dir(path.c_str()); }
+
+    bool remove(const char* path) { return hostFs.files.erase(path) > 0; }
+    bool remove(const String& path) { return remove(path.c_str()); }
+    bool rename(const char* from, const char* to) {
+      auto it = hostFs.files.find(from);
+      if(it == hostFs.files.end()) return false;
+      hostFs.files[to] = it->second;
+      hostFs.files.erase(from);
+      return true;
+    }
+    bool rename(const String& from, const String& to) { return rename(from.c_str(), to.c_str()); }
+};
+inline HostLittleFS LittleFS;
+
+#endif // HOST_LITTLEFS_H_
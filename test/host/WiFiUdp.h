@@ -0,0 +1,114 @@
+#ifndef HOST_WIFIUDP_H_
+#define HOST_WIFIUDP_H_
+
+/* UDP over an in-process LAN. Every socket takes hostLan.localIP when it
+ * begins, so a test runs several units by setting it before each one. A
+ * datagram arrives hostLan.delayMs (plus the sender's extra delay) after
+ * it was sent, measured on the host clock */
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <Arduino.h>
+#include "IPAddress.h"
+
+class WiFiUDP;
+
+struct HostDatagram {
+  IPAddress from;
+  uint64_t deliverAt;   // Cycle count
+  std::vector<uint8_t> data;
+};
+
+struct HostLan {
+  std::vector<WiFiUDP*> sockets;
+  IPAddress localIP;
+  uint32_t delayMs = 1;
+  std::map<uint32_t, uint32_t> extraDelayMs;  // By sender address, for asymmetric paths
+  uint32_t sent = 0;
+  uint32_t dropped = 0;
+  bool down = false;                          // Wi-Fi drop, everything sent is lost
+};
+inline HostLan hostLan;
+
+class WiFiUDP {
+  public:
+    ~WiFiUDP() { stop(); }
+
+    uint8_t begin(uint16_t port) {
+      stop();
+      this->port = port;
+      ip = hostLan.localIP;
+      hostLan.sockets.push_back(this);
+      return 1;
+    }
+    void stop() {
+      for(size_t i = 0; i < hostLan.sockets.size(); i++) {
+        if(hostLan.sockets[i] == this) hostLan.sockets.erase(hostLan.sockets.begin() + i--);
+      }
+      inbox.clear();
+    }
+
+    int beginPacket(IPAddress to, uint16_t toPort) {
+      outgoing.clear();
+      outgoingTo = to;
+      outgoingPort = toPort;
+      return 1;
+    }
+    size_t write(const uint8_t* buffer, size_t size) {
+      outgoing.insert(outgoing.end(), buffer, buffer + size);
+      return size;
+    }
+    size_t write(uint8_t c) { return write(&c, 1); }
+    int endPacket() {
+      hostLan.sent++;
+      if(hostLan.down) {
+        hostLan.dropped++;
+        return 0;
+      }
+      uint32_t delayMs = hostLan.delayMs + hostLan.extraDelayMs[ip.v4()];
+      uint64_t deliverAt = hostClock.cycles + (uint64_t)delayMs * (F_CPU / 1000);
+      bool broadcast = outgoingTo == IPAddress(255, 255, 255, 255);
+      for(WiFiUDP* socket : hostLan.sockets) {
+        if(socket == this || socket->port != outgoingPort) continue;
+        if(broadcast || socket->ip == outgoingTo) socket->inbox.push_back({ ip, deliverAt, outgoing });
+      }
+      return 1;
+    }
+
+    /** Size of the next datagram that has arrived, 0 if none */
+    int parsePacket() {
+      current.data.clear();
+      readAt = 0;
+      for(size_t i = 0; i < inbox.size(); i++) {
+        if(inbox[i].deliverAt > hostClock.cycles) continue;
+        current = inbox[i];
+        inbox.erase(inbox.begin() + i);
+        return current.data.size();
+      }
+      return 0;
+    }
+    int read(uint8_t* buffer, size_t size) {
+      size_t left = current.data.size() - readAt;
+      if(size > left) size = left;
+      memcpy(buffer, current.data.data() + readAt, size);
+      readAt += size;
+      return size;
+    }
+    int available() { return current.data.size() - readAt; }
+    void flush() { readAt = current.data.size(); }
+    IPAddress remoteIP() const { return current.from; }
+
+  private:
+    uint16_t port = 0;
+    IPAddress ip;
+    std::deque<HostDatagram> inbox;
+    HostDatagram current;
+    size_t readAt = 0;
+    std::vector<uint8_t> outgoing;
+    IPAddress outgoingTo;
+    uint16_t outgoingPort = 0;
+};
+
+#endif // HOST_WIFIUDP_H_
@@ -0,0 +1,89 @@
+#ifndef HOST_Z906_AMP_H_
+#define HOST_Z906_AMP_H_
+
+/* The Z906 in front of an IR LED, for the suites that check what the
+ * firmware believes against what the amp would have done */
+
+#include <string>
+
+#include <Arduino.h>
+#include <esp8266_peri.h>
+
+#include "NecDecoder.hpp"
+#include "Z906Controller.h"
+
+/**
+ * The amp. It acts on every frame it sees, ours or the remote's, repeats
+ * the last key while repeats keep coming and drops out of a level mode
+ * after LEVEL_TIMEOUT. A key counts the same whoever sent it, the amp
+ * can't tell (applySent). It's on or off as its on-led says, the test
+ * drives both
+ */
+struct AmpModel {
+  Z906State state;
+  uint32_t lastKey;
+  uint32_t lastFrameMs;
+
+  void frame(uint32_t code, uint32_t ms) {
+    idle(ms);
+    bool repeat = code == NEC_REPEAT;
+    if(repeat && (ms - lastFrameMs > NEC_HOLD_TIMEOUT || !isRepeatableKey(lastKey))) {
+      // Released, like IRHold: repeats stay orphaned until the next key
+      lastKey = 0;
+      lastFrameMs = ms;
+      return;
+    }
+    if(!repeat) lastKey = code;
+    lastFrameMs = ms;
+    // Power is what the on-led says, see power()
+    if(lastKey == POWER_IR) return;
+    applySent(state, lastKey);
+  }
+
+  /** The on-led is the amp's own word on its power */
+  void power(bool on) {
+    if(!on) state.mode = Off;
+    else if(state.mode == Off) state.mode = On;
+  }
+
+  void idle(uint32_t ms) {
+    if(state.mode > On && ms - lastFrameMs > LEVEL_TIMEOUT) state.mode = On;
+  }
+};
+
+/** The fields where believed and amp differ, separated by spaces */
+inline std::string divergence(const Z906State& believed, const Z906State& amp) {
+  static const char* const levels[] = { "soundlevel", "basslevel", "rearlevel", "centerlevel" };
+  std::string fields;
+  auto differs = [&fields](bool different, const char* name) {
+    if(!different) return;
+    if(!fields.empty()) fields += " ";
+    fields += name;
+  };
+  differs((believed.mode == Off) != (amp.mode == Off), "power");
+  differs(believed.input != amp.input, "input");
+  differs(believed.mute != amp.mute, "mute");
+  differs(memcmp(believed.effectOnInput, amp.effectOnInput, sizeof(amp.effectOnInput)) != 0, "effect");
+  for(uint8_t i = 0; i < 4; i++) differs(believed.soundLevel[i] != amp.soundLevel[i], levels[i]);
+  return fields;
+}
+
+/** Decodes the edges on an IR LED as they show up */
+struct LedDecoder {
+  NecDecoder decoder;
+  size_t next = 0;
+  uint64_t last = 0;
+  bool mark = false;
+
+  void poll(uint8_t pin, std::vector<uint32_t>& codes) {
+    HostEdges& edges = hostWaveform[pin];
+    for(; next < edges.size() && hostEdgeFinal(pin, next); next++) {
+      decoder.feed((edges[next].at - last) / clockCyclesPerMicrosecond(), mark);
+      if(decoder.available()) codes.push_back(decoder.read());
+      last = edges[next].at;
+      mark = edges[next].mark;
+    }
+  }
+};
+
+#endif // HOST_Z906_AMP_H_
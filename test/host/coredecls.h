@@ -0,0 +1,17 @@
+#ifndef HOST_COREDECLS_H_
+#define HOST_COREDECLS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** The core's CRC-32 (reflected, polynomial 0xEDB88320) */
+inline uint32_t crc32(const void* data, size_t length, uint32_t crc = 0xffffffff) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  while(length--) {
+    crc ^= *bytes++;
+    for(uint8_t i = 0; i < 8; i++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return crc;
+}
+
+#endif // HOST_COREDECLS_H_
@@ -0,0 +1,58 @@
+#ifndef HOST_ESP8266_PERI_H_
+#define HOST_ESP8266_PERI_H_
+
+/* The GPIO set/clear registers (GPOS/GPOC). Writes change hostPins and are
+ * folded back into the envelope of the carrier on every pin, the way the IR
+ * receiver in front of it sees it, so a test can decode what each IR LED
+ * sent. A low that lasts less than HOST_CARRIER_GAP is still the same mark */
+
+#include <vector>
+
+#include <Arduino.h>
+
+#define HOST_CARRIER_GAP  microsecondsToClockCycles(40) // The carrier is 26 µs
+
+struct HostEdge {
+  uint64_t at;  // Cycle count
+  bool mark;    // Carrier on from here
+};
+
+typedef std::vector<HostEdge, HostUntracked<HostEdge>> HostEdges;
+inline HostEdges hostWaveform[HOST_PIN_COUNT];
+inline uint32_t hostCarrierPulses[HOST_PIN_COUNT];  // Highs written, one per carrier period
+
+inline void hostPinWrite(uint8_t pin, bool high) {
+  if(pin >= HOST_PIN_COUNT || hostPins[pin] == high) return;
+  hostPins[pin] = high;
+  HostEdges& edges = hostWaveform[pin];
+  if(!high) {
+    edges.push_back({ hostClock.cycles, false });
+    return;
+  }
+  hostCarrierPulses[pin]++;
+  if(!edges.empty() && !edges.back().mark && hostClock.cycles - edges.back().at < HOST_CARRIER_GAP) {
+    edges.pop_back();
+    return;
+  }
+  edges.push_back({ hostClock.cycles, true });
+}
+
+/** True unless edge is the last one on pin and a carrier low that may still turn out to be part of a mark */
+inline bool hostEdgeFinal(uint8_t pin, size_t edge) {
+  const HostEdges& edges = hostWaveform[pin];
+  return edge + 1 < edges.size() || edges[edge].mark || hostClock.cycles - edges[edge].at >= HOST_CARRIER_GAP;
+}
+
+struct HostGpioRegister {
+  bool set;
+  HostGpioRegister& operator=(uint32_t mask) {
+    for(uint8_t pin = 0; pin < 16; pin++) {
+      if(mask & (1UL << pin)) hostPinWrite(pin, set);
+    }
+    return *this;
+  }
+};
+inline HostGpioRegister GPOS = { true };
+inline HostGpioRegister GPOC = { false };
+
+#endif // HOST_ESP8266_PERI_H_
@@ -0,0 +1,6 @@
+# PlatformIO only hands build_flags to the compiler on the native platform,
+# the thread library and the sanitizers have to reach the linker as well
+Import("env")
+
+flags = [f for f in env.get("CCFLAGS", []) if f == "-pthread" or str(f).startswith("-fsanitize")]
+env.Append(LINKFLAGS=[f for f in flags if f not in env.get("LINKFLAGS", [])])
@@ -0,0 +1,107 @@
+#include <unity.h>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <LittleFS.h>
+#include <esp8266_peri.h>
+
+#include "Z906Controller.h"
+
+/* Batch requests: all operations merged into one planned sequence, or
+ * nothing at all when one of them is wrong, and a result per operation */
+
+#define IR_PIN      4
+#define ON_LED_PIN  5
+
+static Z906Controller controller("", IR_PIN, ON_LED_PIN, 0);
+
+static bool drain(uint32_t limitMs = 10000) {
+  for(uint32_t ms = 0; ms < limitMs; ms++) {
+    controller.service();
+    if(!IRTransmitter::anyBusy()) return true;
+    hostAdvance(1000);
+  }
+  return false;
+}
+
+/** Runs a batch of ops (a JSON array) and returns the response */
+static String batch(const char* ops) {
+  String response = controller.handleJSONReq(String("{\"method\":\"batch\",\"ops\":") + ops + "}");
+  TEST_ASSERT_TRUE(drain());
+  return response;
+}
+
+static bool hasResults(const String& response, const char* results) {
+  return response.indexOf(String("\"results\":") + results) != -1;
+}
+
+void setUp() {
+  digitalWrite(ON_LED_PIN, HIGH);
+  controller.checkIfStillOn();
+  controller.state.input = Input1;
+  for(uint8_t i = 0; i < INPUT_COUNT; i++) controller.state.effectOnInput[i] = Surround;
+  for(uint8_t i = 0; i < 4; i++) controller.state.soundLevel[i] = 20;
+  controller.saveSettings();
+  TEST_ASSERT_TRUE(drain());
+  hostWaveform[IR_PIN].clear();
+}
+
+void tearDown() {}
+
+/** One wrong operation and nothing is sent, the others are skipped */
+void test_invalid_operation_rejects_the_batch() {
+  const char* const rejected[][2] = {
+    { "[{\"soundlevel\":30},{\"volume\":12}]", "[\"skipped\",\"invalid\"]" },                  // Unknown field
+    { "[{\"soundlevel\":30,\"bas\":5},{\"input\":\"Input 2\"}]", "[\"invalid\",\"skipped\"]" }, // Unknown next to a known one
+    { "[{\"soundlevel\":101}]", "[\"invalid\"]" },                                              // Past LEVEL_MAX
+    { "[{\"basslevel\":-1},{\"mute\":true}]", "[\"invalid\",\"skipped\"]" },
+    { "[{\"mute\":true},{\"input\":\"Input 9\"}]", "[\"skipped\",\"invalid\"]" },
+    { "[{\"effect\":\"Music\"},{}]", "[\"skipped\",\"invalid\"]" },                             // Nothing to do
+  };
+  uint32_t commits = EEPROM.commits;
+  uint32_t version = controller.stateVersion;
+  for(auto& request : rejected) {
+    String response = batch(request[0]);
+    TEST_ASSERT_TRUE_MESSAGE(hasResults(response, request[1]), response.c_str());
+    TEST_ASSERT_NOT_EQUAL(-1, response.indexOf("nothing was sent"));
+  }
+  TEST_ASSERT_TRUE(hostWaveform[IR_PIN].empty());
+  TEST_ASSERT_EQUAL_UINT32(commits, EEPROM.commits);
+  TEST_ASSERT_EQUAL_UINT32(version, controller.stateVersion);
+  TEST_ASSERT_EQUAL_INT8(20, controller.state.soundLevel[0]);
+  TEST_ASSERT_FALSE(controller.state.mute);
+}
+
+/** A later operation on the same fields wins, the earlier one is overridden */
+void test_later_operations_override() {
+  String response = batch("[{\"soundlevel\":30},{\"basslevel\":15,\"mute\":true},{\"soundlevel\":25},{\"mute\":false}]");
+  TEST_ASSERT_TRUE_MESSAGE(hasResults(response, "[\"overridden\",\"ok\",\"ok\",\"ok\"]"), response.c_str());
+  TEST_ASSERT_EQUAL_INT8(25, controller.state.soundLevel[0]);
+  TEST_ASSERT_EQUAL_INT8(15, controller.state.soundLevel[1]);
+  TEST_ASSERT_FALSE(controller.state.mute);
+  TEST_ASSERT_FALSE(hostWaveform[IR_PIN].empty());
+}
+
+/** Stereo has no rear or center level, those operations are unreachable
+ *  and the rest still goes out */
+void test_levels_the_effect_lacks_are_unreachable() {
+  String response = batch("[{\"effect\":\"Stereo\"},{\"rearlevel\":10},{\"soundlevel\":12,\"centerlevel\":8},{\"basslevel\":11}]");
+  TEST_ASSERT_TRUE_MESSAGE(hasResults(response, "[\"ok\",\"unreachable\",\"unreachable\",\"ok\"]"), response.c_str());
+  TEST_ASSERT_EQUAL(Stereo, controller.state.currentEffect());
+  TEST_ASSERT_EQUAL_INT8(12, controller.state.soundLevel[0]);
+  TEST_ASSERT_EQUAL_INT8(11, controller.state.soundLevel[1]);
+  TEST_ASSERT_EQUAL_INT8(20, controller.state.soundLevel[2]);
+  TEST_ASSERT_EQUAL_INT8(20, controller.state.soundLevel[3]);
+}
+
+int main() {
+  EEPROM.begin(512);
+  LittleFS.begin();
+  bindings.begin();
+  controller.begin("speaker/logitech_z906");
+  UNITY_BEGIN();
+  RUN_TEST(test_invalid_operation_rejects_the_batch);
+  RUN_TEST(test_later_operations_override);
+  RUN_TEST(test_levels_the_effect_lacks_are_unreachable);
+  return UNITY_END();
+}
@@ -0,0 +1,124 @@
+#include <unity.h>
+#include <vector>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <LittleFS.h>
+#include <esp8266_peri.h>
+
+#include "Z906Controller.h"
+
+/* Another remote's NEC key bound to Plus, held down in front of the
+ * receiver. The receiver is off from the moment we queue a frame until
+ * nothing is on the air any more, like main.cpp's suspendIRIn() and
+ * serviceIR(), and only hears a frame of the remote's it was on for the
+ * whole of */
+
+#define IR_PIN        4
+#define ON_LED_PIN    5
+#define TV_VOLUME_UP  0x20DF40BF
+
+static Z906Controller controller("", IR_PIN, ON_LED_PIN, 0);
+static bool suspended = false;
+
+struct RemoteFrame {
+  uint64_t start;   // Cycle count
+  uint64_t end;
+  bool heard;
+};
+
+/** Runs the loop for holdMs while the remote holds its key and as long
+ *  again after, returns the remote's frames */
+static std::vector<RemoteFrame> hold(uint32_t holdMs) {
+  uint64_t frameLength = microsecondsToClockCycles((uint64_t)necDuration(necWaveforms[0].timings, NEC_FRAME_LENGTH));
+  uint64_t repeatLength = microsecondsToClockCycles((uint64_t)necDuration(necRepeatWaveform, NEC_REPEAT_LENGTH));
+  uint64_t period = microsecondsToClockCycles((uint64_t)NEC_FRAME_PERIOD);
+  uint64_t start = hostClock.cycles;
+  uint64_t release = start + microsecondsToClockCycles((uint64_t)holdMs * 1000);
+
+  std::vector<RemoteFrame> frames;
+  for(uint64_t at = start; at < release; at += period) {
+    frames.push_back({ at, at + (frames.empty() ? frameLength : repeatLength), true });
+  }
+  size_t next = 0;
+  while(hostClock.cycles < release + (release - start)) {
+    if(suspended && !IRTransmitter::anyOnAir()) suspended = false;
+    for(RemoteFrame& frame : frames) {
+      if(frame.start <= hostClock.cycles && hostClock.cycles < frame.end && suspended) frame.heard = false;
+    }
+    if(next < frames.size() && frames[next].end <= hostClock.cycles) {
+      if(frames[next].heard) {
+        if(next == 0)
+          controller.receiveIR(decode_type_t::NEC, TV_VOLUME_UP, 32, false);
+        else
+          controller.receiveIR(decode_type_t::NEC, NEC_REPEAT, 0, true);
+      }
+      next++;
+    }
+    controller.service();
+    hostAdvance(1000);
+  }
+  return frames;
+}
+
+/** Start of every frame on the IR LED, a header mark is the only one over 8 ms */
+static std::vector<uint64_t> ledFrames() {
+  std::vector<uint64_t> starts;
+  HostEdges& edges = hostWaveform[IR_PIN];
+  for(size_t i = 0; i + 1 < edges.size(); i++) {
+    if(edges[i].mark && edges[i + 1].at - edges[i].at > microsecondsToClockCycles(8000)) starts.push_back(edges[i].at);
+  }
+  return starts;
+}
+
+void setUp() {
+  IRTransmitter::onSend = []() { suspended = true; };
+  digitalWrite(ON_LED_PIN, HIGH);
+  controller.checkIfStillOn();
+  controller.state.soundLevel[0] = 20;
+  for(HostEdges& edges : hostWaveform) edges.clear();
+}
+
+void tearDown() {}
+
+/** One missed repeat mustn't end the hold, a longer silence still does */
+void test_bound_hold_survives_one_missed_repeat() {
+  IRHold bound(BOUND_HOLD_TIMEOUT);
+  bound.onFrame(TV_VOLUME_UP, 1000);
+  // The key frame is decoded 56 ms later in its frame than a repeat
+  TEST_ASSERT_EQUAL_HEX32(TV_VOLUME_UP, bound.onFrame(NEC_REPEAT, 1000 + 2 * NEC_FRAME_PERIOD_MS - 56));
+  TEST_ASSERT_EQUAL_UINT16(2, bound.repeatsBy(1000 + 2 * NEC_FRAME_PERIOD_MS - 56));
+  TEST_ASSERT_EQUAL_HEX32(NEC_REPEAT, bound.onFrame(NEC_REPEAT, 1000 + 5 * NEC_FRAME_PERIOD_MS - 56));
+
+  IRHold remote;
+  remote.onFrame(PLUS_IR, 1000);
+  TEST_ASSERT_EQUAL_HEX32(NEC_REPEAT, remote.onFrame(NEC_REPEAT, 1000 + 2 * NEC_FRAME_PERIOD_MS + 52));
+}
+
+/** The echo keeps up with the remote and its repeats follow each other without a gap */
+void test_held_bound_key_is_echoed_as_one_burst() {
+  TEST_ASSERT_TRUE(bindings.bind(decode_type_t::NEC, TV_VOLUME_UP, 32, PLUS_IR));
+  std::vector<RemoteFrame> remote = hold(2000);
+  std::vector<uint64_t> echo = ledFrames();
+
+  // Every frame of the remote's got to the amp, heard or not
+  TEST_ASSERT_UINT32_WITHIN(1, remote.size(), echo.size());
+  TEST_ASSERT_EQUAL_INT8(20 + echo.size(), controller.state.soundLevel[0]);
+  for(size_t i = 2; i < echo.size(); i++) {
+    TEST_ASSERT_UINT32_WITHIN(1000, NEC_FRAME_PERIOD, (echo[i] - echo[i - 1]) / clockCyclesPerMicrosecond());
+  }
+  // Up to the end of the hold
+  int32_t behind = (int64_t)(remote.back().start - echo.back()) / clockCyclesPerMicrosecond();
+  TEST_ASSERT_LESS_OR_EQUAL(2 * NEC_FRAME_PERIOD, behind);
+}
+
+int main() {
+  EEPROM.begin(512);
+  LittleFS.begin();
+  bindings.begin();
+  controller.begin("speaker/logitech_z906");
+  UNITY_BEGIN();
+  RUN_TEST(test_bound_hold_survives_one_missed_repeat);
+  RUN_TEST(test_held_bound_key_is_echoed_as_one_burst);
+  return UNITY_END();
+}
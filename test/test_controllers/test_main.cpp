@@ -0,0 +1,151 @@
+#include <unity.h>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <LittleFS.h>
+#include <esp8266_peri.h>
+
+#include "CommandRouter.h"
+#include "Z906Controller.h"
+
+/* Several amps on one board, like main.cpp's controllers[]. Each has its
+ * own EEPROM slot, topics, transmitter and believed state, and a command
+ * for one must leave the others alone */
+
+#define CLIENT_ROOT "speaker/logitech_z906"
+#define CONTROLLERS 4
+#define REFUSING    3   // GPIO16 can't carry the carrier, its transmitter refuses everything
+
+static const uint8_t irPins[CONTROLLERS] = { 4, 5, 12, 16 };
+static const uint8_t ledPins[CONTROLLERS] = { 0, 1, 2, 3 };
+static Z906Controller controllers[CONTROLLERS] = {
+  Z906Controller("", 4, 0, 0),
+  Z906Controller("kitchen", 5, 1, 1),
+  Z906Controller("patio", 12, 2, 2),
+  Z906Controller("garage", 16, 3, 3),
+};
+
+/** Runs the loop until nothing is on the air */
+static bool drain(uint32_t limitMs = 5000) {
+  for(uint32_t ms = 0; ms < limitMs; ms++) {
+    for(Z906Controller& controller : controllers) controller.service();
+    if(!IRTransmitter::anyBusy()) return true;
+    hostAdvance(1000);
+  }
+  return false;
+}
+
+static void setLevels(int8_t level) {
+  for(Z906Controller& controller : controllers) {
+    for(uint8_t i = 0; i < 4; i++) controller.state.soundLevel[i] = level;
+  }
+}
+
+void setUp() {
+  for(uint8_t i = 0; i < CONTROLLERS; i++) {
+    digitalWrite(ledPins[i], HIGH);
+    controllers[i].checkIfStillOn();
+  }
+  setLevels(20);
+  drain();
+  Event event;
+  while(router.popEvent(event)) {}
+  for(HostEdges& edges : hostWaveform) edges.clear();
+}
+
+void tearDown() {}
+
+void test_topics_follow_the_names() {
+  TEST_ASSERT_EQUAL_STRING(CLIENT_ROOT "/cmnd/json", controllers[0].commandTopic.c_str());
+  TEST_ASSERT_EQUAL_STRING(CLIENT_ROOT "/state/json", controllers[0].stateTopic.c_str());
+  TEST_ASSERT_EQUAL_STRING(CLIENT_ROOT "/debug", controllers[0].debugTopic.c_str());
+  TEST_ASSERT_EQUAL_STRING(CLIENT_ROOT "/kitchen/cmnd/json", controllers[1].commandTopic.c_str());
+  TEST_ASSERT_EQUAL_STRING(CLIENT_ROOT "/kitchen/state/json", controllers[1].stateTopic.c_str());
+  TEST_ASSERT_EQUAL_STRING(CLIENT_ROOT "/patio/debug", controllers[2].debugTopic.c_str());
+
+  // The state goes out on the controller's own topic
+  controllers[2].sendStates();
+  Event event;
+  TEST_ASSERT_TRUE(router.popEvent(event));
+  TEST_ASSERT_EQUAL_STRING(CLIENT_ROOT "/patio/state/json", event.topic.c_str());
+  TEST_ASSERT_FALSE(router.popEvent(event));
+}
+
+/** Every controller saves to and loads from its own EEPROM slot */
+void test_settings_live_in_their_slot() {
+  for(uint8_t i = 0; i < CONTROLLERS; i++) {
+    controllers[i].state.soundLevel[0] = 10 + i;
+    controllers[i].state.input = (Input)i;
+    controllers[i].saveSettings();
+  }
+  for(uint8_t i = 0; i < CONTROLLERS; i++) {
+    TEST_ASSERT_EQUAL_UINT8(10 + i, EEPROM.read(i * EEPROM_SLOT_SIZE + SOUND_LEVEL_ADDR));
+    TEST_ASSERT_EQUAL_UINT8(i, EEPROM.read(i * EEPROM_SLOT_SIZE + CURRENT_INPUT_ADDR));
+  }
+
+  setLevels(0);
+  for(Z906Controller& controller : controllers) controller.loadSettings();
+  for(uint8_t i = 0; i < CONTROLLERS; i++) {
+    TEST_ASSERT_EQUAL_INT8(10 + i, controllers[i].state.soundLevel[0]);
+    TEST_ASSERT_EQUAL(i, controllers[i].state.input);
+  }
+}
+
+/** A command for one amp only goes out on its LED and only changes its state */
+void test_commands_change_one_controller() {
+  uint32_t versions[CONTROLLERS];
+  for(uint8_t i = 0; i < CONTROLLERS; i++) versions[i] = controllers[i].stateVersion;
+
+  controllers[1].handleJSONReq("{\"method\":\"setSettings\",\"soundlevel\":25}");
+  TEST_ASSERT_TRUE(drain());
+
+  TEST_ASSERT_EQUAL_INT8(25, controllers[1].state.soundLevel[0]);
+  TEST_ASSERT_FALSE(hostWaveform[irPins[1]].empty());
+  for(uint8_t i = 0; i < CONTROLLERS; i++) {
+    if(i == 1) continue;
+    TEST_ASSERT_EQUAL_INT8(20, controllers[i].state.soundLevel[0]);
+    TEST_ASSERT_EQUAL_UINT32(versions[i], controllers[i].stateVersion);
+    TEST_ASSERT_TRUE(hostWaveform[irPins[i]].empty());
+  }
+}
+
+/** A power key the transmitter won't take changes nothing: no mode, no
+ *  EEPROM commit and no journal entry that a reset would replay */
+void test_refused_power_key_leaves_the_state() {
+  for(uint8_t i : { (uint8_t)0, (uint8_t)REFUSING }) {
+    digitalWrite(ledPins[i], LOW);
+    controllers[i].checkIfStillOn();
+  }
+  uint32_t journal[JOURNAL_RTC_BLOCKS];
+  ESP.rtcUserMemoryRead(JOURNAL_RTC_OFFSET + REFUSING * JOURNAL_RTC_BLOCKS, journal, sizeof(journal));
+  uint32_t commits = EEPROM.commits;
+
+  String response = controllers[REFUSING].handleJSONReq("{\"method\":\"turnOn\"}");
+  TEST_ASSERT_NOT_EQUAL(-1, response.indexOf("busy"));
+  TEST_ASSERT_EQUAL(Off, controllers[REFUSING].state.mode);
+  TEST_ASSERT_EQUAL_UINT32(commits, EEPROM.commits);
+  uint32_t after[JOURNAL_RTC_BLOCKS];
+  ESP.rtcUserMemoryRead(JOURNAL_RTC_OFFSET + REFUSING * JOURNAL_RTC_BLOCKS, after, sizeof(after));
+  TEST_ASSERT_EQUAL_MEMORY(journal, after, sizeof(journal));
+
+  // The same request goes out on an amp with a transmitter
+  response = controllers[0].handleJSONReq("{\"method\":\"turnOn\"}");
+  TEST_ASSERT_EQUAL(-1, response.indexOf("busy"));
+  TEST_ASSERT_EQUAL_UINT32(commits + 1, EEPROM.commits);
+  TEST_ASSERT_TRUE(drain());
+  TEST_ASSERT_FALSE(hostWaveform[irPins[0]].empty());
+}
+
+int main() {
+  EEPROM.begin(512);
+  LittleFS.begin();
+  bindings.begin();
+  router.begin(controllers, CONTROLLERS);
+  for(Z906Controller& controller : controllers) controller.begin(CLIENT_ROOT);
+  UNITY_BEGIN();
+  RUN_TEST(test_topics_follow_the_names);
+  RUN_TEST(test_settings_live_in_their_slot);
+  RUN_TEST(test_commands_change_one_controller);
+  RUN_TEST(test_refused_power_key_leaves_the_state);
+  return UNITY_END();
+}
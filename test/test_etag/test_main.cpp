@@ -0,0 +1,120 @@
+#include <unity.h>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <LittleFS.h>
+#include <esp8266_peri.h>
+
+#include "ETag.hpp"
+#include "Z906Controller.h"
+
+/* The conditional GETs main.cpp's serveState() answers, against a
+ * stand-in for ESP8266WebServer that keeps what was sent */
+
+#define CLIENT_ROOT "speaker/logitech_z906"
+
+struct HostServer {
+  String ifNoneMatch;
+  String etag;
+  int status = 0;
+
+  void sendHeader(const char* name, const String& value) {
+    if(strcmp(name, "ETag") == 0) etag = value;
+  }
+  String header(const char*) const { return ifNoneMatch; }
+  void send(int code) { status = code; }
+};
+
+static Z906Controller controller("", 4, 5, 0);
+static HostServer server;
+static String bootTag;
+
+/** GET of the controller's state like serveState(), returns the status */
+static int get(Z906Controller& c, const String& ifNoneMatch = "") {
+  server = HostServer();
+  server.ifNoneMatch = ifNoneMatch;
+  if(notModified(server, makeETag(bootTag, String(c.stateVersion)))) return server.status;
+  return 200;
+}
+
+static bool drain(uint32_t limitMs = 10000) {
+  for(uint32_t ms = 0; ms < limitMs; ms++) {
+    controller.service();
+    if(!IRTransmitter::anyBusy()) return true;
+    hostAdvance(1000);
+  }
+  return false;
+}
+
+void setUp() {
+  digitalWrite(5, HIGH);
+  controller.checkIfStillOn();
+  TEST_ASSERT_TRUE(drain());
+}
+
+void tearDown() {}
+
+void test_matching_tag_is_not_modified() {
+  TEST_ASSERT_EQUAL(200, get(controller));
+  String etag = server.etag;
+  TEST_ASSERT_EQUAL('"', etag[0]);
+  TEST_ASSERT_EQUAL(304, get(controller, etag));
+  TEST_ASSERT_TRUE(etag == server.etag);
+  TEST_ASSERT_EQUAL(304, get(controller, "*"));
+  TEST_ASSERT_EQUAL(304, get(controller, "\"other-1\", " + etag));
+  TEST_ASSERT_EQUAL(304, get(controller, "W/" + etag));
+
+  // Version 1 is not in a tag for version 12
+  TEST_ASSERT_FALSE(etagMatches(makeETag(bootTag, "12"), makeETag(bootTag, "1")));
+  TEST_ASSERT_EQUAL(200, get(controller, "\"" + bootTag + "\""));
+}
+
+void test_state_change_changes_the_tag() {
+  get(controller);
+  String before = server.etag;
+
+  // Reading doesn't change anything
+  controller.handleJSONReq("{\"method\":\"getSettings\"}");
+  TEST_ASSERT_EQUAL(304, get(controller, before));
+
+  controller.handleJSONReq("{\"method\":\"setSettings\",\"soundlevel\":12}");
+  TEST_ASSERT_TRUE(drain());
+  TEST_ASSERT_EQUAL(200, get(controller, before));
+  String on = server.etag;
+  TEST_ASSERT_FALSE(before == on);
+  TEST_ASSERT_EQUAL(304, get(controller, on));
+
+  // The amp going off by itself changes it too
+  digitalWrite(5, LOW);
+  controller.checkIfStillOn();
+  TEST_ASSERT_EQUAL(200, get(controller, on));
+}
+
+/** The state version starts over after a reboot, the tag doesn't */
+void test_reboot_changes_the_tag() {
+  Z906Controller& first = *new Z906Controller("", 16, 5, 0);
+  first.begin(CLIENT_ROOT);
+  get(first);
+  String before = server.etag;
+
+  // Same EEPROM, same version
+  bootTag = newBootTag();
+  Z906Controller& rebooted = *new Z906Controller("", 16, 5, 0);
+  rebooted.begin(CLIENT_ROOT);
+  TEST_ASSERT_EQUAL_UINT32(first.stateVersion, rebooted.stateVersion);
+  TEST_ASSERT_EQUAL(200, get(rebooted, before));
+  TEST_ASSERT_FALSE(before == server.etag);
+}
+
+int main() {
+  EEPROM.begin(512);
+  LittleFS.begin();
+  bindings.begin();
+  bootTag = newBootTag();
+  controller.begin(CLIENT_ROOT);
+  UNITY_BEGIN();
+  RUN_TEST(test_matching_tag_is_not_modified);
+  RUN_TEST(test_state_change_changes_the_tag);
+  RUN_TEST(test_reboot_changes_the_tag);
+  return UNITY_END();
+}
@@ -0,0 +1,153 @@
+#include <unity.h>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <LittleFS.h>
+#include <esp8266_peri.h>
+
+#include "Z906Controller.h"
+
+/* Resets in the middle of a burst. EEPROM already holds where a command
+ * was going when it's sent, the RTC journal where the LED got to. A reset
+ * keeps both and loses RAM, so every boot here is a new controller over a
+ * copy of the RTC user memory and EEPROM taken mid-burst, while the
+ * original goes on to finish its burst like the amp saw it */
+
+#define CLIENT_ROOT     "speaker/logitech_z906"
+#define BOOT_IR_PIN     16  // No carrier there, a booted controller only loads
+#define EMITTED_BLOCK(slot) (JOURNAL_RTC_OFFSET + (slot) * JOURNAL_RTC_BLOCKS + 1)
+
+static Z906Controller controllers[] = {
+  Z906Controller("", 4, 0, 0),
+  Z906Controller("kitchen", 5, 1, 1),
+};
+
+struct Snapshot {
+  uint32_t rtc[HOST_RTC_USER_BLOCKS];
+  uint8_t eeprom[512];
+};
+static Snapshot snapshot;
+
+/** Runs the loop until nothing is on the air */
+static bool drain(uint32_t limitMs = 10000) {
+  for(uint32_t ms = 0; ms < limitMs; ms++) {
+    for(Z906Controller& controller : controllers) controller.service();
+    if(!IRTransmitter::anyBusy()) return true;
+    hostAdvance(1000);
+  }
+  return false;
+}
+
+/** Sends req to controller i and takes the snapshot once frames of it
+ *  have left the LED, then lets the burst finish */
+static void resetAfter(uint8_t i, const char* req, uint32_t frames) {
+  controllers[i].handleJSONReq(req);
+  while(ESP.rtcUserMemory[EMITTED_BLOCK(i)] < frames) hostAdvance(100);
+  memcpy(snapshot.rtc, (const void*)ESP.rtcUserMemory, sizeof(snapshot.rtc));
+  memcpy(snapshot.eeprom, EEPROM.bytes, sizeof(snapshot.eeprom));
+  TEST_ASSERT_TRUE(drain());
+}
+
+/** What a controller for slot believes after booting from the snapshot. It's
+ *  never destroyed, like the transmitter channels it would have taken */
+static Z906Controller& boot(uint8_t slot) {
+  memcpy((void*)ESP.rtcUserMemory, snapshot.rtc, sizeof(snapshot.rtc));
+  memcpy(EEPROM.bytes, snapshot.eeprom, sizeof(snapshot.eeprom));
+  Z906Controller* booted = new Z906Controller(slot ? "kitchen" : "", BOOT_IR_PIN, slot, slot);
+  booted->begin(CLIENT_ROOT);
+  return *booted;
+}
+
+static uint8_t savedLevel(uint8_t slot) {
+  return EEPROM.read(slot * EEPROM_SLOT_SIZE + SOUND_LEVEL_ADDR);
+}
+
+void setUp() {
+  for(uint8_t i = 0; i < 2; i++) {
+    digitalWrite(i, HIGH);
+    controllers[i].checkIfStillOn();
+    controllers[i].state.input = Input1;
+    for(uint8_t level = 0; level < 4; level++) controllers[i].state.soundLevel[level] = 20;
+    controllers[i].saveSettings();
+  }
+  TEST_ASSERT_TRUE(drain());
+}
+
+void tearDown() {}
+
+/** The EEPROM says 30, only 4 of the 10 Plus frames made it out */
+void test_boot_replays_the_frames_that_went_out() {
+  resetAfter(0, "{\"method\":\"setSettings\",\"soundlevel\":30}", 4);
+  TEST_ASSERT_EQUAL_UINT8(30, snapshot.eeprom[SOUND_LEVEL_ADDR]);
+
+  Z906Controller& booted = boot(0);
+  TEST_ASSERT_EQUAL_INT8(24, booted.state.soundLevel[0]);
+  TEST_ASSERT_EQUAL_INT8(20, booted.state.soundLevel[1]);
+  TEST_ASSERT_EQUAL(Input1, booted.state.input);
+  // Saved over the EEPROM and committed, the next boot takes it from there
+  TEST_ASSERT_EQUAL_UINT8(24, savedLevel(0));
+  memcpy(snapshot.rtc, (const void*)ESP.rtcUserMemory, sizeof(snapshot.rtc));
+  memcpy(snapshot.eeprom, EEPROM.bytes, sizeof(snapshot.eeprom));
+  TEST_ASSERT_EQUAL_INT8(24, boot(0).state.soundLevel[0]);
+}
+
+/** Steps of several keys replay in order, the input switch before the levels */
+void test_boot_replays_across_steps() {
+  resetAfter(0, "{\"method\":\"setSettings\",\"input\":\"Input 2\",\"soundlevel\":17}", 3);
+  Z906Controller& booted = boot(0);
+  TEST_ASSERT_EQUAL(Input2, booted.state.input);
+  TEST_ASSERT_EQUAL_INT8(18, booted.state.soundLevel[0]);
+}
+
+/** A reset after the burst finished and was committed replays nothing */
+void test_committed_journal_leaves_the_eeprom() {
+  controllers[0].handleJSONReq("{\"method\":\"setSettings\",\"soundlevel\":30}");
+  TEST_ASSERT_TRUE(drain());
+  memcpy(snapshot.rtc, (const void*)ESP.rtcUserMemory, sizeof(snapshot.rtc));
+  memcpy(snapshot.eeprom, EEPROM.bytes, sizeof(snapshot.eeprom));
+  TEST_ASSERT_EQUAL_INT8(30, boot(0).state.soundLevel[0]);
+}
+
+/** A record whose checksum doesn't hold, e.g. power lost while it was being
+ *  written, is thrown away and the EEPROM is what we believe */
+void test_torn_journal_is_ignored() {
+  resetAfter(0, "{\"method\":\"setSettings\",\"soundlevel\":30}", 4);
+  snapshot.rtc[JOURNAL_RTC_OFFSET + 3] ^= 0x00010000;
+
+  Z906Controller& booted = boot(0);
+  TEST_ASSERT_EQUAL_INT8(30, booted.state.soundLevel[0]);
+  TEST_ASSERT_EQUAL_UINT8(30, savedLevel(0));
+  // Started over: valid again and empty
+  memcpy(snapshot.rtc, (const void*)ESP.rtcUserMemory, sizeof(snapshot.rtc));
+  TEST_ASSERT_EQUAL_INT8(30, boot(0).state.soundLevel[0]);
+}
+
+/** Another slot's record, or whatever power on leaves in RTC memory, isn't
+ *  taken for this slot's */
+void test_foreign_journal_is_ignored() {
+  resetAfter(1, "{\"method\":\"setSettings\",\"soundlevel\":10}", 4);
+  memcpy(snapshot.rtc + JOURNAL_RTC_OFFSET, snapshot.rtc + JOURNAL_RTC_OFFSET + JOURNAL_RTC_BLOCKS, JOURNAL_RTC_BLOCKS * 4);
+  TEST_ASSERT_EQUAL_INT8(20, boot(0).state.soundLevel[0]);
+
+  // The record is valid where it belongs
+  resetAfter(1, "{\"method\":\"setSettings\",\"soundlevel\":20}", 4);
+  TEST_ASSERT_EQUAL_INT8(14, boot(1).state.soundLevel[0]);
+
+  for(uint32_t i = 0; i < HOST_RTC_USER_BLOCKS; i++) snapshot.rtc[i] = 0x9E3779B9 * (i + 1);
+  TEST_ASSERT_EQUAL_INT8(20, boot(0).state.soundLevel[0]);
+  TEST_ASSERT_EQUAL_INT8(20, boot(1).state.soundLevel[0]);
+}
+
+int main() {
+  EEPROM.begin(sizeof(snapshot.eeprom));
+  LittleFS.begin();
+  bindings.begin();
+  for(Z906Controller& controller : controllers) controller.begin(CLIENT_ROOT);
+  UNITY_BEGIN();
+  RUN_TEST(test_boot_replays_the_frames_that_went_out);
+  RUN_TEST(test_boot_replays_across_steps);
+  RUN_TEST(test_committed_journal_leaves_the_eeprom);
+  RUN_TEST(test_torn_journal_is_ignored);
+  RUN_TEST(test_foreign_journal_is_ignored);
+  return UNITY_END();
+}
@@ -0,0 +1,218 @@
+#include <unity.h>
+#include <vector>
+
+#include <Arduino.h>
+#include <esp8266_peri.h>
+
+#include "IRTransmitter.h"
+#include "Z906Journal.h"
+
+/* One transmitter per amp, all sharing timer0. The host core folds the
+ * carrier written to every pin back into marks and spaces and each pin is
+ * decoded on its own, the way the amp in front of that LED would see it */
+
+static const uint8_t pins[IR_TX_MAX_CHANNELS] = { 4, 5, 12, 13 };
+static IRTransmitter amps[IR_TX_MAX_CHANNELS] = { IRTransmitter(4), IRTransmitter(5), IRTransmitter(12), IRTransmitter(13) };
+
+/** Runs the clock until every transmitter is idle, false if one never is */
+static bool drain(uint32_t limitMs = 5000) {
+  for(uint32_t ms = 0; ms < limitMs; ms++) {
+    if(!IRTransmitter::anyBusy()) return true;
+    hostAdvance(1000);
+  }
+  return !IRTransmitter::anyBusy();
+}
+
+/** The codes (NEC_REPEAT for repeat frames) the edges on pin decode to */
+static std::vector<uint32_t> decodePin(uint8_t pin) {
+  NecDecoder decoder;
+  std::vector<uint32_t> codes;
+  uint64_t last = 0;
+  bool mark = false;
+  for(const HostEdge& edge : hostWaveform[pin]) {
+    decoder.feed((edge.at - last) / clockCyclesPerMicrosecond(), mark);
+    if(decoder.available()) codes.push_back(decoder.read());
+    last = edge.at;
+    mark = edge.mark;
+  }
+  decoder.feed(20000, false);
+  if(decoder.available()) codes.push_back(decoder.read());
+  return codes;
+}
+
+static uint64_t firstEdge(uint8_t pin) { return hostWaveform[pin].front().at; }
+
+void setUp() {
+  for(IRTransmitter& amp : amps) TEST_ASSERT_TRUE(amp.begin());
+  drain();
+  for(HostEdges& edges : hostWaveform) edges.clear();
+}
+
+void tearDown() {}
+
+void test_amps_send_at_the_same_time() {
+  const uint32_t codes[IR_TX_MAX_CHANNELS] = { POWER_IR, PLUS_IR, MINUS_IR, MUTE_IR };
+  uint64_t start = hostClock.cycles;
+  for(uint8_t i = 0; i < IR_TX_MAX_CHANNELS; i++) TEST_ASSERT_TRUE(amps[i].send(codes[i]));
+  TEST_ASSERT_TRUE(drain());
+
+  for(uint8_t i = 0; i < IR_TX_MAX_CHANNELS; i++) {
+    std::vector<uint32_t> decoded = decodePin(pins[i]);
+    TEST_ASSERT_EQUAL_UINT32(1, decoded.size());
+    TEST_ASSERT_EQUAL_HEX32(codes[i], decoded[0]);
+    // Interleaved, so every frame starts right away instead of after the others
+    TEST_ASSERT_LESS_THAN(microsecondsToClockCycles(50), firstEdge(pins[i]) - start);
+  }
+}
+
+void test_bursts_with_repeats_and_gaps() {
+  amps[0].send(PLUS_IR, 3, 50);
+  amps[0].send(MINUS_IR, 2);
+  amps[1].send(INPUT1_IR);
+  amps[1].sendRepeat(4);
+  amps[2].send(POWER_IR, 0, 200);
+  amps[2].send(POWER_IR);
+  TEST_ASSERT_TRUE(drain());
+
+  std::vector<uint32_t> expected0 = { PLUS_IR, NEC_REPEAT, NEC_REPEAT, NEC_REPEAT, MINUS_IR, NEC_REPEAT, NEC_REPEAT };
+  std::vector<uint32_t> expected1 = { INPUT1_IR, NEC_REPEAT, NEC_REPEAT, NEC_REPEAT, NEC_REPEAT };
+  std::vector<uint32_t> expected2 = { POWER_IR, POWER_IR };
+  TEST_ASSERT_TRUE(decodePin(pins[0]) == expected0);
+  TEST_ASSERT_TRUE(decodePin(pins[1]) == expected1);
+  TEST_ASSERT_TRUE(decodePin(pins[2]) == expected2);
+  TEST_ASSERT_TRUE(hostWaveform[pins[3]].empty());
+
+  // Frames are padded to the NEC period and the gap comes on top
+  uint64_t period = microsecondsToClockCycles(NEC_FRAME_PERIOD);
+  uint64_t gap = microsecondsToClockCycles(200000);
+  uint64_t secondStart = hostWaveform[pins[2]][NEC_FRAME_LENGTH + 1].at;
+  TEST_ASSERT_LESS_THAN(microsecondsToClockCycles(50), secondStart - firstEdge(pins[2]) - period - gap);
+}
+
+/** Every mark is a 38 kHz carrier that starts high, on all LEDs at once */
+void test_marks_carry_the_carrier() {
+  const uint32_t codes[IR_TX_MAX_CHANNELS] = { POWER_IR, EFFECT_IR, AUX_IR, TEST_IR };
+  uint32_t before[IR_TX_MAX_CHANNELS];
+  for(uint8_t i = 0; i < IR_TX_MAX_CHANNELS; i++) {
+    before[i] = hostCarrierPulses[pins[i]];
+    TEST_ASSERT_TRUE(amps[i].send(codes[i]));
+  }
+  TEST_ASSERT_TRUE(drain());
+
+  for(uint8_t i = 0; i < IR_TX_MAX_CHANNELS; i++) {
+    const NecWaveform* waveform = findNecWaveform(codes[i]);
+    uint32_t periods = 0;
+    for(uint8_t s = 0; s < NEC_FRAME_LENGTH; s += 2) {
+      // A high due closer than 5 µs (IR_TX_MIN_ARM) to the end of its mark ends with it
+      uint16_t room = waveform->timings[s] - 5;
+      periods += (room + NEC_CARRIER_HIGH + NEC_CARRIER_LOW - 1) / (NEC_CARRIER_HIGH + NEC_CARRIER_LOW);
+    }
+    TEST_ASSERT_EQUAL_UINT32(periods, hostCarrierPulses[pins[i]] - before[i]);
+    TEST_ASSERT_EQUAL_UINT32(NEC_FRAME_LENGTH + 1, hostWaveform[pins[i]].size());
+    TEST_ASSERT_EQUAL(LOW, digitalRead(pins[i]));
+  }
+}
+
+/** Sending never waits for the interrupt, a full queue refuses instead */
+void test_a_full_queue_refuses_without_waiting() {
+  uint64_t start = hostClock.cycles;
+  uint8_t accepted = 0;
+  while(amps[3].send(EFFECT_IR, 0, 20, 2)) accepted++;
+  TEST_ASSERT_TRUE(hostClock.cycles == start);
+  // The first press is on the air already, its slot is free again
+  TEST_ASSERT_EQUAL_UINT8(IR_TX_QUEUE_SIZE, accepted);
+  TEST_ASSERT_EQUAL_UINT8(0, amps[3].room());
+  TEST_ASSERT_EQUAL_UINT32(1, amps[3].refused);
+  TEST_ASSERT_TRUE(drain(20000));
+
+  std::vector<uint32_t> decoded = decodePin(pins[3]);
+  TEST_ASSERT_EQUAL_UINT32(2 * accepted, decoded.size());
+  for(uint32_t code : decoded) TEST_ASSERT_EQUAL_HEX32(EFFECT_IR, code);
+  TEST_ASSERT_EQUAL_UINT8(IR_TX_QUEUE_SIZE - 1, amps[3].room());
+}
+
+void test_frame_counters_follow_each_amp() {
+  uint32_t before[IR_TX_MAX_CHANNELS];
+  for(uint8_t i = 0; i < IR_TX_MAX_CHANNELS; i++) {
+    before[i] = amps[i].framesSent;
+    amps[i].send(PLUS_IR, i);
+  }
+  TEST_ASSERT_TRUE(drain());
+  for(uint8_t i = 0; i < IR_TX_MAX_CHANNELS; i++) TEST_ASSERT_EQUAL_UINT32(i + 1, amps[i].framesSent - before[i]);
+}
+
+void test_a_fifth_transmitter_is_refused() {
+  IRTransmitter fifth(14);
+  TEST_ASSERT_FALSE(fifth.begin());
+  TEST_ASSERT_FALSE(fifth.send(POWER_IR));
+  fifth.sendRepeat(3);
+  TEST_ASSERT_FALSE(fifth.busy());
+  TEST_ASSERT_FALSE(IRTransmitter::anyBusy());
+  TEST_ASSERT_TRUE(hostWaveform[14].empty());
+
+  // The others keep going
+  amps[3].send(MUTE_IR);
+  TEST_ASSERT_TRUE(drain());
+  TEST_ASSERT_EQUAL_HEX32(MUTE_IR, decodePin(pins[3]).at(0));
+}
+
+void test_journal_slots_stay_in_rtc_memory() {
+  uint32_t refused = ESP.rtcRefused;
+  Z906Journal last(JOURNAL_SLOTS - 1);
+  last.begin(amps[3]);
+  TEST_ASSERT_EQUAL_UINT32(refused, ESP.rtcRefused);
+  TEST_ASSERT_TRUE(amps[3].frameCounter < ESP.rtcUserMemory + HOST_RTC_USER_BLOCKS);
+
+  // Every frame sent lands in the slot's RTC counter
+  Z906State state = {};
+  last.record(state, PLUS_IR, 3, true);
+  amps[3].send(PLUS_IR, 2);
+  TEST_ASSERT_TRUE(drain());
+  TEST_ASSERT_EQUAL_UINT32(3, *amps[3].frameCounter);
+
+  IRTransmitter spare(15);
+  Z906Journal past(JOURNAL_SLOTS);
+  past.begin(spare);
+  past.record(state, PLUS_IR, 3, true);
+  TEST_ASSERT_NULL(spare.frameCounter);
+  TEST_ASSERT_FALSE(past.open());
+  TEST_ASSERT_EQUAL_UINT32(refused, ESP.rtcRefused);
+}
+
+/** A burst longer than the journal folds what is on the air into its base */
+void test_a_full_journal_folds_what_was_sent() {
+  Z906Journal journal(0);
+  journal.begin(amps[0]);
+  Z906State state = {};
+  state.mode = On;
+  state.soundLevel[0] = 10;
+  uint32_t sentBefore = amps[0].framesSent;
+  // Queued faster than they go out, so the transmitter never idles
+  uint8_t presses = JOURNAL_SIZE + JOURNAL_SIZE / 2;
+  for(uint8_t i = 0; i < presses; i++) {
+    journal.record(state, PLUS_IR, 1, !amps[0].busy());
+    TEST_ASSERT_TRUE(amps[0].send(PLUS_IR, 0, 400));
+    hostAdvance(300000);
+  }
+  TEST_ASSERT_TRUE(amps[0].busy());
+  Z906State replayed;
+  TEST_ASSERT_TRUE(journal.replay(replayed));
+  TEST_ASSERT_EQUAL_INT8(10 + amps[0].framesSent - sentBefore, replayed.soundLevel[0]);
+
+  TEST_ASSERT_TRUE(drain(30000));
+  TEST_ASSERT_TRUE(journal.replay(replayed));
+  TEST_ASSERT_EQUAL_INT8(10 + presses, replayed.soundLevel[0]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_amps_send_at_the_same_time);
+  RUN_TEST(test_bursts_with_repeats_and_gaps);
+  RUN_TEST(test_marks_carry_the_carrier);
+  RUN_TEST(test_a_full_queue_refuses_without_waiting);
+  RUN_TEST(test_frame_counters_follow_each_amp);
+  RUN_TEST(test_a_fifth_transmitter_is_refused);
+  RUN_TEST(test_journal_slots_stay_in_rtc_memory);
+  RUN_TEST(test_a_full_journal_folds_what_was_sent);
+  return UNITY_END();
+}
@@ -0,0 +1,85 @@
+#include <unity.h>
+#include <stdio.h>
+#include <chrono>
+
+#include <IRrecv.h>
+
+#include "NecDecoder.hpp"
+#include "../test_nec_decoder/corpus.h"
+
+/* The NecDecoder against the path it replaces, IRremoteESP8266's own
+ * IRrecv::decode() trying every protocol it was built with, the way
+ * handleIR() called it. The library builds for the host with UNIT_TEST,
+ * see env:native_irrecv: pio test -e native_irrecv */
+
+#define BENCH_ROUNDS    2000
+#define BENCH_SPEEDUP   2     // At least this many times less CPU per capture than decode()
+
+static IRrecv irrecv(0, 2 * NEC_BITS + 8);
+static uint16_t rawbuf[2 * NEC_BITS + 8];
+static decode_results results;
+
+/** What the receive interrupt leaves in rawbuf, in kRawTick units after the
+ *  gap, and decode() over it. 0 when it isn't an NEC frame */
+static uint32_t irrecvDecode(const uint16_t* raw, uint16_t length) {
+  rawbuf[0] = 0;
+  for(uint16_t i = 0; i < length; i++) rawbuf[i + 1] = raw[i] / kRawTick;
+  results.rawbuf = rawbuf;
+  results.rawlen = length + 1;
+  results.overflow = false;
+  if(!irrecv.decode(&results) || results.decode_type != NEC) return 0;
+  return results.repeat ? NEC_REPEAT : (uint32_t)results.value;
+}
+
+/** Feeds a capture to the NecDecoder edge by edge, 0 when nothing was latched */
+static uint32_t necDecode(NecDecoder& decoder, const uint16_t* raw, uint16_t length) {
+  for(uint16_t i = 0; i < length; i++) decoder.feed(raw[i], i % 2 == 0);
+  decoder.feed(20000, false); // The gap after the frame
+  return decoder.available() ? decoder.read() : 0;
+}
+
+void setUp() {}
+void tearDown() {}
+
+/** The library takes the same frames as the NecDecoder */
+void test_irrecv_agrees_on_the_corpus() {
+  char message[96];
+  for(const CorpusEntry& entry : corpus) {
+    snprintf(message, sizeof(message), "IRrecv on %s", entry.name);
+    TEST_ASSERT_EQUAL_HEX32_MESSAGE(entry.expected, irrecvDecode(entry.raw, entry.length), message);
+  }
+}
+
+/** Host CPU time to decode the whole corpus both ways. On the board the
+ *  NecDecoder work is spread over the edge interrupts, decode() runs in
+ *  loop() once the capture timed out */
+void test_decoder_beats_irrecv() {
+  NecDecoder decoder;
+  volatile uint32_t sink = 0;
+  size_t captures = sizeof(corpus) / sizeof(corpus[0]);
+
+  auto start = std::chrono::steady_clock::now();
+  for(int r = 0; r < BENCH_ROUNDS; r++) {
+    for(const CorpusEntry& entry : corpus) sink = sink + necDecode(decoder, entry.raw, entry.length);
+  }
+  auto middle = std::chrono::steady_clock::now();
+  for(int r = 0; r < BENCH_ROUNDS; r++) {
+    for(const CorpusEntry& entry : corpus) sink = sink + irrecvDecode(entry.raw, entry.length);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  double necNs = std::chrono::duration<double, std::nano>(middle - start).count() / (BENCH_ROUNDS * captures);
+  double irrecvNs = std::chrono::duration<double, std::nano>(end - middle).count() / (BENCH_ROUNDS * captures);
+  char message[96];
+  snprintf(message, sizeof(message), "NecDecoder %.0f ns/capture, IRrecv::decode() %.0f ns/capture, %.1fx",
+    necNs, irrecvNs, irrecvNs / necNs);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE_MESSAGE(necNs * BENCH_SPEEDUP < irrecvNs, message);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_irrecv_agrees_on_the_corpus);
+  RUN_TEST(test_decoder_beats_irrecv);
+  return UNITY_END();
+}
@@ -0,0 +1,119 @@
+#ifndef NEC_CORPUS_H_
+#define NEC_CORPUS_H_
+
+#include <stdint.h>
+
+#include "NecDecoder.hpp"
+#include "LogitechIRCodes.h"
+
+/**
+ * Captures in the format IRrecvDumpV2 prints (µs, mark first, the gap before
+ * the frame left out), so dumps taken with it on the board can be pasted in
+ * as they are. The entries below are synthetic, not recorded: they are
+ * generated from how TSOP type receivers distort NEC (marks stretched,
+ * spaces shrunk, or the other way round for a weak signal), oscillator
+ * error of the remote and 2 µs capture ticks, with ±30 µs of jitter. That
+ * way every case the windows have to get right is in there on purpose, which
+ * a few minutes of dumps from one remote in one room wouldn't give.
+ * expected is the value both decoders must report, 0 for captures that hold
+ * no NEC frame.
+ */
+struct CorpusEntry {
+  const char* name;
+  const uint16_t* raw;
+  uint16_t length;
+  uint32_t expected;
+};
+
+// Receiver close to the remote, marks stretched and spaces shrunk by about 50-100
+static const uint16_t typicalPower[67] = {9046, 4454, 652, 460, 648, 1602, 626, 476, 636, 464, 614, 462, 660, 494, 632, 480, 660, 498, 652, 486, 606, 494, 648, 512, 610, 494, 636, 482, 622, 1620, 634, 472, 658, 1588, 628, 502, 608, 468, 622, 460, 626, 504, 622, 506, 662, 512, 662, 482, 644, 1588, 628, 1622, 616, 1614, 610, 1634, 662, 1600, 608, 1588, 654, 1616, 644, 1598, 646, 492, 618};  // NEC 400501FE
+static const uint16_t typicalPlus[67] = {9090, 4396, 610, 500, 642, 1610, 628, 510, 624, 488, 650, 500, 628, 484, 650, 466, 656, 462, 646, 508, 662, 514, 662, 514, 656, 500, 616, 462, 628, 1608, 656, 510, 624, 1636, 648, 506, 652, 1606, 642, 506, 642, 1590, 622, 484, 660, 1594, 646, 474, 626, 1596, 614, 1598, 664, 498, 614, 1642, 642, 514, 634, 1626, 640, 502, 646, 1630, 622, 466, 652};  // NEC 400555AA
+static const uint16_t typicalMinus[67] = {9068, 4398, 660, 466, 628, 1634, 660, 500, 614, 502, 636, 508, 642, 498, 642, 500, 636, 500, 608, 492, 628, 460, 614, 496, 624, 494, 622, 500, 652, 1606, 646, 494, 654, 1642, 654, 480, 646, 1638, 618, 506, 608, 1590, 652, 490, 654, 1594, 644, 1622, 650, 490, 622, 1618, 634, 514, 646, 1608, 614, 476, 620, 1608, 624, 480, 650, 474, 632, 1608, 642};  // NEC 400556A9
+static const uint16_t typicalInput1[67] = {9064, 4430, 646, 466, 628, 1588, 658, 498, 650, 466, 620, 480, 660, 462, 640, 492, 636, 476, 660, 502, 658, 458, 606, 474, 622, 484, 632, 490, 648, 1640, 664, 504, 610, 1588, 622, 514, 662, 476, 608, 1602, 606, 478, 616, 504, 650, 502, 626, 468, 648, 510, 626, 1630, 636, 1600, 632, 470, 638, 1600, 644, 1612, 618, 1586, 638, 1592, 612, 1640, 644};  // NEC 400520DF
+static const uint16_t typicalMute[67] = {9052, 4436, 628, 458, 662, 1628, 634, 510, 648, 488, 630, 502, 634, 506, 616, 496, 662, 456, 632, 500, 636, 508, 610, 496, 650, 460, 662, 482, 656, 1642, 632, 506, 606, 1614, 606, 464, 656, 1624, 612, 494, 644, 1642, 638, 514, 646, 1614, 618, 1596, 636, 1598, 656, 1614, 632, 484, 616, 1604, 616, 468, 650, 1586, 622, 482, 640, 484, 644, 468, 610};  // NEC 400557A8
+static const uint16_t typicalLevel[67] = {9048, 4418, 634, 472, 652, 1630, 660, 512, 650, 490, 660, 484, 652, 468, 664, 488, 606, 510, 628, 514, 618, 464, 610, 480, 662, 472, 644, 510, 618, 1606, 624, 508, 610, 1640, 624, 498, 618, 1636, 660, 508, 660, 1632, 624, 504, 630, 498, 658, 482, 612, 458, 660, 1616, 636, 466, 660, 1644, 636, 490, 648, 1616, 622, 1598, 638, 1600, 610, 1624, 626};  // NEC 400550AF
+static const uint16_t typicalRepeat[3] = {9068, 2158, 656};  // NEC repeat
+
+// Weak signal across the room, the AGC cuts marks short
+static const uint16_t farPower[67] = {8974, 4570, 518, 592, 524, 1734, 492, 578, 526, 606, 510, 596, 494, 602, 492, 582, 536, 594, 502, 612, 518, 584, 508, 634, 502, 626, 500, 618, 516, 1740, 538, 592, 534, 1758, 502, 628, 490, 628, 490, 588, 538, 602, 494, 610, 520, 580, 518, 608, 492, 1756, 506, 1724, 516, 1740, 502, 1748, 488, 1738, 508, 1752, 504, 1756, 534, 1724, 514, 582, 490};  // NEC 400501FE
+static const uint16_t farPlus[67] = {8930, 4526, 526, 584, 518, 1708, 530, 622, 532, 590, 496, 582, 516, 588, 492, 582, 530, 630, 510, 604, 504, 616, 540, 608, 506, 630, 510, 588, 534, 1720, 526, 610, 498, 1710, 506, 600, 506, 1734, 486, 612, 496, 1732, 532, 594, 524, 1720, 500, 626, 532, 1714, 530, 1762, 540, 612, 540, 1718, 516, 622, 516, 1742, 502, 626, 506, 1738, 530, 618, 526};  // NEC 400555AA
+static const uint16_t farMinus[67] = {8978, 4540, 540, 616, 486, 1750, 532, 616, 534, 580, 492, 592, 530, 594, 496, 586, 494, 618, 492, 620, 538, 622, 524, 598, 544, 604, 492, 584, 528, 1744, 496, 618, 534, 1760, 516, 630, 512, 1750, 534, 582, 514, 1712, 538, 608, 512, 1722, 504, 1750, 520, 600, 488, 1708, 498, 602, 544, 1744, 518, 632, 506, 1732, 534, 628, 488, 598, 496, 1718, 520};  // NEC 400556A9
+static const uint16_t farInput1[67] = {8972, 4518, 516, 594, 520, 1758, 506, 608, 486, 584, 526, 632, 496, 586, 540, 626, 526, 582, 528, 614, 534, 588, 542, 634, 518, 602, 486, 626, 526, 1708, 490, 588, 538, 1714, 520, 612, 500, 624, 522, 1732, 516, 622, 522, 614, 502, 594, 508, 594, 504, 634, 530, 1720, 490, 1728, 526, 588, 488, 1714, 522, 1736, 508, 1712, 510, 1716, 528, 1742, 528};  // NEC 400520DF
+static const uint16_t farMute[67] = {8982, 4520, 502, 604, 536, 1722, 498, 584, 508, 606, 502, 580, 510, 576, 516, 592, 486, 628, 518, 606, 510, 626, 498, 622, 532, 620, 502, 578, 486, 1728, 490, 630, 530, 1738, 514, 626, 516, 1730, 508, 594, 518, 1752, 516, 628, 514, 1752, 518, 1716, 490, 1724, 496, 1726, 540, 576, 494, 1746, 498, 610, 492, 1706, 522, 584, 490, 590, 508, 614, 506};  // NEC 400557A8
+static const uint16_t farLevel[67] = {8952, 4542, 522, 610, 506, 1708, 506, 576, 512, 602, 520, 618, 530, 612, 522, 608, 494, 628, 486, 612, 544, 584, 540, 588, 498, 632, 520, 596, 518, 1714, 510, 602, 514, 1750, 506, 622, 520, 1738, 500, 588, 524, 1752, 524, 618, 534, 618, 542, 578, 520, 590, 520, 1738, 534, 610, 508, 1742, 528, 634, 514, 1726, 498, 1730, 492, 1758, 534, 1756, 502};  // NEC 400550AF
+static const uint16_t farRepeat[3] = {8954, 2308, 530};  // NEC repeat
+
+// Remote oscillator 4 % slow, plus the usual stretch
+static const uint16_t slowRemotePower[67] = {9446, 4618, 636, 530, 656, 1704, 648, 524, 656, 496, 622, 530, 654, 520, 658, 548, 616, 502, 628, 528, 634, 498, 656, 506, 658, 532, 646, 514, 628, 1688, 638, 536, 616, 1718, 622, 530, 626, 510, 624, 526, 616, 530, 626, 516, 642, 526, 614, 536, 648, 1678, 656, 1722, 656, 1684, 620, 1700, 618, 1712, 636, 1718, 618, 1698, 638, 1694, 614, 520, 624};  // NEC 400501FE
+static const uint16_t slowRemotePlus[67] = {9444, 4606, 672, 526, 652, 1684, 670, 544, 616, 526, 656, 530, 664, 530, 642, 496, 656, 538, 664, 522, 626, 518, 656, 542, 636, 538, 634, 532, 650, 1686, 614, 546, 642, 1692, 664, 510, 634, 1696, 614, 508, 628, 1680, 672, 548, 638, 1704, 648, 542, 620, 1712, 656, 1694, 644, 498, 658, 1720, 640, 524, 626, 1670, 632, 496, 632, 1670, 650, 532, 646};  // NEC 400555AA
+static const uint16_t slowRemoteMinus[67] = {9444, 4614, 626, 528, 624, 1686, 622, 502, 670, 500, 622, 522, 670, 540, 644, 508, 664, 512, 642, 504, 650, 520, 636, 532, 620, 510, 636, 528, 660, 1690, 652, 522, 664, 1726, 648, 538, 658, 1718, 650, 528, 632, 1686, 634, 534, 648, 1694, 670, 1714, 642, 552, 620, 1680, 660, 542, 644, 1676, 650, 506, 640, 1674, 648, 548, 646, 512, 630, 1698, 638};  // NEC 400556A9
+static const uint16_t slowRemoteInput1[67] = {9400, 4608, 618, 500, 628, 1674, 640, 508, 626, 540, 618, 502, 664, 546, 620, 502, 632, 528, 664, 506, 618, 518, 666, 508, 630, 502, 668, 500, 636, 1702, 624, 530, 660, 1694, 644, 494, 654, 514, 646, 1724, 650, 500, 656, 500, 614, 530, 616, 508, 650, 536, 654, 1668, 672, 1716, 672, 498, 634, 1726, 666, 1684, 630, 1692, 616, 1682, 666, 1686, 618};  // NEC 400520DF
+static const uint16_t slowRemoteMute[67] = {9394, 4636, 664, 518, 636, 1722, 660, 536, 614, 510, 660, 542, 630, 494, 614, 498, 658, 512, 660, 504, 640, 494, 652, 522, 626, 526, 672, 544, 632, 1720, 652, 494, 668, 1686, 644, 532, 644, 1670, 614, 526, 640, 1718, 642, 522, 622, 1678, 618, 1680, 622, 1702, 668, 1698, 622, 526, 646, 1690, 654, 518, 656, 1706, 660, 522, 642, 498, 634, 540, 616};  // NEC 400557A8
+static const uint16_t slowRemoteLevel[67] = {9396, 4608, 666, 522, 660, 1706, 650, 540, 616, 504, 642, 510, 662, 498, 656, 516, 626, 506, 648, 526, 658, 534, 616, 524, 652, 540, 666, 514, 620, 1710, 626, 544, 666, 1718, 620, 550, 672, 1694, 632, 534, 656, 1706, 642, 526, 666, 548, 662, 504, 650, 520, 640, 1676, 636, 542, 664, 1690, 644, 526, 616, 1714, 666, 1674, 660, 1676, 632, 1702, 654};  // NEC 400550AF
+static const uint16_t slowRemoteRepeat[3] = {9434, 2288, 630};  // NEC repeat
+
+// Remote oscillator 4 % fast, plus the usual stretch
+static const uint16_t fastRemotePower[67] = {8684, 4278, 600, 462, 608, 1566, 626, 492, 588, 480, 592, 466, 626, 490, 592, 454, 624, 474, 620, 478, 618, 474, 580, 454, 588, 462, 622, 468, 584, 1562, 594, 482, 604, 1590, 616, 448, 598, 466, 626, 474, 624, 470, 618, 460, 586, 470, 584, 474, 626, 1546, 624, 1590, 576, 1540, 568, 1570, 628, 1542, 616, 1586, 624, 1584, 570, 1540, 592, 504, 572};  // NEC 400501FE
+static const uint16_t fastRemotePlus[67] = {8674, 4240, 588, 458, 600, 1582, 598, 492, 578, 504, 602, 500, 612, 462, 584, 486, 578, 450, 622, 458, 584, 458, 588, 502, 608, 452, 574, 500, 608, 1586, 616, 468, 580, 1570, 590, 460, 600, 1552, 628, 494, 612, 1566, 582, 478, 578, 1590, 592, 506, 624, 1538, 568, 1584, 578, 482, 572, 1546, 618, 498, 606, 1568, 590, 476, 590, 1588, 596, 484, 578};  // NEC 400555AA
+static const uint16_t fastRemoteMinus[67] = {8708, 4276, 570, 506, 590, 1582, 604, 458, 616, 498, 628, 492, 626, 504, 602, 494, 606, 502, 570, 474, 622, 476, 620, 496, 626, 470, 614, 490, 600, 1566, 590, 484, 590, 1552, 598, 504, 596, 1562, 608, 478, 574, 1568, 606, 480, 604, 1578, 598, 1590, 608, 478, 618, 1580, 598, 454, 608, 1554, 622, 462, 628, 1578, 598, 490, 574, 490, 602, 1590, 600};  // NEC 400556A9
+static const uint16_t fastRemoteInput1[67] = {8708, 4282, 616, 466, 590, 1544, 608, 500, 602, 460, 578, 470, 596, 460, 622, 488, 600, 448, 592, 502, 578, 478, 586, 454, 616, 488, 598, 456, 568, 1552, 612, 484, 588, 1556, 608, 496, 582, 472, 578, 1574, 596, 454, 584, 494, 594, 458, 606, 494, 600, 474, 588, 1552, 578, 1578, 592, 476, 574, 1566, 586, 1574, 600, 1540, 598, 1536, 570, 1578, 588};  // NEC 400520DF
+static const uint16_t fastRemoteMute[67] = {8672, 4290, 606, 486, 620, 1550, 608, 464, 588, 468, 604, 490, 626, 488, 578, 466, 580, 498, 614, 500, 578, 464, 592, 470, 616, 476, 616, 504, 576, 1588, 620, 460, 610, 1548, 596, 498, 578, 1538, 572, 458, 588, 1546, 576, 448, 622, 1556, 592, 1590, 598, 1546, 622, 1548, 590, 496, 626, 1592, 576, 470, 608, 1564, 624, 466, 610, 454, 588, 496, 606};  // NEC 400557A8
+static const uint16_t fastRemoteLevel[67] = {8720, 4256, 580, 474, 588, 1588, 602, 494, 588, 482, 616, 492, 606, 508, 620, 494, 622, 484, 588, 452, 582, 460, 600, 462, 600, 494, 616, 480, 578, 1578, 568, 482, 612, 1560, 568, 472, 624, 1552, 610, 482, 598, 1550, 596, 500, 626, 476, 606, 450, 606, 504, 572, 1564, 624, 466, 626, 1538, 624, 494, 620, 1540, 622, 1582, 590, 1576, 584, 1582, 622};  // NEC 400550AF
+static const uint16_t fastRemoteRepeat[3] = {8676, 2074, 568};  // NEC repeat
+
+// Single segments at the edges of what IRrecv accepts
+static const uint16_t zeroSpace600[67] = {9000, 4500, 560, 600, 560, 1690, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560};  // zero space 600
+static const uint16_t zeroSpace636[67] = {9000, 4500, 560, 636, 560, 1690, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560};  // zero space 636, IRrecv's upper edge
+static const uint16_t bitMark480[67] = {9000, 4500, 480, 560, 560, 1690, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560};  // bit mark 480
+static const uint16_t zeroSpace700[67] = {9000, 4500, 560, 700, 560, 1690, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560};  // zero space 700, neither zero nor one
+static const uint16_t headerSpace3000[67] = {9000, 3000, 560, 560, 560, 1690, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560};  // header space 3000
+
+// Noise and other protocols, none of it is an NEC frame
+static const uint16_t fluorescent[40] = {226, 246, 320, 244, 190, 264, 364, 160, 186, 182, 436, 234, 238, 342, 310, 324, 152, 420, 364, 280, 350, 232, 326, 412, 150, 216, 170, 240, 392, 428, 222, 292, 382, 288, 210, 370, 234, 232, 436, 420};  // short flicker bursts
+static const uint16_t truncated[42] = {9074, 4450, 608, 476, 610, 1626, 634, 512, 656, 514, 612, 490, 632, 466, 664, 476, 616, 492, 612, 500, 606, 456, 642, 506, 608, 484, 644, 484, 632, 1634, 656, 472, 664, 1612, 662, 490, 622, 468, 624, 482, 644, 462};  // frame cut after 20 bits
+static const uint16_t samsung[67] = {4560, 4440, 620, 1630, 620, 1630, 620, 1630, 620, 500, 620, 500, 620, 500, 620, 500, 620, 500, 620, 1630, 620, 1630, 620, 1630, 620, 500, 620, 500, 620, 500, 620, 500, 620, 500, 620, 500, 620, 1630, 620, 500, 620, 500, 620, 500, 620, 500, 620, 500, 620, 500, 620, 1630, 620, 500, 620, 1630, 620, 1630, 620, 1630, 620, 1630, 620, 1630, 620, 1630, 620};  // Samsung TV, 4500/4500 header
+static const uint16_t sony[26] = {2460, 540, 660, 540, 660, 540, 1260, 540, 660, 540, 1260, 540, 660, 540, 660, 540, 1260, 540, 660, 540, 660, 540, 660, 540, 660, 540};  // Sony SIRC 12 bit
+static const uint16_t otherNec[67] = {9052, 4414, 630, 480, 648, 500, 626, 1634, 610, 514, 642, 514, 642, 464, 650, 492, 646, 490, 634, 1636, 614, 1606, 612, 514, 616, 1638, 620, 1620, 644, 1604, 614, 1598, 624, 1592, 656, 492, 608, 468, 664, 486, 616, 1644, 618, 484, 658, 482, 624, 508, 622, 492, 646, 1620, 622, 1618, 630, 1644, 618, 462, 610, 1620, 644, 1602, 646, 1586, 636, 1598, 652};  // NEC 20DF10EF (a TV remote)
+
+static const CorpusEntry corpus[] = {
+  { "typicalPower", typicalPower, 67, 0x400501FE },
+  { "typicalPlus", typicalPlus, 67, 0x400555AA },
+  { "typicalMinus", typicalMinus, 67, 0x400556A9 },
+  { "typicalInput1", typicalInput1, 67, 0x400520DF },
+  { "typicalMute", typicalMute, 67, 0x400557A8 },
+  { "typicalLevel", typicalLevel, 67, 0x400550AF },
+  { "typicalRepeat", typicalRepeat, 3, NEC_REPEAT },
+  { "farPower", farPower, 67, 0x400501FE },
+  { "farPlus", farPlus, 67, 0x400555AA },
+  { "farMinus", farMinus, 67, 0x400556A9 },
+  { "farInput1", farInput1, 67, 0x400520DF },
+  { "farMute", farMute, 67, 0x400557A8 },
+  { "farLevel", farLevel, 67, 0x400550AF },
+  { "farRepeat", farRepeat, 3, NEC_REPEAT },
+  { "slowRemotePower", slowRemotePower, 67, 0x400501FE },
+  { "slowRemotePlus", slowRemotePlus, 67, 0x400555AA },
+  { "slowRemoteMinus", slowRemoteMinus, 67, 0x400556A9 },
+  { "slowRemoteInput1", slowRemoteInput1, 67, 0x400520DF },
+  { "slowRemoteMute", slowRemoteMute, 67, 0x400557A8 },
+  { "slowRemoteLevel", slowRemoteLevel, 67, 0x400550AF },
+  { "slowRemoteRepeat", slowRemoteRepeat, 3, NEC_REPEAT },
+  { "fastRemotePower", fastRemotePower, 67, 0x400501FE },
+  { "fastRemotePlus", fastRemotePlus, 67, 0x400555AA },
+  { "fastRemoteMinus", fastRemoteMinus, 67, 0x400556A9 },
+  { "fastRemoteInput1", fastRemoteInput1, 67, 0x400520DF },
+  { "fastRemoteMute", fastRemoteMute, 67, 0x400557A8 },
+  { "fastRemoteLevel", fastRemoteLevel, 67, 0x400550AF },
+  { "fastRemoteRepeat", fastRemoteRepeat, 3, NEC_REPEAT },
+  { "zeroSpace600", zeroSpace600, 67, PLUS_IR },
+  { "zeroSpace636", zeroSpace636, 67, PLUS_IR },
+  { "bitMark480", bitMark480, 67, PLUS_IR },
+  { "zeroSpace700", zeroSpace700, 67, 0 },
+  { "headerSpace3000", headerSpace3000, 67, 0 },
+  { "fluorescent", fluorescent, 40, 0 },
+  { "truncated", truncated, 42, 0 },
+  { "samsung", samsung, 67, 0 },
+  { "sony", sony, 26, 0 },
+  { "otherNec", otherNec, 67, 0x20DF10EF },
+};
+
+#endif // NEC_CORPUS_H_
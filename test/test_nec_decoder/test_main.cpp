@@ -0,0 +1,136 @@
+#include <unity.h>
+#include <stdio.h>
+
+#include "NecDecoder.hpp"
+#include "corpus.h"
+
+/* IRremoteESP8266's matching as it does it: ticksLow()/ticksHigh() around
+ * kMarkExcess shifted lengths and decodeNEC() over the captured buffer, to
+ * check the NecDecoder's windows against segment by segment. The library
+ * itself and the benchmark against it are in test_nec_benchmark */
+#define IRRECV_MARK_EXCESS  50
+#define IRRECV_TOLERANCE    25
+
+static uint32_t ticksLow(uint32_t usecs) {
+  int32_t low = (int32_t)(usecs * (1.0 - IRRECV_TOLERANCE / 100.0));
+  return low > 0 ? low : 0;
+}
+
+static uint32_t ticksHigh(uint32_t usecs) {
+  return (uint32_t)(usecs * (1.0 + IRRECV_TOLERANCE / 100.0)) + 1;
+}
+
+static bool matchMark(uint32_t measured, uint32_t desired) {
+  desired += IRRECV_MARK_EXCESS;
+  return measured >= ticksLow(desired) && measured <= ticksHigh(desired);
+}
+
+static bool matchSpace(uint32_t measured, uint32_t desired) {
+  desired -= IRRECV_MARK_EXCESS;
+  return measured >= ticksLow(desired) && measured <= ticksHigh(desired);
+}
+
+/** decodeNEC() over one capture, 0 when it isn't a frame */
+static uint32_t irrecvDecode(const uint16_t* raw, uint16_t length) {
+  if(length < 3 || !matchMark(raw[0], NEC_HDR_MARK)) return 0;
+  if(length == 3) {
+    return matchSpace(raw[1], NEC_RPT_SPACE) && matchMark(raw[2], NEC_BIT_MARK) ? NEC_REPEAT : 0;
+  }
+  if(length < 2 + 2 * NEC_BITS + 1 || !matchSpace(raw[1], NEC_HDR_SPACE)) return 0;
+  uint32_t value = 0;
+  for(uint8_t i = 0; i < NEC_BITS; i++) {
+    if(!matchMark(raw[2 + 2 * i], NEC_BIT_MARK)) return 0;
+    uint16_t space = raw[3 + 2 * i];
+    if(matchSpace(space, NEC_ONE_SPACE))
+      value = (value << 1) | 1;
+    else if(matchSpace(space, NEC_ZERO_SPACE))
+      value <<= 1;
+    else
+      return 0;
+  }
+  return matchMark(raw[2 + 2 * NEC_BITS], NEC_BIT_MARK) ? value : 0;
+}
+
+/** Feeds a capture to the NecDecoder edge by edge, 0 when nothing was latched */
+static uint32_t necDecode(NecDecoder& decoder, const uint16_t* raw, uint16_t length) {
+  for(uint16_t i = 0; i < length; i++) decoder.feed(raw[i], i % 2 == 0);
+  decoder.feed(20000, false); // The gap after the frame
+  return decoder.available() ? decoder.read() : 0;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_corpus_matches_expected() {
+  NecDecoder decoder;
+  char message[96];
+  for(const CorpusEntry& entry : corpus) {
+    snprintf(message, sizeof(message), "NecDecoder on %s", entry.name);
+    TEST_ASSERT_EQUAL_HEX32_MESSAGE(entry.expected, necDecode(decoder, entry.raw, entry.length), message);
+    snprintf(message, sizeof(message), "IRrecv on %s", entry.name);
+    TEST_ASSERT_EQUAL_HEX32_MESSAGE(entry.expected, irrecvDecode(entry.raw, entry.length), message);
+  }
+}
+
+void test_noise_counts_no_frames() {
+  NecDecoder decoder;
+  necDecode(decoder, fluorescent, sizeof(fluorescent) / sizeof(fluorescent[0]));
+  necDecode(decoder, samsung, sizeof(samsung) / sizeof(samsung[0]));
+  necDecode(decoder, sony, sizeof(sony) / sizeof(sony[0]));
+  TEST_ASSERT_EQUAL_UINT32(0, decoder.frames);
+}
+
+void test_frame_after_an_abandoned_one() {
+  NecDecoder decoder;
+  necDecode(decoder, truncated, sizeof(truncated) / sizeof(truncated[0]));
+  TEST_ASSERT_EQUAL_UINT32(1, decoder.errors);
+  TEST_ASSERT_EQUAL_HEX32(POWER_IR, necDecode(decoder, typicalPower, sizeof(typicalPower) / sizeof(typicalPower[0])));
+}
+
+/** A repeat, or a frame whose first bit is one and the rest zeros, with
+ *  segment index set to measured. True when the decoder still gets it */
+static bool decoderTakes(uint8_t index, uint16_t measured, bool repeat, bool one) {
+  uint16_t frame[67];
+  uint16_t length = repeat ? 3 : 67;
+  frame[0] = NEC_HDR_MARK;
+  frame[1] = repeat ? NEC_RPT_SPACE : NEC_HDR_SPACE;
+  for(uint8_t i = 0; i < NEC_BITS; i++) {
+    frame[2 + 2 * i] = NEC_BIT_MARK;
+    frame[3 + 2 * i] = i == 0 && one ? NEC_ONE_SPACE : NEC_ZERO_SPACE;
+  }
+  frame[repeat ? 2 : 66] = NEC_BIT_MARK;
+  frame[index] = measured;
+  NecDecoder decoder;
+  uint32_t value = necDecode(decoder, frame, length);
+  return decoder.frames == 1 && value == (repeat ? NEC_REPEAT : one ? 0x80000000 : 0);
+}
+
+/** Every segment length is taken by both decoders or by neither */
+void test_windows_match_irrecv() {
+  static const struct { uint16_t expected; bool mark; uint8_t index; bool repeat; bool one; } segments[] = {
+    { NEC_HDR_MARK, true, 0, true, false },
+    { NEC_RPT_SPACE, false, 1, true, false },
+    { NEC_BIT_MARK, true, 2, true, false },
+    { NEC_HDR_SPACE, false, 1, false, true },
+    { NEC_ONE_SPACE, false, 3, false, true },
+    { NEC_ZERO_SPACE, false, 3, false, false },
+  };
+  char message[64];
+  for(const auto& segment : segments) {
+    for(uint32_t measured = segment.expected / 2; measured < segment.expected * 2u; measured += 2) {
+      bool irrecv = segment.mark ? matchMark(measured, segment.expected) : matchSpace(measured, segment.expected);
+      snprintf(message, sizeof(message), "%u us for the %u us %s", (unsigned)measured,
+        (unsigned)segment.expected, segment.mark ? "mark" : "space");
+      TEST_ASSERT_EQUAL_MESSAGE(irrecv, decoderTakes(segment.index, measured, segment.repeat, segment.one), message);
+    }
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_corpus_matches_expected);
+  RUN_TEST(test_noise_counts_no_frames);
+  RUN_TEST(test_frame_after_an_abandoned_one);
+  RUN_TEST(test_windows_match_irrecv);
+  return UNITY_END();
+}
@@ -0,0 +1,111 @@
+#include <unity.h>
+#include <stdio.h>
+
+#include "NecWaveform.h"
+
+/* Golden vectors, written out by hand from the NEC timings: header, then a
+ * 560 µs mark and a 1690 (one) or 560 (zero) µs space per bit, MSB first,
+ * then the stop mark */
+static const uint16_t goldenPower[NEC_FRAME_LENGTH] = {
+  9000, 4500,
+  560, 560, 560, 1690, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560,  // 0x40
+  560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 1690, 560, 560, 560, 1690, // 0x05
+  560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 1690,  // 0x01
+  560, 1690, 560, 1690, 560, 1690, 560, 1690, 560, 1690, 560, 1690, 560, 1690, 560, 560, // 0xFE
+  560
+};
+
+static const uint16_t goldenPlus[NEC_FRAME_LENGTH] = {
+  9000, 4500,
+  560, 560, 560, 1690, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560,  // 0x40
+  560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 1690, 560, 560, 560, 1690, // 0x05
+  560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, // 0x55
+  560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, 560, 1690, 560, 560, // 0xAA
+  560
+};
+
+static const uint16_t goldenAux[NEC_FRAME_LENGTH] = {
+  9000, 4500,
+  560, 560, 560, 1690, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560,  // 0x40
+  560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 560, 1690, 560, 560, 560, 1690, // 0x05
+  560, 560, 560, 1690, 560, 560, 560, 560, 560, 560, 560, 560, 560, 1690, 560, 560, // 0x42
+  560, 1690, 560, 560, 560, 1690, 560, 1690, 560, 1690, 560, 1690, 560, 560, 560, 1690, // 0xBD
+  560
+};
+
+static const uint16_t goldenRepeat[NEC_REPEAT_LENGTH] = { 9000, 2250, 560 };
+
+void setUp() {}
+void tearDown() {}
+
+void test_golden_vectors() {
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(goldenPower, findNecWaveform(POWER_IR)->timings, NEC_FRAME_LENGTH);
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(goldenPlus, findNecWaveform(PLUS_IR)->timings, NEC_FRAME_LENGTH);
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(goldenAux, findNecWaveform(AUX_IR)->timings, NEC_FRAME_LENGTH);
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(goldenRepeat, necRepeatWaveform, NEC_REPEAT_LENGTH);
+}
+
+/** Every table has the NEC shape and its spaces spell out its code */
+void test_every_waveform_spells_its_code() {
+  char message[48];
+  for(size_t w = 0; w < NEC_WAVEFORM_COUNT; w++) {
+    const NecWaveform& waveform = necWaveforms[w];
+    snprintf(message, sizeof(message), "%08X", (unsigned)waveform.code);
+    TEST_ASSERT_EQUAL_UINT16_MESSAGE(NEC_HDR_MARK, waveform.timings[0], message);
+    TEST_ASSERT_EQUAL_UINT16_MESSAGE(NEC_HDR_SPACE, waveform.timings[1], message);
+    uint32_t code = 0;
+    uint8_t ones = 0;
+    for(uint8_t i = 0; i < NEC_BITS; i++) {
+      TEST_ASSERT_EQUAL_UINT16_MESSAGE(NEC_BIT_MARK, waveform.timings[2 + 2 * i], message);
+      uint16_t space = waveform.timings[3 + 2 * i];
+      TEST_ASSERT_TRUE_MESSAGE(space == NEC_ONE_SPACE || space == NEC_ZERO_SPACE, message);
+      code = (code << 1) | (space == NEC_ONE_SPACE);
+      ones += space == NEC_ONE_SPACE;
+    }
+    TEST_ASSERT_EQUAL_UINT16_MESSAGE(NEC_BIT_MARK, waveform.timings[NEC_FRAME_LENGTH - 1], message);
+    TEST_ASSERT_EQUAL_HEX32_MESSAGE(waveform.code, code, message);
+
+    uint32_t expected = NEC_HDR_MARK + NEC_HDR_SPACE + (NEC_BITS + 1) * NEC_BIT_MARK
+      + ones * NEC_ONE_SPACE + (NEC_BITS - ones) * NEC_ZERO_SPACE;
+    uint32_t duration = necDuration(waveform.timings, NEC_FRAME_LENGTH);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected, duration, message);
+    TEST_ASSERT_LESS_THAN_MESSAGE(NEC_FRAME_PERIOD, duration, message);
+  }
+  TEST_ASSERT_EQUAL_UINT32(11810, necDuration(necRepeatWaveform, NEC_REPEAT_LENGTH));
+}
+
+void test_codes_are_unique_and_found() {
+  for(size_t i = 0; i < NEC_WAVEFORM_COUNT; i++) {
+    // NEC_WAVEFORM_COUNT past the codes listed leaves zeros at the end
+    TEST_ASSERT_NOT_EQUAL(0, necWaveforms[i].code);
+    TEST_ASSERT_TRUE(findNecWaveform(necWaveforms[i].code) == &necWaveforms[i]);
+    for(size_t j = i + 1; j < NEC_WAVEFORM_COUNT; j++) {
+      TEST_ASSERT_NOT_EQUAL(necWaveforms[i].code, necWaveforms[j].code);
+    }
+  }
+  TEST_ASSERT_NULL(findNecWaveform(NEC_REPEAT));
+  TEST_ASSERT_NULL(findNecWaveform(0));
+  TEST_ASSERT_NULL(findNecWaveform(0x20DF10EF));
+}
+
+/** What we send is what our own receive path decodes */
+void test_waveforms_decode() {
+  NecDecoder decoder;
+  for(size_t w = 0; w < NEC_WAVEFORM_COUNT; w++) {
+    for(uint8_t i = 0; i < NEC_FRAME_LENGTH; i++) decoder.feed(necWaveforms[w].timings[i], i % 2 == 0);
+    TEST_ASSERT_TRUE(decoder.available());
+    TEST_ASSERT_EQUAL_HEX32(necWaveforms[w].code, decoder.read());
+  }
+  for(uint8_t i = 0; i < NEC_REPEAT_LENGTH; i++) decoder.feed(necRepeatWaveform[i], i % 2 == 0);
+  TEST_ASSERT_EQUAL_HEX32(NEC_REPEAT, decoder.read());
+  TEST_ASSERT_EQUAL_UINT32(0, decoder.errors);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_golden_vectors);
+  RUN_TEST(test_every_waveform_spells_its_code);
+  RUN_TEST(test_codes_are_unique_and_found);
+  RUN_TEST(test_waveforms_decode);
+  return UNITY_END();
+}
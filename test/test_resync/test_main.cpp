@@ -0,0 +1,138 @@
+#include <unity.h>
+#include <string.h>
+
+#include "Z906Resync.hpp"
+#include "Z906Journal.h"
+
+static Z906State state;
+static uint8_t confidence[PARAM_COUNT];
+static uint8_t sentFrames[PARAM_COUNT];
+
+/** Minus presses in seq */
+static uint16_t minusPresses(const IRSequence& seq) {
+  uint16_t total = 0;
+  for(uint8_t i = 0; i < seq.length; i++) {
+    if(seq.steps[i].code == MINUS_IR) total += seq.steps[i].count;
+  }
+  return total;
+}
+
+void setUp() {
+  memset(&state, 0, sizeof(state));
+  state.mode = On;
+  memset(confidence, CONFIDENCE_MAX, sizeof(confidence));
+  memset(sentFrames, 0, sizeof(sentFrames));
+}
+
+void tearDown() {}
+
+/** The amp after every press in seq, counted like the journal does */
+static Z906State play(Z906State amp, const IRSequence& seq) {
+  for(uint8_t i = 0; i < seq.length; i++) {
+    for(uint8_t j = 0; j < seq.steps[i].count; j++) applySent(amp, seq.steps[i].code);
+  }
+  return amp;
+}
+
+/** The amp can't tell the remote's Plus and Minus from ours, one step per
+ *  frame either way, and the resync counts on both ends of the range */
+void test_keys_count_the_same_whoever_sends_them() {
+  const uint32_t remote[] = { 0xABB1A8D2, 0x11E728E };
+  const uint32_t sent[] = { PLUS_IR, MINUS_IR };
+  for(int8_t level = 0; level <= LEVEL_MAX; level++) {
+    for(uint8_t key = 0; key < 2; key++) {
+      Z906State byRemote = state;
+      byRemote.soundLevel[0] = level;
+      Z906State byUs = byRemote;
+      TEST_ASSERT_TRUE(byRemote.applyKey(remote[key]));
+      applySent(byUs, sent[key]);
+      TEST_ASSERT_EQUAL_INT8(byUs.soundLevel[0], byRemote.soundLevel[0]);
+    }
+  }
+  state.soundLevel[0] = 1;
+  state.applyKey(MINUS_IR);
+  TEST_ASSERT_EQUAL_INT8(0, state.soundLevel[0]);
+  state.applyKey(MINUS_IR);
+  TEST_ASSERT_EQUAL_INT8(0, state.soundLevel[0]);
+  state.soundLevel[0] = LEVEL_MAX - 1;
+  state.applyKey(PLUS_IR);
+  state.applyKey(PLUS_IR);
+  TEST_ASSERT_EQUAL_INT8(LEVEL_MAX, state.soundLevel[0]);
+}
+
+/** Whatever the believed level, the Minus burst reaches 0 from the top */
+void test_any_level_is_driven_to_zero() {
+  for(int8_t level = 0; level <= LEVEL_MAX; level++) {
+    Z906State believed = state;
+    believed.soundLevel[0] = level;
+    IRSequence seq;
+    TEST_ASSERT_EQUAL_UINT8(TARGET_LEVEL(0), planResync(believed, TARGET_LEVEL(0), seq));
+    TEST_ASSERT_EQUAL_UINT16(LEVEL_MAX + RESYNC_MARGIN, minusPresses(seq));
+    TEST_ASSERT_EQUAL_INT8(level, believed.soundLevel[0]);
+  }
+}
+
+/** The amp was turned up behind our back, the resync still lands on the
+ *  believed levels */
+void test_amp_above_the_believed_level() {
+  state.soundLevel[0] = 5;
+  state.soundLevel[1] = 12;
+  for(int8_t real = 5; real <= LEVEL_MAX; real++) {
+    Z906State amp = state;
+    amp.soundLevel[0] = real;
+    amp.soundLevel[1] = LEVEL_MAX;
+    Z906State believed = state;
+    IRSequence seq;
+    TEST_ASSERT_EQUAL_UINT8(TARGET_LEVEL(0) | TARGET_LEVEL(1), planResync(believed, TARGET_LEVEL(0) | TARGET_LEVEL(1), seq));
+    amp = play(amp, seq);
+    TEST_ASSERT_EQUAL_INT8(5, amp.soundLevel[0]);
+    TEST_ASSERT_EQUAL_INT8(12, amp.soundLevel[1]);
+    TEST_ASSERT_EQUAL(On, amp.mode);
+    TEST_ASSERT_TRUE(memcmp(&amp, &believed, sizeof(amp)) == 0);
+  }
+}
+
+/** Two 25 step moves of our own mustn't look like a lost amp */
+void test_own_ramps_cost_little() {
+  chargeFrames(confidence, sentFrames, TARGET_LEVEL(0), 25);
+  chargeFrames(confidence, sentFrames, TARGET_LEVEL(0), 25);
+  TEST_ASSERT_EQUAL_UINT8(CONFIDENCE_MAX - 2, confidence[4]);
+  TEST_ASSERT_EQUAL_UINT8(10, sentFrames[4]);
+  TEST_ASSERT_EQUAL_UINT8(CONFIDENCE_MAX, confidence[5]);
+
+  // Single presses add up instead of rounding away
+  for(uint8_t i = 0; i < CONFIDENCE_FRAMES; i++) chargeFrames(confidence, sentFrames, TARGET_LEVEL(1), 1);
+  TEST_ASSERT_EQUAL_UINT8(CONFIDENCE_MAX - 1, confidence[5]);
+
+  // It takes a thousand of our frames to get to the threshold
+  confidence[4] = CONFIDENCE_MAX;
+  sentFrames[4] = 0;
+  uint16_t frames = 0;
+  while(confidence[4] >= RESYNC_THRESHOLD) {
+    chargeFrames(confidence, sentFrames, TARGET_LEVEL(0), 1);
+    frames++;
+  }
+  TEST_ASSERT_EQUAL_UINT16((CONFIDENCE_MAX - RESYNC_THRESHOLD + 1) * CONFIDENCE_FRAMES, frames);
+}
+
+/** One orphaned repeat costs more than a whole ramp of ours */
+void test_orphans_cost_more_than_ramps() {
+  uint8_t ours[PARAM_COUNT];
+  memcpy(ours, confidence, sizeof(ours));
+  chargeFrames(ours, sentFrames, TARGET_LEVEL(0), LEVEL_MAX);
+  lowerConfidence(confidence, TARGET_LEVELS, CONFIDENCE_ORPHAN);
+  TEST_ASSERT_LESS_THAN(ours[4], confidence[4]);
+  lowerConfidence(confidence, TARGET_LEVELS, CONFIDENCE_ORPHAN);
+  lowerConfidence(confidence, TARGET_LEVELS, CONFIDENCE_ORPHAN);
+  TEST_ASSERT_LESS_THAN(RESYNC_THRESHOLD, confidence[4]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_keys_count_the_same_whoever_sends_them);
+  RUN_TEST(test_any_level_is_driven_to_zero);
+  RUN_TEST(test_amp_above_the_believed_level);
+  RUN_TEST(test_own_ramps_cost_little);
+  RUN_TEST(test_orphans_cost_more_than_ramps);
+  return UNITY_END();
+}
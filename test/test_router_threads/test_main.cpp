@@ -0,0 +1,147 @@
+#include <unity.h>
+#include <atomic>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <LittleFS.h>
+#include <esp8266_peri.h>
+
+#include "CommandRouter.h"
+#include "Z906Controller.h"
+
+/* The router with the network and IR contexts on threads of their own, the
+ * case post() answers 202 for. The network thread posts and collects the
+ * answers by id, the IR thread runs the commands, the transmitter and the
+ * clock. Built with -fsanitize=thread (pio test -e native_tsan) anything
+ * they share besides the two queues shows up as a race */
+
+#define REQUESTS    400
+#define IR_PIN      4
+#define ON_LED_PIN  5
+
+static Z906Controller controller("", IR_PIN, ON_LED_PIN, 0);
+
+/* Network side */
+static std::map<uint32_t, String> answers;  // By command id
+static std::vector<uint32_t> order;         // Ids as the answers came back
+static uint32_t lastId = 0;                 // Of the last command queued
+static uint32_t duplicates = 0;
+
+/** What the board would publish, the events post() didn't take */
+static void collect(const Event& event) {
+  if(!event.id) return;
+  if(!answers.emplace(event.id, event.payload).second) duplicates++;
+  else order.push_back(event.id);
+}
+
+static void collectEvents() {
+  Event event;
+  while(router.popEvent(event)) collect(event);
+}
+
+static String requestFor(uint32_t i) {
+  if(i % 2) return "{\"method\":\"getSettings\"}";
+  return "{\"method\":\"setSettings\",\"soundlevel\":" + String(10 + i % 30) + "}";
+}
+
+void setUp() {
+  answers.clear();
+  order.clear();
+  duplicates = 0;
+}
+
+void tearDown() {}
+
+/** Without anyone to run it while post() waits, a command is answered
+ *  with its id and the answer comes back as an event carrying it */
+void test_post_without_ir_context_answers_by_id() {
+  String response;
+  TEST_ASSERT_EQUAL(202, router.post(0, "{\"method\":\"getSettings\"}", response));
+  uint32_t id = response.substring(response.indexOf("\"id\":") + 5).toInt();
+  TEST_ASSERT_EQUAL_UINT32(lastId + 1, id);
+  lastId = id;
+  TEST_ASSERT_TRUE(router.runNext());
+  collectEvents();
+  TEST_ASSERT_EQUAL(1, answers.size());
+  TEST_ASSERT_NOT_EQUAL(-1, answers[id].indexOf("\"settings\""));
+}
+
+/** Every POST is answered once, under its own id and in order */
+void test_two_threads_answer_every_post() {
+  std::atomic<bool> stop(false);
+  std::thread ir([&stop]() {
+    while(!stop.load()) {
+      router.runNext();
+      controller.service();
+      hostAdvance(1000);
+    }
+  });
+
+  std::map<uint32_t, uint32_t> requestOf;   // Command id -> i
+  uint32_t busy = 0;
+  uint32_t answeredRightAway = 0;
+  for(uint32_t i = 0; i < REQUESTS; i++) {
+    String req = requestFor(i);
+    String response;
+    int status;
+    while((status = router.post(0, req, response)) == 503) {
+      busy++;
+      collectEvents();
+      std::this_thread::yield();
+    }
+    // Ids are handed out in the order the commands were queued
+    uint32_t id = ++lastId;
+    requestOf[id] = i;
+    if(status == 202) {
+      TEST_ASSERT_EQUAL_UINT32(id, response.substring(response.indexOf("\"id\":") + 5).toInt());
+    } else {
+      // The IR thread was quicker than post() looking for the answer
+      TEST_ASSERT_EQUAL(200, status);
+      answers[id] = response;
+      order.push_back(id);
+      answeredRightAway++;
+    }
+    collectEvents();
+  }
+
+  for(uint32_t spins = 0; answers.size() < REQUESTS && spins < 10000000; spins++) {
+    collectEvents();
+    std::this_thread::yield();
+  }
+  stop.store(true);
+  ir.join();
+  collectEvents();
+
+  TEST_ASSERT_EQUAL(REQUESTS, requestOf.size());
+  TEST_ASSERT_EQUAL(REQUESTS, answers.size());
+  TEST_ASSERT_EQUAL_UINT32(0, duplicates);
+  TEST_ASSERT_EQUAL_UINT32(0, router.events.dropped.load());
+  for(size_t i = 1; i < order.size(); i++) TEST_ASSERT_EQUAL_UINT32(order[i - 1] + 1, order[i]);
+  for(auto& entry : requestOf) {
+    TEST_ASSERT_TRUE(answers.count(entry.first));
+    if(entry.second % 2) TEST_ASSERT_NOT_EQUAL(-1, answers[entry.first].indexOf("\"settings\""));
+  }
+  TEST_ASSERT_EQUAL_INT8(10 + (REQUESTS - 2) % 30, controller.state.soundLevel[0]);
+  char message[96];
+  snprintf(message, sizeof(message), "%u answered right away, %u 503s while the queue was full",
+    (unsigned)answeredRightAway, (unsigned)busy);
+  TEST_MESSAGE(message);
+}
+
+int main() {
+  EEPROM.begin(512);
+  LittleFS.begin();
+  bindings.begin();
+  router.begin(&controller, 1);
+  router.onEvent = collect;
+  digitalWrite(ON_LED_PIN, HIGH);
+  controller.begin("speaker/logitech_z906");
+  controller.checkIfStillOn();
+  UNITY_BEGIN();
+  RUN_TEST(test_post_without_ir_context_answers_by_id);
+  RUN_TEST(test_two_threads_answer_every_post);
+  return UNITY_END();
+}
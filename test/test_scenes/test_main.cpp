@@ -0,0 +1,182 @@
+#include <unity.h>
+#include <vector>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <LittleFS.h>
+#include <esp8266_peri.h>
+#include <Z906Amp.h>
+
+#include "Z906Controller.h"
+
+/* Scenes from the request to the LED: stored in LittleFS, compiled against
+ * the believed state, kept compiled while nothing changes and sent as one
+ * burst the amp in front of the LED ends up agreeing with */
+
+#define IR_PIN      4
+#define ON_LED_PIN  5
+
+static Z906Controller controller("", IR_PIN, ON_LED_PIN, 0);
+static AmpModel amp;
+static LedDecoder led;
+
+/** Runs the loop until nothing is on the air, the amp sees every frame */
+static bool drain(uint32_t limitMs = 10000) {
+  std::vector<uint32_t> codes;
+  for(uint32_t ms = 0; ms < limitMs; ms++) {
+    controller.service();
+    led.poll(IR_PIN, codes);
+    for(uint32_t code : codes) amp.frame(code, millis());
+    codes.clear();
+    if(!IRTransmitter::anyBusy()) return true;
+    hostAdvance(1000);
+  }
+  return false;
+}
+
+static String request(const char* req) {
+  String response = controller.handleJSONReq(req);
+  TEST_ASSERT_TRUE(drain());
+  return response;
+}
+
+/** Start of every frame on the IR LED, a header mark is the only one over 8 ms */
+static std::vector<uint64_t> ledFrames() {
+  std::vector<uint64_t> starts;
+  HostEdges& edges = hostWaveform[IR_PIN];
+  for(size_t i = 0; i + 1 < edges.size(); i++) {
+    if(edges[i].mark && edges[i + 1].at - edges[i].at > microsecondsToClockCycles(8000)) starts.push_back(edges[i].at);
+  }
+  return starts;
+}
+
+static size_t storedScenes() {
+  size_t count = 0;
+  for(auto& file : hostFs.files) count += file.first.rfind(SCENE_DIR, 0) == 0;
+  return count;
+}
+
+void setUp() {
+  hostFs.broken = false;
+  for(auto file = hostFs.files.begin(); file != hostFs.files.end();) {
+    file = file->first.rfind(SCENE_DIR, 0) == 0 ? hostFs.files.erase(file) : std::next(file);
+  }
+  digitalWrite(ON_LED_PIN, HIGH);
+  controller.checkIfStillOn();
+  controller.state.input = Input1;
+  controller.state.effectOnInput[Input1] = Surround;
+  controller.state.effectOnInput[Input2] = Surround;
+  for(uint8_t i = 0; i < 4; i++) controller.state.soundLevel[i] = 20;
+  controller.saveSettings();
+  drain();
+  amp.state = controller.state;
+  led = LedDecoder();
+  for(HostEdges& edges : hostWaveform) edges.clear();
+}
+
+void tearDown() {}
+
+void test_store_saves_loads_and_deletes() {
+  String json;
+  TEST_ASSERT_TRUE(scenes.save("Movie", "{\"soundlevel\":30}"));
+  TEST_ASSERT_TRUE(scenes.save("late-night_2", "{\"mute\":true}"));
+  TEST_ASSERT_TRUE(scenes.load("Movie", json));
+  TEST_ASSERT_EQUAL_STRING("{\"soundlevel\":30}", json.c_str());
+
+  // Saving again replaces the document
+  TEST_ASSERT_TRUE(scenes.save("Movie", "{\"soundlevel\":12}"));
+  TEST_ASSERT_TRUE(scenes.load("Movie", json));
+  TEST_ASSERT_EQUAL_STRING("{\"soundlevel\":12}", json.c_str());
+
+  String listed = controller.handleJSONReq("{\"method\":\"listScenes\"}");
+  TEST_ASSERT_NOT_EQUAL(-1, listed.indexOf("\"Movie\""));
+  TEST_ASSERT_NOT_EQUAL(-1, listed.indexOf("\"late-night_2\""));
+
+  TEST_ASSERT_TRUE(scenes.remove("Movie"));
+  TEST_ASSERT_FALSE(scenes.load("Movie", json));
+  TEST_ASSERT_FALSE(scenes.remove("Movie"));
+  TEST_ASSERT_TRUE(scenes.load("late-night_2", json));
+
+  // Names end up in paths, nothing that could leave SCENE_DIR gets through
+  TEST_ASSERT_FALSE(scenes.save("", "{}"));
+  TEST_ASSERT_FALSE(scenes.save("../boot", "{}"));
+  TEST_ASSERT_FALSE(scenes.save("with space", "{}"));
+  TEST_ASSERT_FALSE(scenes.save("a_name_that_is_too_long_", "{}"));
+  TEST_ASSERT_EQUAL(1, storedScenes());
+}
+
+/** All presses of a scene are queued at once and go out back to back */
+void test_scene_goes_out_as_one_burst() {
+  request("{\"method\":\"saveScene\",\"name\":\"Movie\",\"scene\":{\"input\":\"Input 2\",\"effect\":\"Music\",\"soundlevel\":30}}");
+  String response = request("{\"method\":\"applyScene\",\"name\":\"Movie\"}");
+  TEST_ASSERT_EQUAL(-1, response.indexOf("No such scene"));
+
+  TEST_ASSERT_EQUAL(Input2, controller.state.input);
+  TEST_ASSERT_EQUAL(Music, controller.state.currentEffect());
+  TEST_ASSERT_EQUAL_INT8(30, controller.state.soundLevel[0]);
+  TEST_ASSERT_EQUAL_STRING("", divergence(controller.state, amp.state).c_str());
+
+  std::vector<uint64_t> frames = ledFrames();
+  TEST_ASSERT_GREATER_THAN(2, frames.size());
+  for(size_t i = 1; i < frames.size(); i++) {
+    uint32_t apart = (frames[i] - frames[i - 1]) / clockCyclesPerMicrosecond();
+    TEST_ASSERT_LESS_OR_EQUAL(NEC_FRAME_PERIOD + MS_BETWEEN_SENDING_IR * 1000 + 1000, apart);
+  }
+}
+
+/** Once idle the cached scenes are compiled against the current state, so
+ *  applying one neither reads flash nor plans */
+void test_cached_scene_needs_no_flash() {
+  request("{\"method\":\"saveScene\",\"name\":\"Movie\",\"scene\":{\"soundlevel\":30}}");
+  request("{\"method\":\"saveScene\",\"name\":\"Night\",\"scene\":{\"soundlevel\":8,\"basslevel\":5}}");
+  request("{\"method\":\"applyScene\",\"name\":\"Movie\"}");
+  request("{\"method\":\"applyScene\",\"name\":\"Night\"}");
+
+  hostFs.broken = true;
+  String response = request("{\"method\":\"applyScene\",\"name\":\"Movie\"}");
+  TEST_ASSERT_EQUAL(-1, response.indexOf("No such scene"));
+  TEST_ASSERT_EQUAL_INT8(30, controller.state.soundLevel[0]);
+  TEST_ASSERT_EQUAL_INT8(5, controller.state.soundLevel[1]);
+  TEST_ASSERT_EQUAL_STRING("", divergence(controller.state, amp.state).c_str());
+
+  // One that never was applied has to come from flash
+  response = controller.handleJSONReq("{\"method\":\"applyScene\",\"name\":\"Party\"}");
+  TEST_ASSERT_NOT_EQUAL(-1, response.indexOf("No such scene"));
+}
+
+/** Overwriting or deleting a scene throws its compiled presses away */
+void test_overwritten_scene_is_recompiled() {
+  request("{\"method\":\"saveScene\",\"name\":\"Movie\",\"scene\":{\"soundlevel\":30}}");
+  request("{\"method\":\"applyScene\",\"name\":\"Movie\"}");
+  request("{\"method\":\"setSettings\",\"soundlevel\":20}");
+  TEST_ASSERT_EQUAL_INT8(20, controller.state.soundLevel[0]);
+
+  request("{\"method\":\"saveScene\",\"name\":\"Movie\",\"scene\":{\"soundlevel\":12,\"input\":\"Input 2\"}}");
+  request("{\"method\":\"applyScene\",\"name\":\"Movie\"}");
+  TEST_ASSERT_EQUAL_INT8(12, controller.state.soundLevel[0]);
+  TEST_ASSERT_EQUAL(Input2, controller.state.input);
+  TEST_ASSERT_EQUAL_STRING("", divergence(controller.state, amp.state).c_str());
+
+  // Right away too, before service() had a chance to recompile it
+  controller.handleJSONReq("{\"method\":\"saveScene\",\"name\":\"Movie\",\"scene\":{\"soundlevel\":15}}");
+  request("{\"method\":\"applyScene\",\"name\":\"Movie\"}");
+  TEST_ASSERT_EQUAL_INT8(15, controller.state.soundLevel[0]);
+
+  request("{\"method\":\"deleteScene\",\"name\":\"Movie\"}");
+  String response = request("{\"method\":\"applyScene\",\"name\":\"Movie\"}");
+  TEST_ASSERT_NOT_EQUAL(-1, response.indexOf("No such scene"));
+  TEST_ASSERT_EQUAL_INT8(15, controller.state.soundLevel[0]);
+}
+
+int main() {
+  EEPROM.begin(512);
+  LittleFS.begin();
+  bindings.begin();
+  controller.begin("speaker/logitech_z906");
+  UNITY_BEGIN();
+  RUN_TEST(test_store_saves_loads_and_deletes);
+  RUN_TEST(test_scene_goes_out_as_one_burst);
+  RUN_TEST(test_cached_scene_needs_no_flash);
+  RUN_TEST(test_overwritten_scene_is_recompiled);
+  return UNITY_END();
+}
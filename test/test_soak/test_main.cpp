@@ -0,0 +1,710 @@
+#include <unity.h>
+#include <stdio.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <LittleFS.h>
+#include <esp8266_peri.h>
+#include <Z906Amp.h>
+
+#include "CommandRouter.h"
+#include "SceneStore.h"
+#include "StateHistory.h"
+#include "IRBindings.h"
+#include "RuntimeStats.h"
+#include "ActivityProfile.h"
+
+/* Days of a busy household squeezed into the host clock: two amps, HTTP
+ * clients that come back on 503, a home automation publishing over a
+ * broker, and the remote held and mashed in front of the first amp. On top
+ * of that the broker restarts (what was in flight is lost), Wi-Fi drops,
+ * requests come in malformed or oversized and the receiver picks up noise.
+ * Everything goes in the way main.cpp hands it over (router.post() and
+ * router.receive(), receiveIR(), missedFrame(), checkIfStillOn()) and the
+ * loop runs every ms.
+ * Every round has inputs and faults for ROUND_INPUT_MS and then settles,
+ * when what we believe is checked against the amp models. The report has
+ * the tail latency, the commands dropped, the heap high-water mark and
+ * the divergence, a regression past the limits below fails the suite.
+ * SOAK_MINUTES and SOAK_SEED in the environment run longer or another day */
+
+#define SOAK_MINUTES      60
+#define SOAK_SEED         906
+#define SOAK_ROOT         "speaker/logitech_z906"
+
+#define UNIT_COUNT        2
+#define RECV_IR_UNIT      0     // The remote is in front of this one
+#define ROUND_MS          60000
+#define ROUND_INPUT_MS    40000 // Then nothing new comes in until the round ends
+#define SETTLE_LIMIT      60000 // ms past the round a unit may take to get off the air
+
+#define HTTP_CLIENTS      3
+#define HTTP_THINK_MS     8000  // Mean time between a client's requests
+#define HTTP_DELAY_MS     40    // Most a request takes over Wi-Fi to get to us
+#define HTTP_PATIENCE     60000 // ms of 503s a client takes, a resync holds a controller for up to half a minute
+#define MQTT_THINK_MS     15000
+#define MQTT_CHECK_MS     10000 // main.cpp's tCheckMQTTStatus
+#define REMOTE_THINK_MS   8000
+#define NOISE_THINK_MS    30000
+#define ON_LED_MS         1000  // main.cpp's tCheckIfStillOn while active
+#define FAULT_PERCENT     4     // Of the requests, malformed and as many oversized
+
+// What counts as a regression
+#define SOAK_HTTP_P99     2500  // ms from a client's first try to its answer, Retry-Afters included
+#define SOAK_LEAK_BYTES   1024  // Live heap after draining over what it was after the first round, a
+                                // String per command left behind is kilobytes by then
+
+/******************************* Counted heap *********************************/
+/* malloc() and friends are replaced so ESP.getFreeHeap() goes down with
+ * what the firmware allocates (Firmware below sets hostHeap.counting).
+ * glibc only, elsewhere the heap stays full and only the leak check is
+ * meaningless */
+
+#if defined(__GLIBC__)
+#define HEAP_TRACKED  16384   // Counted blocks alive at once
+
+struct TrackedBlock {
+  void* p;
+  size_t size;
+};
+static TrackedBlock tracked[HEAP_TRACKED];
+static size_t trackedCount = 0;
+static size_t untrackable = 0;  // Blocks that didn't fit in tracked
+
+static size_t trackedSlot(void* p) {
+  return (size_t)(((uintptr_t)p >> 4) * 2654435761u % HEAP_TRACKED);
+}
+
+static void track(void* p, size_t size) {
+  if(!p) return;
+  if(trackedCount >= HEAP_TRACKED * 3 / 4) {
+    untrackable++;
+    return;
+  }
+  size_t i = trackedSlot(p);
+  while(tracked[i].p) i = (i + 1) % HEAP_TRACKED;
+  tracked[i] = { p, size };
+  trackedCount++;
+  hostHeap.live += size;
+  if(hostHeap.live > hostHeap.peak) hostHeap.peak = hostHeap.live;
+}
+
+/** Forgets p, returns how big it was or 0 if it wasn't counted */
+static size_t untrack(void* p) {
+  if(!p || trackedCount == 0) return 0;
+  size_t i = trackedSlot(p);
+  while(tracked[i].p && tracked[i].p != p) i = (i + 1) % HEAP_TRACKED;
+  if(!tracked[i].p) return 0;
+  size_t size = tracked[i].size;
+  hostHeap.live -= size;
+  trackedCount--;
+  // Linear probing: move the ones after it up so none is cut off its slot
+  for(size_t j = (i + 1) % HEAP_TRACKED; tracked[j].p; j = (j + 1) % HEAP_TRACKED) {
+    size_t home = trackedSlot(tracked[j].p);
+    bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+    if(stays) continue;
+    tracked[i] = tracked[j];
+    i = j;
+  }
+  tracked[i].p = NULL;
+  return size;
+}
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void __libc_free(void* p);
+
+void* malloc(size_t size) {
+  void* p = __libc_malloc(size);
+  if(hostHeap.counting) track(p, size);
+  return p;
+}
+
+void* calloc(size_t count, size_t size) {
+  void* p = __libc_calloc(count, size);
+  if(hostHeap.counting) track(p, count * size);
+  return p;
+}
+
+void* realloc(void* p, size_t size) {
+  size_t was = untrack(p);
+  void* moved = __libc_realloc(p, size);
+  if(moved && (was || hostHeap.counting)) track(moved, size);
+  else if(!moved && was) track(p, was);
+  return moved;
+}
+
+void free(void* p) {
+  untrack(p);
+  __libc_free(p);
+}
+}
+#endif
+
+/** Counts the heap while the firmware has the CPU */
+struct Firmware {
+  Firmware() { hostHeap.counting = true; }
+  ~Firmware() { hostHeap.counting = false; }
+};
+
+/*********************************** World ************************************/
+
+static Z906Controller controllers[UNIT_COUNT] = { Z906Controller("", 4, 5, 0), Z906Controller("kitchen", 12, 13, 1) };
+static const uint8_t irPins[UNIT_COUNT] = { 4, 12 };
+static const uint8_t onLedPins[UNIT_COUNT] = { 5, 13 };
+static AmpModel amps[UNIT_COUNT];
+static AmpModel heard[UNIT_COUNT];   // The amps as far as the firmware could know
+static IRHold heardHold;             // The remote's keys in heard, like handleIRCode() holds them
+static LedDecoder leds[UNIT_COUNT];
+
+static uint32_t seed;
+
+/** xorshift32, the same day for the same SOAK_SEED */
+static uint32_t roll(uint32_t n) {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return n ? seed % n : 0;
+}
+
+/** Random wait with mean ms, so inputs bunch up now and then */
+static uint32_t think(uint32_t ms) {
+  return ms / 4 + roll(ms * 3 / 2);
+}
+
+enum RequestKind : uint8_t { Valid, Malformed, Oversized };
+
+/** What the soak saw, the tests below check it */
+struct SoakReport {
+  uint32_t rounds = 0;
+  // HTTP
+  uint32_t httpSent = 0;
+  uint32_t httpDone = 0;
+  uint32_t httpQueued = 0;      // 202s
+  uint32_t retries = 0;         // 503s
+  uint32_t gaveUp = 0;          // Dropped: still 503 after HTTP_PATIENCE
+  uint32_t wrongStatus = 0;     // A valid request refused or a broken one taken
+  uint32_t refused = 0;         // 400 and 413 to broken requests, as it should
+  uint32_t cutOff = 0;          // Tries lost to a Wi-Fi drop, tried again
+  std::vector<uint32_t> latencies;  // ms, requests that saw no Wi-Fi drop
+  // MQTT
+  uint32_t mqttSent = 0;
+  uint32_t mqttQueued = 0;
+  uint32_t mqttDropped = 0;     // Dropped: the command queue was full
+  uint32_t mqttLost = 0;        // Never got to us: broker restart or Wi-Fi drop
+  uint32_t mqttMalformed = 0;   // Refused, as it should
+  uint32_t eventsOut = 0;
+  uint32_t eventsLost = 0;      // Published while we were off the broker
+  // Faults
+  uint32_t brokerRestarts = 0;
+  uint32_t wifiDrops = 0;
+  uint32_t noise = 0;
+  uint32_t remoteFrames = 0;
+  uint32_t remoteUnheard = 0;   // The receiver was off for our own IR
+  // State
+  uint32_t divergedExplained = 0;   // Rounds the remote's frames account for: unheard, or taken by the amp for ours
+  uint32_t divergedUnexplained = 0;
+  uint32_t unsettled = 0;       // Rounds a unit didn't get off the air in time
+  // Heap
+  size_t heapBaseline = 0;
+  size_t heapPeak = 0;
+  long heapLeaked = 0;
+};
+static SoakReport report;
+static bool soaked = false;
+
+/********************************** Network ***********************************/
+
+struct HttpRequest {
+  uint8_t client;
+  uint8_t target;
+  RequestKind kind;
+  String body;
+  uint32_t firstMs;
+  uint32_t arrivesMs;
+  bool faulted;       // A Wi-Fi drop got in its way
+};
+
+struct HttpClient {
+  uint32_t nextMs;
+  bool busy;
+  HttpRequest request;
+};
+
+struct MqttMessage {
+  uint8_t target;
+  RequestKind kind;
+  String payload;
+};
+
+static HttpClient clients[HTTP_CLIENTS];
+static std::deque<HttpRequest> backlog;  // Connections waiting for handleClient()
+static std::deque<MqttMessage> inbound;  // At the broker, for us
+static bool wifiUp = true;
+static uint32_t wifiBackMs = 0;
+static bool brokerUp = true;
+static uint32_t brokerBackMs = 0;
+static bool subscribed = true;           // We're connected to the broker
+static uint32_t nextMqttMs = 0;
+
+/** A request body the way the apps send them, or a broken one */
+static String makeRequest(RequestKind kind) {
+  if(kind == Malformed) return "{\"method\":\"setSettings\",\"soundlevel\":";
+  if(kind == Oversized) {
+    String body = "{\"method\":\"setSettings\",\"input\":\"Input 1\",\"note\":\"";
+    while(body.length() <= REQUEST_MAX_SIZE) body += "0123456789abcdef";
+    return body + "\"}";
+  }
+  uint32_t pick = roll(100);
+  if(pick < 20) return "{\"method\":\"getSettings\"}";
+  if(pick < 28) {
+    return String("{\"method\":\"rampSoundLevel\",\"soundlevel\":") + String(10 + roll(40))
+      + ",\"duration\":" + String(1000 + roll(3000)) + "}";
+  }
+  if(pick < 32) {
+    return String("{\"method\":\"batch\",\"ops\":[{\"soundlevel\":") + String(10 + roll(40))
+      + "},{\"mute\":" + (roll(2) ? "true" : "false") + "}]}";
+  }
+  String body = "{\"method\":\"setSettings\"";
+  switch(roll(5)) {
+    case 0: body += String(",\"input\":\"") + inputs[roll(INPUT_COUNT)] + "\""; break;
+    case 1: body += String(",\"effect\":\"") + effects[roll(EFFECT_COUNT)] + "\""; break;
+    case 2: body += String(",\"mute\":") + (roll(2) ? "true" : "false"); break;
+    case 3: body += String(",\"basslevel\":") + String(10 + roll(30)); break;
+    default: body += String(",\"soundlevel\":") + String(10 + roll(40)); break;
+  }
+  return body + "}";
+}
+
+static RequestKind makeKind() {
+  uint32_t pick = roll(100);
+  if(pick < FAULT_PERCENT) return Malformed;
+  if(pick < 2 * FAULT_PERCENT) return Oversized;
+  return Valid;
+}
+
+/** Clients send while Wi-Fi is up, a drop cuts off what's waiting */
+static void httpClients(uint32_t now, bool inputs) {
+  for(uint8_t i = 0; i < HTTP_CLIENTS; i++) {
+    HttpClient& client = clients[i];
+    if(client.busy || !inputs || (int32_t)(now - client.nextMs) < 0 || !wifiUp) continue;
+    RequestKind kind = makeKind();
+    client.request = { i, (uint8_t)roll(UNIT_COUNT), kind, makeRequest(kind), now, now + roll(HTTP_DELAY_MS), false };
+    client.busy = true;
+    client.nextMs = now + 0x7FFFFFFF;
+    backlog.push_back(client.request);
+    report.httpSent++;
+  }
+}
+
+/** What the network context does with an event, like main.cpp's publishEvent() */
+static void publishEvent(const Event& event) {
+  if(event.payload.length() == 0) return;
+  if(subscribed) report.eventsOut++;
+  else report.eventsLost++;
+}
+
+/** Whatever the client makes of the answer */
+static void httpAnswer(HttpRequest& request, int status, uint32_t now) {
+  HttpClient& client = clients[request.client];
+  if(status == 503) {
+    report.retries++;
+    if(now - request.firstMs >= HTTP_PATIENCE) {
+      report.gaveUp++;
+      client.busy = false;
+      client.nextMs = now + think(HTTP_THINK_MS);
+      return;
+    }
+    // Retry-After: 1
+    client.request = request;
+    client.nextMs = now + 1000;
+    return;
+  }
+  // 202: queued behind a busy transmitter, the answer goes out on MQTT
+  bool expected = request.kind == Valid ? status == 200 || status == 202 : status == (request.kind == Malformed ? 400 : 413);
+  if(!expected) report.wrongStatus++;
+  if(request.kind != Valid && expected) report.refused++;
+  if(request.kind == Valid && expected) {
+    report.httpDone++;
+    if(status == 202) report.httpQueued++;
+    else if(!request.faulted) report.latencies.push_back(now - request.firstMs);
+  }
+  client.busy = false;
+  client.nextMs = now + think(HTTP_THINK_MS);
+}
+
+/** Clients waiting out a Retry-After or a Wi-Fi drop try again */
+static void httpRetries(uint32_t now) {
+  if(!wifiUp) return;
+  for(HttpClient& client : clients) {
+    if(!client.busy || (int32_t)(now - client.nextMs) < 0) continue;
+    bool waiting = false;
+    for(const HttpRequest& request : backlog) waiting |= request.client == client.request.client;
+    if(waiting) continue;
+    client.nextMs = now + 0x7FFFFFFF;
+    client.request.arrivesMs = now + roll(HTTP_DELAY_MS);
+    backlog.push_back(client.request);
+  }
+}
+
+static void wifiDrop(uint32_t now, uint32_t ms) {
+  wifiUp = false;
+  wifiBackMs = now + ms;
+  subscribed = false;
+  report.wifiDrops++;
+  for(HttpRequest& request : backlog) {
+    HttpClient& client = clients[request.client];
+    request.faulted = true;
+    client.request = request;
+    client.nextMs = wifiBackMs;
+    report.cutOff++;
+  }
+  backlog.clear();
+  for(HttpClient& client : clients) client.request.faulted |= client.busy;
+  report.mqttLost += inbound.size();
+  inbound.clear();
+}
+
+static void brokerRestart(uint32_t now, uint32_t ms) {
+  brokerUp = false;
+  brokerBackMs = now + ms;
+  subscribed = false;
+  report.brokerRestarts++;
+  report.mqttLost += inbound.size();
+  inbound.clear();
+}
+
+/** The home automation publishes now and then, the broker only passes it
+ *  on while we're subscribed */
+static void mqttPublisher(uint32_t now, bool inputs) {
+  if(!inputs || (int32_t)(now - nextMqttMs) < 0) return;
+  nextMqttMs = now + think(MQTT_THINK_MS);
+  if(!brokerUp) return;
+  RequestKind kind = roll(100) < FAULT_PERCENT ? Malformed : Valid;
+  String payload = makeRequest(kind);
+  if(payload.indexOf("\"get") >= 0) payload = "{\"method\":\"setSettings\",\"mute\":false}";
+  report.mqttSent++;
+  if(!subscribed) {
+    report.mqttLost++;
+    return;
+  }
+  inbound.push_back({ roll(3) == 0 ? (uint8_t)COMMAND_ALL : (uint8_t)roll(UNIT_COUNT), kind, payload });
+}
+
+/************************************ IR **************************************/
+
+struct RemoteFrame {
+  uint64_t start;   // Cycle count
+  uint64_t end;
+  uint32_t code;
+  bool heard;
+};
+
+static std::deque<RemoteFrame> remote;
+static bool suspended = false;          // main.cpp's irReceiveSuspended
+static uint32_t nextPressMs = 0;
+static uint32_t nextNoiseMs = 0;
+
+/** Schedules a press of the Z906 remote: Plus and Minus are held for a while */
+static void remotePresses(uint32_t now, bool inputs) {
+  if(!inputs || !remote.empty() || (int32_t)(now - nextPressMs) < 0) return;
+  nextPressMs = now + think(REMOTE_THINK_MS);
+  static const uint32_t keys[] = { PLUS_IR, MINUS_IR, PLUS_IR, MINUS_IR, MUTE_IR, INPUT_IR, EFFECT_IR };
+  uint32_t key = keys[roll(sizeof(keys) / sizeof(keys[0]))];
+  uint16_t repeats = isRepeatableKey(key) ? roll(15) : 0;
+  uint64_t frameLength = microsecondsToClockCycles((uint64_t)necDuration(necWaveforms[0].timings, NEC_FRAME_LENGTH));
+  uint64_t repeatLength = microsecondsToClockCycles((uint64_t)necDuration(necRepeatWaveform, NEC_REPEAT_LENGTH));
+  uint64_t at = hostClock.cycles;
+  for(uint16_t i = 0; i <= repeats; i++) {
+    remote.push_back({ at, at + (i == 0 ? frameLength : repeatLength), i == 0 ? key : NEC_REPEAT, true });
+    at += microsecondsToClockCycles((uint64_t)NEC_FRAME_PERIOD);
+  }
+}
+
+/************************************ Loop ************************************/
+
+/** One pass of main.cpp's loop(): the tasks due, the network context, the
+ *  IR context. Then the amps take what's on the air and the clock moves on */
+static void pass(bool inputs) {
+  uint32_t now = millis();
+  // The world
+  if(!wifiUp && (int32_t)(now - wifiBackMs) >= 0) wifiUp = true;
+  if(!brokerUp && (int32_t)(now - brokerBackMs) >= 0) brokerUp = true;
+  httpClients(now, inputs);
+  httpRetries(now);
+  mqttPublisher(now, inputs);
+  remotePresses(now, inputs);
+  if(suspended) {
+    for(RemoteFrame& frame : remote) {
+      if(frame.start <= hostClock.cycles && hostClock.cycles < frame.end) frame.heard = false;
+    }
+  }
+
+  uint64_t started = hostClock.cycles;
+  {
+    Firmware firmware;
+    // Tasks
+    if(now % ON_LED_MS == 0) {
+      for(Z906Controller& controller : controllers) {
+        bool wasOn = controller.isOn;
+        controller.checkIfStillOn();
+        controller.recordChanges(SourcePower);
+        if(controller.isOn == wasOn) continue;
+        activity.wake("power");
+        activity.handled();
+      }
+    }
+    if(now % MQTT_CHECK_MS == 0 && !subscribed && wifiUp) {
+      stats.mqttReconnects++;
+      subscribed = brokerUp;
+    }
+    if(now % ON_LED_MS == 0 && !wifiUp && report.wifiDrops > stats.wifiDrops) stats.wifiDrops++;
+
+    // Network context: one connection and one packet per pass, like
+    // handleClient() and mqttclient.loop()
+    if(wifiUp && !backlog.empty() && (int32_t)(now - backlog.front().arrivesMs) >= 0) {
+      HttpRequest request = backlog.front();
+      backlog.pop_front();
+      String response;
+      int status = router.post(request.target, request.body, response);
+      hostHeap.counting = false;
+      httpAnswer(request, status, now);
+      hostHeap.counting = true;
+    }
+    if(subscribed && !inbound.empty()) {
+      MqttMessage message = inbound.front();
+      inbound.pop_front();
+      String error;
+      bool queued = router.receive(message.target, message.payload, error);
+      if(message.kind == Malformed) {
+        if(queued) report.wrongStatus++;
+        else report.mqttMalformed++;
+      } else if(queued) {
+        report.mqttQueued++;
+      } else {
+        report.mqttDropped++;
+      }
+    }
+    Event event;
+    for(uint8_t i = 0; i < 4 && router.popEvent(event); i++) publishEvent(event);
+
+    // IR context
+    Z906Controller& receiving = controllers[RECV_IR_UNIT];
+    if(inputs && (int32_t)(now - nextNoiseMs) >= 0) {
+      nextNoiseMs = now + think(NOISE_THINK_MS);
+      if(!suspended) {
+        receiving.missedFrame();
+        report.noise++;
+      }
+    }
+    if(!remote.empty() && remote.front().end <= hostClock.cycles) {
+      RemoteFrame frame = remote.front();
+      remote.pop_front();
+      report.remoteFrames++;
+      amps[RECV_IR_UNIT].frame(frame.code, now);
+      if(frame.heard) {
+        // The amp can take a repeat for one of ours, we can't know that
+        uint32_t key = heardHold.onFrame(frame.code, now);
+        if(frame.code != NEC_REPEAT || isRepeatableKey(key)) heard[RECV_IR_UNIT].state.applyKey(key);
+        heard[RECV_IR_UNIT].lastFrameMs = now;
+        activity.wake("ir");
+        receiving.receiveIR(decode_type_t::NEC, frame.code, NEC_BITS, frame.code == NEC_REPEAT);
+        receiving.recordChanges(SourceRemote);
+        activity.handled();
+      } else {
+        report.remoteUnheard++;
+      }
+    }
+    router.runNext();
+    for(Z906Controller& controller : controllers) controller.service();
+    if(suspended && !IRTransmitter::anyOnAir()) suspended = false;
+
+    stats.loopPass((hostClock.cycles - started) / clockCyclesPerMicrosecond());
+    stats.sampleHeap();
+  }
+
+  for(uint8_t i = 0; i < UNIT_COUNT; i++) {
+    std::vector<uint32_t> codes;
+    leds[i].poll(irPins[i], codes);
+    for(uint32_t code : codes) {
+      amps[i].frame(code, now);
+      heard[i].frame(code, now);
+    }
+  }
+  hostAdvance(1000);
+}
+
+/** Nothing left to send or to hand over */
+static bool settled() {
+  return router.commands.empty() && router.events.empty() && !IRTransmitter::anyBusy() && remote.empty()
+    && backlog.empty() && inbound.empty();
+}
+
+/** A round of inputs and faults, then quiet until it settles. Checks the
+ *  believed state against the amps */
+static void round() {
+  uint32_t start = millis();
+  int32_t brokerAt = roll(3) == 0 ? 5000 + roll(25000) : -1;
+  int32_t wifiAt = roll(4) == 0 ? 5000 + roll(25000) : -1;
+  while(millis() - start < ROUND_INPUT_MS) {
+    uint32_t at = millis() - start;
+    if((int32_t)at == brokerAt) brokerRestart(millis(), 1000 + roll(7000));
+    if((int32_t)at == wifiAt) wifiDrop(millis(), 1000 + roll(9000));
+    pass(true);
+  }
+  while(millis() - start < ROUND_MS) pass(false);
+  uint32_t late = millis();
+  while(!settled() && millis() - late < SETTLE_LIMIT) pass(false);
+  // Clients still waiting out a Retry-After
+  for(uint32_t ms = 0; ms < HTTP_PATIENCE + 1000; ms++) {
+    bool busy = false;
+    for(HttpClient& client : clients) busy |= client.busy;
+    if(!busy && settled()) break;
+    pass(false);
+  }
+  if(!settled()) report.unsettled++;
+
+  // Without the remote's unheard frames the amp has to be where we think,
+  // with them it may be elsewhere
+  for(uint8_t i = 0; i < UNIT_COUNT; i++) {
+    amps[i].idle(millis());
+    heard[i].idle(millis());
+    std::string unexplained = divergence(controllers[i].state, heard[i].state);
+    if(!unexplained.empty()) {
+      report.divergedUnexplained++;
+      printf("Round %u: unit %u diverged on %s\n", report.rounds, i, unexplained.c_str());
+    } else if(!divergence(controllers[i].state, amps[i].state).empty()) {
+      report.divergedExplained++;
+    }
+  }
+  report.rounds++;
+}
+
+static uint32_t percentile(std::vector<uint32_t> values, uint8_t percent) {
+  if(values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  return values[(values.size() - 1) * percent / 100];
+}
+
+static void printReport() {
+  printf("Soak: %u rounds, %u HTTP requests (%u retries, %u answered on MQTT, %u cut off by Wi-Fi), %u MQTT messages\n",
+    report.rounds, report.httpSent, report.retries, report.httpQueued, report.cutOff, report.mqttSent);
+  printf("Faults: %u broker restarts, %u Wi-Fi drops, %u noise, %u broken requests refused\n",
+    report.brokerRestarts, report.wifiDrops, report.noise, report.refused + report.mqttMalformed);
+  printf("Latency (ms): HTTP p50 %u p99 %u max %u, queued p99 %u (RuntimeStats)\n",
+    percentile(report.latencies, 50), percentile(report.latencies, 99), percentile(report.latencies, 100),
+    stats.latencyPercentile(99));
+  printf("Dropped: %u HTTP gave up, %u MQTT queue full, %u wrong answers. Lost to faults: %u MQTT, %u events\n",
+    report.gaveUp, report.mqttDropped, report.wrongStatus, report.mqttLost, report.eventsLost);
+  printf("Heap: %u bytes at the high-water mark, %u after the first round, %ld leaked, low %u free\n",
+    (unsigned)report.heapPeak, (unsigned)report.heapBaseline, report.heapLeaked, stats.heapLow);
+  printf("Remote: %u frames, %u unheard. Diverged: %u rounds the remote accounts for, %u otherwise, %u unsettled\n",
+    report.remoteFrames, report.remoteUnheard, report.divergedExplained, report.divergedUnexplained, report.unsettled);
+}
+
+/** Runs the soak once, the tests share its report */
+static void soak() {
+  if(soaked) return;
+  soaked = true;
+  const char* minutes = getenv("SOAK_MINUTES");
+  const char* day = getenv("SOAK_SEED");
+  seed = day ? strtoul(day, NULL, 10) : SOAK_SEED;
+  if(!seed) seed = SOAK_SEED;
+  uint32_t rounds = (minutes ? strtoul(minutes, NULL, 10) : SOAK_MINUTES) * 60000 / ROUND_MS;
+
+  router.begin(controllers, UNIT_COUNT);
+  router.onWake = [](const char* reason) { activity.wake(reason); };
+  router.onWait = []() { return router.runNext(); };
+  router.onEvent = publishEvent;
+  IRTransmitter::onSend = []() { suspended = true; };
+  for(uint8_t i = 0; i < UNIT_COUNT; i++) {
+    Firmware firmware;
+    controllers[i].begin(SOAK_ROOT);
+    digitalWrite(onLedPins[i], HIGH);
+    controllers[i].checkIfStillOn();
+    amps[i] = { controllers[i].state, 0, 0 };
+    heard[i] = amps[i];
+  }
+  for(HttpClient& client : clients) client.nextMs = think(HTTP_THINK_MS);
+  stats.reset();
+
+  for(uint32_t i = 0; i < rounds; i++) {
+    round();
+    if(i == 0) {
+      report.heapBaseline = hostHeap.live;
+      hostHeap.peak = hostHeap.live;
+    }
+  }
+  report.heapPeak = hostHeap.peak;
+  report.heapLeaked = (long)hostHeap.live - (long)report.heapBaseline;
+  printReport();
+}
+
+void setUp() {
+  soak();
+}
+
+void tearDown() {}
+
+/** Every valid command ran, MQTT only loses what the faults took */
+void test_no_command_is_dropped() {
+  TEST_ASSERT_GREATER_THAN(0, report.httpDone);
+  TEST_ASSERT_GREATER_THAN(0, report.mqttQueued);
+  TEST_ASSERT_EQUAL_UINT32(0, report.gaveUp);
+  TEST_ASSERT_EQUAL_UINT32(0, report.mqttDropped);
+  TEST_ASSERT_EQUAL_UINT32(0, report.wrongStatus);
+  TEST_ASSERT_EQUAL_UINT32(0, router.events.dropped.load());
+}
+
+/** Malformed and oversized requests are refused and counted, never run */
+void test_broken_requests_are_refused() {
+  TEST_ASSERT_GREATER_THAN(0, report.refused);
+  TEST_ASSERT_EQUAL_UINT32(report.refused + report.mqttMalformed, stats.malformed + stats.oversized);
+  TEST_ASSERT_EQUAL_UINT32(report.wifiDrops, stats.wifiDrops);
+}
+
+void test_tail_latency() {
+  TEST_ASSERT_LESS_OR_EQUAL(SOAK_HTTP_P99, percentile(report.latencies, 99));
+  TEST_ASSERT_LESS_OR_EQUAL(STATS_LATENCY_LIMIT, stats.latencyPercentile(99));
+  // Nothing in the loop waits on the host clock
+  TEST_ASSERT_EQUAL_UINT32(0, stats.maxLoop);
+}
+
+/** The firmware stays over its heap floor and gives back what it took */
+void test_heap() {
+#if defined(__GLIBC__)
+  TEST_ASSERT_EQUAL_UINT32(0, untrackable);
+  TEST_ASSERT_GREATER_THAN(0, report.heapPeak);
+#endif
+  TEST_ASSERT_TRUE(stats.healthy());
+  TEST_ASSERT_GREATER_OR_EQUAL(STATS_HEAP_FLOOR, stats.heapLow);
+  TEST_ASSERT_LESS_OR_EQUAL(SOAK_LEAK_BYTES, report.heapLeaked);
+}
+
+/** The amps end every round where we believe they are, unless the remote
+ *  was pressed while the receiver was off for our own IR */
+void test_state_follows_the_amps() {
+  TEST_ASSERT_EQUAL_UINT32(0, report.unsettled);
+  TEST_ASSERT_EQUAL_UINT32(0, report.divergedUnexplained);
+}
+
+int main() {
+  EEPROM.begin(512);
+  LittleFS.begin();
+  scenes.begin();
+  bindings.begin();
+  history.begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_no_command_is_dropped);
+  RUN_TEST(test_broken_requests_are_refused);
+  RUN_TEST(test_tail_latency);
+  RUN_TEST(test_heap);
+  RUN_TEST(test_state_follows_the_amps);
+  return UNITY_END();
+}
@@ -0,0 +1,82 @@
+#include <unity.h>
+#include <string>
+#include <thread>
+
+#include "SpscQueue.hpp"
+
+/* The queues are used from two cooperative contexts on the board, here the
+ * producer and consumer are real threads. Built with -fsanitize=thread
+ * (pio test -e native_tsan) a missing acquire/release shows up as a race */
+
+#define ITEMS 200000
+
+struct Item {
+  uint32_t seq;
+  std::string payload;  // Owns heap memory, so a torn hand-over is a use after free
+};
+
+static std::string payloadFor(uint32_t seq) {
+  return "{\"method\":\"getSettings\",\"seq\":" + std::to_string(seq) + "}";
+}
+
+void setUp() {}
+void tearDown() {}
+
+/** Everything that was accepted comes out once, in order and intact */
+void test_two_threads_hand_over_every_item() {
+  static SpscQueue<Item, 8> queue;
+  uint32_t refused = 0;
+  std::thread producer([&refused]() {
+    for(uint32_t seq = 0; seq < ITEMS; seq++) {
+      Item item;
+      item.seq = seq;
+      item.payload = payloadFor(seq);
+      while(!queue.push(item)) {
+        refused++;
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  uint32_t expected = 0;
+  uint32_t broken = 0;
+  Item item;
+  while(expected < ITEMS) {
+    Item* next = queue.front();
+    if(!next) {
+      std::this_thread::yield();
+      continue;
+    }
+    if(next->seq != expected) broken++;
+    TEST_ASSERT_TRUE(queue.pop(item));
+    if(item.seq != expected || item.payload != payloadFor(expected)) broken++;
+    expected++;
+  }
+  producer.join();
+
+  TEST_ASSERT_EQUAL_UINT32(0, broken);
+  TEST_ASSERT_TRUE(queue.empty());
+  TEST_ASSERT_EQUAL_UINT32(refused, queue.dropped.load());
+}
+
+/** A full queue refuses instead of waiting, and the size is right from both sides */
+void test_full_queue_refuses() {
+  SpscQueue<Item, 4> queue;
+  for(uint32_t seq = 0; seq < 4; seq++) TEST_ASSERT_TRUE(queue.push(Item{ seq, payloadFor(seq) }));
+  TEST_ASSERT_TRUE(queue.full());
+  TEST_ASSERT_FALSE(queue.push(Item{ 4, payloadFor(4) }));
+  TEST_ASSERT_EQUAL_UINT32(1, queue.dropped.load());
+  TEST_ASSERT_EQUAL_UINT32(0, queue.front()->seq);
+  Item item;
+  TEST_ASSERT_TRUE(queue.pop(item));
+  TEST_ASSERT_EQUAL_UINT32(3, queue.size());
+  TEST_ASSERT_TRUE(queue.push(Item{ 4, payloadFor(4) }));
+  TEST_ASSERT_EQUAL_UINT32(1, queue.front()->seq);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_two_threads_hand_over_every_item);
+  RUN_TEST(test_full_queue_refuses);
+  return UNITY_END();
+}
@@ -0,0 +1,66 @@
+#include <unity.h>
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#include "StateHistory.h"
+
+/* Reboots are a new StateHistory on the same host file system, what was
+ * only in RAM is gone like after a reset */
+
+static uint32_t lastSeq;
+static uint16_t lastBoot;
+
+static bool keepLast(const StateHistory::Entry& entry, void*) {
+  lastSeq = entry.seq;
+  lastBoot = entry.boot;
+  return true;
+}
+
+void setUp() {
+  hostFs.files.clear();
+  LittleFS.begin();
+}
+
+void tearDown() {}
+
+/** A ring that never rolled over still counts boots and never reuses a sequence number */
+void test_boot_and_seq_survive_without_rollover() {
+  StateHistory* first = new StateHistory();
+  first->begin();
+  for(uint8_t i = 0; i < 10; i++) first->record(0, SourceHttp, 0, i);
+  first->read(0, keepLast, NULL);
+  TEST_ASSERT_EQUAL_UINT16(0, lastBoot);
+  uint32_t used = lastSeq;
+  delete first;
+
+  StateHistory* second = new StateHistory();
+  second->begin();
+  second->record(0, SourceRemote, 0, 1);
+  second->read(0, keepLast, NULL);
+  TEST_ASSERT_EQUAL_UINT16(1, lastBoot);
+  TEST_ASSERT_GREATER_THAN(used, lastSeq);
+  TEST_ASSERT_EQUAL_UINT32(lastSeq, second->firstSeq);
+  delete second;
+}
+
+/** Running past the reserved numbers reserves more before handing them out */
+void test_seq_past_the_reserve_survives() {
+  StateHistory* first = new StateHistory();
+  first->begin();
+  for(uint16_t i = 0; i < HISTORY_SEQ_RESERVE + 5; i++) first->record(0, SourceHttp, 0, i);
+  uint32_t next = first->nextSeq;
+  delete first;
+
+  StateHistory* second = new StateHistory();
+  second->begin();
+  TEST_ASSERT_GREATER_OR_EQUAL(next, second->nextSeq);
+  delete second;
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_boot_and_seq_survive_without_rollover);
+  RUN_TEST(test_seq_past_the_reserve_survives);
+  return UNITY_END();
+}
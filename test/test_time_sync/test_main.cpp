@@ -0,0 +1,219 @@
+#include <unity.h>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <LittleFS.h>
+#include <ESP8266WiFi.h>
+#include <esp8266_peri.h>
+
+#include "TimeSync.h"
+#include "Z906Controller.h"
+
+/* Three units on the host LAN, each with its own chip id, address and a
+ * clock that is off by skewMs, and an amp. Switching the host's skew, chip
+ * id and address and the shared clock the controllers read before every
+ * call makes each instance see only its own world */
+
+#define UNIT_COUNT 3
+
+struct Unit {
+  uint32_t chipId;
+  int32_t skewMs;
+  IPAddress ip;
+  bool running;
+  TimeSync sync;
+};
+
+static Unit units[UNIT_COUNT] = {
+  { 0x300, 0, IPAddress(10, 0, 0, 1), true, TimeSync() },
+  { 0x100, 5000, IPAddress(10, 0, 0, 2), true, TimeSync() },   // Lowest id, the reference
+  { 0x200, -12345, IPAddress(10, 0, 0, 3), true, TimeSync() },
+};
+
+static const uint8_t irPins[UNIT_COUNT] = { 4, 5, 12 };
+static Z906Controller controllers[UNIT_COUNT] = {
+  Z906Controller("", 4, 0, 0),
+  Z906Controller("", 5, 1, 1),
+  Z906Controller("", 12, 2, 2),
+};
+
+static void enter(Unit& unit) {
+  hostClock.millisSkew = unit.skewMs;
+  ESP.chipId = unit.chipId;
+  hostLan.localIP = unit.ip;
+  timeSync.offset = unit.sync.offset;
+}
+
+/** The shared clock as unit sees it */
+static uint32_t sharedNow(Unit& unit) {
+  enter(unit);
+  return unit.sync.now();
+}
+
+/** Runs the running units for ms, one handle() and service() each per ms */
+static void run(uint32_t ms) {
+  while(ms--) {
+    for(uint8_t i = 0; i < UNIT_COUNT; i++) {
+      if(!units[i].running) continue;
+      enter(units[i]);
+      units[i].sync.handle();
+      controllers[i].service();
+    }
+    hostAdvance(1000);
+  }
+}
+
+/** The shared time, as unit i has it, at which its LED first lit */
+static uint32_t firstFrameAt(uint8_t i) {
+  uint64_t cycles = hostWaveform[irPins[i]].front().at;
+  return (uint32_t)(cycles / (F_CPU / 1000)) + units[i].skewMs + units[i].sync.offset;
+}
+
+/** Hands req to every unit, as the broker delivers it: one after the other */
+static void deliver(const String& req, String responses[UNIT_COUNT]) {
+  for(uint8_t i = 0; i < UNIT_COUNT; i++) {
+    enter(units[i]);
+    responses[i] = controllers[i].handleJSONReq(req);
+    run(37);
+  }
+}
+
+/** How far unit's shared clock is from the reference's */
+static int32_t error(Unit& unit, Unit& reference) {
+  return (int32_t)(sharedNow(unit) - sharedNow(reference));
+}
+
+void setUp() {
+  hostLan.delayMs = 3;
+  hostLan.extraDelayMs.clear();
+  for(Unit& unit : units) {
+    unit.running = true;
+    unit.sync = TimeSync();
+    enter(unit);
+    unit.sync.begin();
+  }
+  for(uint8_t i = 0; i < UNIT_COUNT; i++) {
+    digitalWrite(i, HIGH);
+    controllers[i].checkIfStillOn();
+    controllers[i].state.soundLevel[0] = 0;
+  }
+  for(HostEdges& edges : hostWaveform) edges.clear();
+}
+
+void tearDown() {}
+
+void test_units_follow_the_lowest_id() {
+  run(3 * TIME_SYNC_INTERVAL);
+  for(Unit& unit : units) {
+    enter(unit);
+    TEST_ASSERT_TRUE(unit.sync.synced());
+    TEST_ASSERT_EQUAL(unit.chipId == 0x100, unit.sync.isReference());
+  }
+  // Symmetric paths, the NTP offset is exact up to the 1 ms clock resolution
+  TEST_ASSERT_LESS_OR_EQUAL(1, abs(error(units[0], units[1])));
+  TEST_ASSERT_LESS_OR_EQUAL(1, abs(error(units[2], units[1])));
+  TEST_ASSERT_EQUAL_INT32(5000, units[0].sync.offset);
+  TEST_ASSERT_EQUAL_INT32(5000 + 12345, units[2].sync.offset);
+  TEST_ASSERT_EQUAL_UINT32(2 * 3, units[0].sync.roundTrip);
+}
+
+void test_asymmetric_path_costs_half_the_difference() {
+  // Everything unit 2 sends takes 20 ms longer. NTP splits the round trip
+  // evenly, so it puts the reference 10 ms later than it is
+  hostLan.extraDelayMs[units[2].ip.v4()] = 20;
+  run(3 * TIME_SYNC_INTERVAL);
+  TEST_ASSERT_EQUAL_UINT32(2 * 3 + 20, units[2].sync.roundTrip);
+  int32_t err = error(units[2], units[1]);
+  TEST_ASSERT_TRUE(err >= 9 && err <= 11);
+}
+
+void test_shortest_round_trip_wins() {
+  run(2 * TIME_SYNC_INTERVAL);
+  // A congested spell: the next requests see a long, one-sided delay
+  hostLan.extraDelayMs[units[0].ip.v4()] = 40;
+  run(2 * TIME_SYNC_INTERVAL);
+  TEST_ASSERT_EQUAL_UINT32(2 * 3, units[0].sync.roundTrip);
+  TEST_ASSERT_LESS_OR_EQUAL(1, abs(error(units[0], units[1])));
+}
+
+void test_a_silent_reference_is_replaced() {
+  run(2 * TIME_SYNC_INTERVAL);
+  units[1].running = false;
+  run(TIME_SYNC_EXPIRE + 3 * TIME_SYNC_INTERVAL);
+  enter(units[2]);
+  TEST_ASSERT_TRUE(units[2].sync.isReference());
+  enter(units[0]);
+  TEST_ASSERT_FALSE(units[0].sync.isReference());
+  TEST_ASSERT_TRUE(units[0].sync.synced());
+  TEST_ASSERT_LESS_OR_EQUAL(1, abs(error(units[0], units[2])));
+}
+
+/** A command scheduled on the shared clock goes out at the same instant on
+ *  every unit, no matter when the broker got it to them or how far their
+ *  own clocks are apart */
+void test_scheduled_command_runs_at_the_same_instant() {
+  run(3 * TIME_SYNC_INTERVAL);
+  uint32_t at = sharedNow(units[1]) + 500;
+  String responses[UNIT_COUNT];
+  deliver(String("{\"method\":\"setSettings\",\"soundlevel\":5,\"at\":") + at + "}", responses);
+  for(uint8_t i = 0; i < UNIT_COUNT; i++) {
+    TEST_ASSERT_NOT_EQUAL(-1, responses[i].indexOf("scheduled"));
+    TEST_ASSERT_TRUE(hostWaveform[irPins[i]].empty());
+  }
+
+  run(1000);
+  for(uint8_t i = 0; i < UNIT_COUNT; i++) {
+    TEST_ASSERT_FALSE(hostWaveform[irPins[i]].empty());
+    // Within the ms the loop passes take and the 1 ms the clocks may be apart
+    int32_t late = (int32_t)(firstFrameAt(i) - at);
+    TEST_ASSERT_TRUE(late >= 0 && late <= 2);
+    TEST_ASSERT_EQUAL_INT8(5, controllers[i].state.soundLevel[0]);
+  }
+  // The same instant on the host clock too, whatever the unit clocks say
+  uint64_t first = hostWaveform[irPins[0]].front().at;
+  for(uint8_t i = 1; i < UNIT_COUNT; i++) {
+    int64_t apart = (int64_t)(hostWaveform[irPins[i]].front().at - first) / clockCyclesPerMicrosecond();
+    TEST_ASSERT_TRUE(apart > -2000 && apart < 2000);
+  }
+}
+
+/** Only the units in the group a command names run it */
+void test_group_command_skips_other_groups() {
+  controllers[0].group = "upstairs";
+  controllers[1].group = "upstairs";
+  controllers[2].group = "patio";
+  run(3 * TIME_SYNC_INTERVAL);
+  uint32_t at = sharedNow(units[1]) + 500;
+  String responses[UNIT_COUNT];
+  deliver(String("{\"method\":\"setSettings\",\"soundlevel\":5,\"group\":\"upstairs\",\"at\":") + at + "}", responses);
+  TEST_ASSERT_NOT_EQUAL(-1, responses[0].indexOf("scheduled"));
+  TEST_ASSERT_NOT_EQUAL(-1, responses[1].indexOf("scheduled"));
+  TEST_ASSERT_EQUAL_STRING("", responses[2].c_str());
+
+  run(1000);
+  TEST_ASSERT_EQUAL_INT8(5, controllers[0].state.soundLevel[0]);
+  TEST_ASSERT_EQUAL_INT8(5, controllers[1].state.soundLevel[0]);
+  TEST_ASSERT_EQUAL_INT8(0, controllers[2].state.soundLevel[0]);
+  TEST_ASSERT_TRUE(hostWaveform[irPins[2]].empty());
+
+  // Every controller is in GROUP_ALL
+  deliver("{\"method\":\"setSettings\",\"soundlevel\":7,\"group\":\"" GROUP_ALL "\"}", responses);
+  run(1000);
+  for(Z906Controller& controller : controllers) TEST_ASSERT_EQUAL_INT8(7, controller.state.soundLevel[0]);
+  for(Z906Controller& controller : controllers) controller.group = "";
+}
+
+int main() {
+  EEPROM.begin(512);
+  LittleFS.begin();
+  bindings.begin();
+  for(Z906Controller& controller : controllers) controller.begin("speaker/logitech_z906");
+  UNITY_BEGIN();
+  RUN_TEST(test_units_follow_the_lowest_id);
+  RUN_TEST(test_asymmetric_path_costs_half_the_difference);
+  RUN_TEST(test_shortest_round_trip_wins);
+  RUN_TEST(test_a_silent_reference_is_replaced);
+  RUN_TEST(test_scheduled_command_runs_at_the_same_instant);
+  RUN_TEST(test_group_command_skips_other_groups);
+  return UNITY_END();
+}
@@ -0,0 +1,318 @@
+#include <unity.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <esp8266_peri.h>
+#include <Z906Amp.h>
+
+#include "CommandRouter.h"
+#include "TraceBuffer.h"
+#include "SceneStore.h"
+#include "StateHistory.h"
+#include "IRBindings.h"
+#include "RuntimeStats.h"
+
+/* Plays a trace downloaded from GET /trace back against the firmware, handed
+ * over the way main.cpp does it: HTTP bodies through router.post(), MQTT
+ * payloads through router.receive(), the remote's frames through
+ * receiveIR() and on-led changes through checkIfStillOn(), each at its
+ * recorded time on the host clock. The loop
+ * (router.runNext(), service()) runs every ms in between.
+ * An amp model takes the remote's frames and the ones decoded off the IR
+ * LED. The report lists the frames sent, how long every input took and
+ * where the believed state and the amp parted ways.
+ * TRACE_FILE replays another trace than the sample */
+
+#define REPLAY_ROOT     "speaker/logitech_z906"
+#define SETTLE_LIMIT    15000 // ms an input may take to get off the air
+
+/** A trace record, at is ms since the first one */
+struct TraceEvent {
+  uint32_t at;
+  TraceBuffer::Kind kind;
+  uint8_t unit;
+  std::string payload;
+};
+
+/** What became of one input */
+struct EventReport {
+  uint32_t at;
+  TraceBuffer::Kind kind;
+  int status;             // HTTP status, or 200/503 for queued MQTT and 400 when dropped
+  int32_t settledMs;      // Until nothing was queued or on the air, -1 if never
+  std::string divergence; // Fields believed and amp disagree on once settled
+
+  bool operator==(const EventReport& other) const {
+    return at == other.at && kind == other.kind && status == other.status && settledMs == other.settledMs
+      && divergence == other.divergence;
+  }
+};
+
+struct Report {
+  std::vector<uint32_t> sent;   // Frames off the IR LED, NEC_REPEAT for repeats
+  std::vector<EventReport> events;
+  std::string divergence;       // At the end of the trace
+};
+
+/** Parses a GET /trace download, false if it isn't one, is cut short or
+ *  spans more than millis() can tell apart */
+static bool parseTrace(const std::string& data, std::vector<TraceEvent>& events) {
+  TraceBuffer::FileHeader header;
+  if(data.size() < sizeof(header)) return false;
+  memcpy(&header, data.data(), sizeof(header));
+  if(memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) return false;
+
+  // Records are placed by their age at the download, which holds across a
+  // wrap of millis(). Ages shrink towards the newest record, unless one is
+  // older than a whole turn of it
+  size_t i = sizeof(header);
+  uint32_t firstAge = 0;
+  uint32_t lastAge = 0;
+  while(i + TRACE_RECORD_HEADER <= data.size()) {
+    const uint8_t* record = (const uint8_t*)data.data() + i;
+    uint32_t age = header.now - (record[0] | record[1] << 8 | record[2] << 16 | (uint32_t)record[3] << 24);
+    size_t length = record[5];
+    if(i + TRACE_RECORD_HEADER + length > data.size()) return false;
+    if(events.empty()) firstAge = age;
+    else if(age > lastAge) return false;
+    lastAge = age;
+    events.push_back({ firstAge - age, (TraceBuffer::Kind)(record[4] >> 4), (uint8_t)(record[4] & 0x0F),
+      std::string((const char*)record + TRACE_RECORD_HEADER, length) });
+    i += TRACE_RECORD_HEADER + length;
+  }
+  return i == data.size();
+}
+
+static bool loadTrace(const char* path, std::vector<TraceEvent>& events) {
+  FILE* file = fopen(path, "rb");
+  if(!file) return false;
+  std::string data;
+  char buffer[512];
+  size_t read;
+  while((read = fread(buffer, 1, sizeof(buffer), file)) > 0) data.append(buffer, read);
+  fclose(file);
+  return parseTrace(data, events);
+}
+
+/** The sample next to this suite unless TRACE_FILE says otherwise */
+static std::string tracePath() {
+  const char* path = getenv("TRACE_FILE");
+  if(path) return path;
+  std::string file = __FILE__;
+  return file.substr(0, file.find_last_of("/\\") + 1) + "../traces/sample.z9t";
+}
+
+static std::vector<TraceEvent> events;
+
+/* Every replay gets a controller of its own, on its own pins and EEPROM slot */
+static Z906Controller units[] = { Z906Controller("", 4, 5, 0), Z906Controller("", 12, 13, 1), Z906Controller("", 14, 15, 2) };
+static const uint8_t irPins[] = { 4, 12, 14 };
+static const uint8_t onLedPins[] = { 5, 13, 15 };
+
+/** Hands one input to the firmware like main.cpp does */
+static int dispatch(Z906Controller& controller, const TraceEvent& event) {
+  String payload(event.payload);
+  String response;
+  switch(event.kind) {
+    case TraceBuffer::Http:
+      return router.post(0, payload, response);
+    case TraceBuffer::Mqtt: {
+      uint32_t malformed = stats.malformed;
+      if(router.receive(event.unit == (COMMAND_ALL & 0x0F) ? COMMAND_ALL : 0, payload, response)) return 200;
+      return stats.malformed != malformed ? 400 : 503;
+    }
+    case TraceBuffer::IRFrame: {
+      uint32_t code;
+      if(event.payload.size() != sizeof(code)) return 400;
+      memcpy(&code, event.payload.data(), sizeof(code));
+      controller.receiveIR(decode_type_t::NEC, code, NEC_BITS, code == NEC_REPEAT);
+      controller.recordChanges(SourceRemote);
+      return 200;
+    }
+    case TraceBuffer::OnLed:
+      if(event.payload.size() != 1) return 400;
+      digitalWrite(onLedPins[&controller - units], event.payload[0] ? HIGH : LOW);
+      controller.checkIfStillOn();
+      return 200;
+    default:
+      // IRSent is what the recording unit sent, we report our own
+      return 0;
+  }
+}
+
+/** Replays events on units[unit] from a clock at 0, like after a boot */
+static Report replay(uint8_t unit) {
+  Z906Controller& controller = units[unit];
+  TEST_ASSERT_FALSE(IRTransmitter::anyBusy());
+  hostClock.cycles = 0;
+  uint8_t irPin = irPins[unit];
+  router.begin(&controller, 1);
+  router.onWait = []() { return router.runNext(); };
+  digitalWrite(onLedPins[unit], LOW);
+  controller.begin(REPLAY_ROOT);
+  controller.checkIfStillOn();
+  hostWaveform[irPin].clear();
+
+  Report report;
+  AmpModel amp = { controller.state, 0, 0 };
+  LedDecoder led;
+  std::vector<size_t> unsettled;
+  uint64_t start = hostClock.cycles;
+  auto nowMs = [start]() { return (uint32_t)((hostClock.cycles - start) / (F_CPU / 1000)); };
+
+  // One pass of the loop: the IR context and the amp watching the LED
+  auto pass = [&]() {
+    router.runNext();
+    controller.service();
+    Event event;
+    while(router.popEvent(event)) {}
+    std::vector<uint32_t> codes;
+    led.poll(irPin, codes);
+    for(uint32_t code : codes) {
+      report.sent.push_back(code);
+      amp.frame(code, nowMs());
+    }
+    if(unsettled.empty() || !router.commands.empty() || IRTransmitter::anyBusy()) return;
+    amp.idle(nowMs());
+    for(size_t i : unsettled) {
+      EventReport& settled = report.events[i];
+      settled.settledMs = nowMs() - settled.at;
+      settled.divergence = divergence(controller.state, amp.state);
+    }
+    unsettled.clear();
+  };
+  auto runUntil = [&](uint64_t due) {
+    while(hostClock.cycles < due) {
+      pass();
+      uint64_t left = (due - hostClock.cycles) / clockCyclesPerMicrosecond();
+      hostAdvance(left > 1000 ? 1000 : (left > 0 ? left : 1));
+    }
+  };
+
+  for(const TraceEvent& event : events) {
+    if(event.unit != 0 && event.unit != (COMMAND_ALL & 0x0F)) continue;
+    if(event.kind == TraceBuffer::IRSent) continue;
+    runUntil(start + (uint64_t)event.at * (F_CPU / 1000));
+    if(event.kind == TraceBuffer::IRFrame && event.payload.size() == sizeof(uint32_t)) {
+      uint32_t code;
+      memcpy(&code, event.payload.data(), sizeof(code));
+      amp.frame(code, nowMs());
+    }
+    if(event.kind == TraceBuffer::OnLed && event.payload.size() == 1) amp.power(event.payload[0]);
+    int status = dispatch(controller, event);
+    report.events.push_back({ event.at, event.kind, status, -1, "" });
+    unsettled.push_back(report.events.size() - 1);
+  }
+  runUntil(hostClock.cycles + microsecondsToClockCycles((uint64_t)SETTLE_LIMIT * 1000));
+  std::vector<uint32_t> codes;
+  led.decoder.feed(20000, false);
+  if(led.decoder.available()) codes.push_back(led.decoder.read());
+  for(uint32_t code : codes) report.sent.push_back(code);
+  amp.idle(nowMs());
+  report.divergence = divergence(controller.state, amp.state);
+  return report;
+}
+
+static const char* kindName(TraceBuffer::Kind kind) {
+  switch(kind) {
+    case TraceBuffer::Mqtt: return "MQTT";
+    case TraceBuffer::Http: return "HTTP";
+    case TraceBuffer::IRFrame: return "Remote";
+    case TraceBuffer::OnLed: return "On-led";
+    default: return "?";
+  }
+}
+
+static void printReport(const Report& report) {
+  printf("Sent:");
+  for(size_t i = 0; i < report.sent.size();) {
+    size_t repeats = 0;
+    while(i + 1 + repeats < report.sent.size() && report.sent[i + 1 + repeats] == NEC_REPEAT) repeats++;
+    printf(repeats ? " %s+%u" : " %s", report.sent[i] == NEC_REPEAT ? "Repeat" : keyName(report.sent[i]), (unsigned)repeats);
+    i += 1 + repeats;
+  }
+  printf("\n%10s %-7s %6s %10s  %s\n", "at (ms)", "input", "status", "settled ms", "diverged");
+  for(const EventReport& event : report.events) {
+    printf("%10u %-7s %6d %10d  %s\n", (unsigned)event.at, kindName(event.kind), event.status,
+      (int)event.settledMs, event.divergence.c_str());
+  }
+  printf("Diverged at the end: %s\n", report.divergence.empty() ? "nothing" : report.divergence.c_str());
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+/** The same trace on a fresh controller gives the same report */
+void test_replay_is_deterministic() {
+  Report first = replay(0);
+  printReport(first);
+  Report second = replay(1);
+  TEST_ASSERT_TRUE(first.sent == second.sent);
+  TEST_ASSERT_TRUE(first.events == second.events);
+  TEST_ASSERT_TRUE(first.divergence == second.divergence);
+}
+
+/** Every input gets off the air and the amp ends where we think it is */
+void test_sample_replays_clean() {
+  Report report = replay(2);
+  TEST_ASSERT_FALSE(report.sent.empty());
+  for(const EventReport& event : report.events) {
+    TEST_ASSERT_NOT_EQUAL(-1, event.settledMs);
+    TEST_ASSERT_NOT_EQUAL(400, event.status);
+  }
+  TEST_ASSERT_EQUAL_STRING("", report.divergence.c_str());
+}
+
+/** A trace with a record at each of ats, millis() at the download */
+static std::string traceOf(uint32_t now, std::initializer_list<uint32_t> ats) {
+  TraceBuffer::FileHeader header;
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.now = now;
+  header.dropped = 0;
+  std::string data((const char*)&header, sizeof(header));
+  for(uint32_t at : ats) {
+    const char record[TRACE_RECORD_HEADER] = { (char)at, (char)(at >> 8), (char)(at >> 16), (char)(at >> 24),
+      (char)(TraceBuffer::OnLed << 4), 1 };
+    data.append(record, sizeof(record));
+    data.push_back(1);
+  }
+  return data;
+}
+
+/** Across a wrap of millis() the records stay as far apart as they were,
+ *  one older than a whole turn of it refuses the trace */
+void test_wrapped_millis() {
+  std::vector<TraceEvent> wrapped;
+  TEST_ASSERT_TRUE(parseTrace(traceOf(0x1000, { 0xFFFFF000, 0xFFFFFF00, 0x500 }), wrapped));
+  TEST_ASSERT_EQUAL(3, wrapped.size());
+  TEST_ASSERT_EQUAL_UINT32(0, wrapped[0].at);
+  TEST_ASSERT_EQUAL_UINT32(0xF00, wrapped[1].at);
+  TEST_ASSERT_EQUAL_UINT32(0x1500, wrapped[2].at);
+
+  // 50 days, then one day before the download
+  uint32_t now = 1000;
+  uint32_t day = 24 * 3600 * 1000;
+  std::vector<TraceEvent> tooLong;
+  TEST_ASSERT_FALSE(parseTrace(traceOf(now, { now - 50 * day, now - day }), tooLong));
+}
+
+int main() {
+  EEPROM.begin(512);
+  scenes.begin();
+  bindings.begin();
+  history.begin();
+  std::string path = tracePath();
+  if(!loadTrace(path.c_str(), events)) {
+    printf("Can't read trace %s\n", path.c_str());
+    return 1;
+  }
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_is_deterministic);
+  RUN_TEST(test_sample_replays_clean);
+  RUN_TEST(test_wrapped_millis);
+  return UNITY_END();
+}